@@ -2,4 +2,24 @@
 //  Use this file to import your target's public headers that you would like to expose to Swift.
 //
 
-#import <KiiSDK/KiiSDK-Bridging-Header.h>
\ No newline at end of file
+#import <KiiSDK/KiiSDK-Bridging-Header.h>
+#import "LSMemberTable.h"
+#import "LSGeoDistance.h"
+#import "LSSpatialIndex.h"
+#import "LSGeoCell.h"
+#import "LSClause.h"
+#import "LSObjectPatch.h"
+#import "LSAnnotationDiff.h"
+#import "LSClusterIndex.h"
+#import "LSTrajectoryStore.h"
+#import "LSSimplifier.h"
+#import "LSKalmanBank.h"
+#import "LSMQTTCodec.h"
+#import <KiiSDK/KiiRequest.h>
+#import "LSLocationFrame.h"
+#import "LSFrameBatcher.h"
+#import "LSRequestScheduler.h"
+#import <KiiSDK/KiiUtilities.h>
+#import "LSQueryPage.h"
+#import "LSDeflater.h"
+#import "LSResponseCache.h"
@@ -17,7 +17,27 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
     func application(application: UIApplication, didFinishLaunchingWithOptions launchOptions: [NSObject: AnyObject]?) -> Bool {
         // Override point for customization after application launch.
         
-        Kii.beginWithID("193e78e5", andKey: "e55d546c34bae1d3a1348c01fc94a344", andSite: KiiSite.US)
+        let appID = "193e78e5"
+        let appKey = "e55d546c34bae1d3a1348c01fc94a344"
+        
+        Kii.beginWithID(appID, andKey: appKey, andSite: KiiSite.US)
+        
+        // SDK requests run in priority order from here on
+        RequestScheduler.install()
+        
+        // Requests sent outside the SDK go to the same app
+        Transport.shared.app = Transport.App(id: appID, key: appKey, baseURL: NSURL(string: "https://api.kii.com/api")!)
+        
+        // gzip needs no setup on the server. Kii Cloud cannot read bodies
+        // deflated with the location dictionary, so that is left unused
+        Transport.shared.compressor = BodyCompressor()
+        
+        // Object reads of unchanged objects are answered with 304; bucket
+        // queries are POSTs and always fetch
+        Transport.shared.cache = ResponseCache()
+        
+        // Local times are stamped in server time, like _modified
+        Transport.shared.clock = ServerClock.shared
         
         return true
     }
@@ -0,0 +1,164 @@
+//
+//  BatchWriter.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-17.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// Commits the changed fields of many objects together and reports the
+// result of each like KiiACLSaveBlock: the objects saved, the ones that
+// failed and the first error.
+//
+// Kii Cloud has no multi-object write, so every object is a partial update
+// of its own (POST with X-HTTP-Method-Override: PATCH and only the dirty
+// fields). They are all handed to the transport at once, as bulk requests
+// behind any map query, and share its connections rather than each paying
+// for one. Objects not created yet, or
+// every object when the transport has no app, are saved through the SDK.
+class BatchWriter: NSObject {
+
+    typealias SaveBlock = (succeeded: [KiiObject], failed: [KiiObject], error: NSError?) -> Void
+
+    static let errorDomain = "LocationSharing.BatchWriter"
+
+    let transport: Transport
+
+    private var patches = [ObjectPatch]()
+
+    // SDK saves are queued from here, a full bulk queue makes the scheduler
+    // wait and that must not be the main queue
+    private static let submitQueue = dispatch_queue_create("LocationSharing.BatchWriter", DISPATCH_QUEUE_SERIAL)
+
+    init(transport: Transport = Transport.shared) {
+        self.transport = transport
+        super.init()
+    }
+
+    var count: Int {
+        return patches.count
+    }
+
+    func add(patch: ObjectPatch) {
+        patches.append(patch)
+    }
+
+    // Sends everything added so far; the block is called on the main queue
+    func commit(block: SaveBlock) {
+
+        let patches = self.patches
+        self.patches.removeAll()
+
+        var succeeded = [KiiObject]()
+        var failed = [KiiObject]()
+        var firstError: NSError?
+
+        let group = dispatch_group_create()
+
+        let finish = { (saved: [KiiObject], notSaved: [KiiObject], error: NSError?) -> Void in
+            succeeded.appendContentsOf(saved)
+            failed.appendContentsOf(notSaved)
+            if firstError == nil {
+                firstError = error
+            }
+        }
+
+        var single = [ObjectPatch]()
+
+        for patch in patches {
+
+            if !patch.isDirty {
+                succeeded.append(patch.object)
+                continue
+            }
+
+            // Objects not created yet have no path and go through the SDK
+            guard let path = BatchWriter.pathOf(patch.object), request = transport.request(path, method: "POST", contentType: "application/json") else {
+                single.append(patch)
+                continue
+            }
+
+            let encoded = patch.encode()
+
+            request.HTTPBody = encoded.body
+            request.setValue("PATCH", forHTTPHeaderField: "X-HTTP-Method-Override")
+
+            dispatch_group_enter(group)
+
+            transport.send(request, priority: .Bulk) { (data : NSData?, response : NSHTTPURLResponse?, error : NSError?) -> Void in
+
+                dispatch_async(dispatch_get_main_queue()) {
+
+                    if let status = response?.statusCode where status >= 200 && status < 300 {
+                        finish([patch.object], [], nil)
+                    } else {
+                        // Not applied, the fields go out with the next save
+                        patch.restore(encoded.sent)
+                        finish([], [patch.object], error ?? NSError(domain: BatchWriter.errorDomain, code: response?.statusCode ?? 0, userInfo: nil))
+                    }
+
+                    dispatch_group_leave(group)
+                }
+            }
+        }
+
+        saveEach(single, group: group, finish: finish)
+
+        dispatch_group_notify(group, dispatch_get_main_queue()) {
+            block(succeeded: succeeded, failed: failed, error: firstError)
+        }
+    }
+
+    private func saveEach(patches: [ObjectPatch], group: dispatch_group_t, finish: ([KiiObject], [KiiObject], NSError?) -> Void) {
+
+        if patches.isEmpty {
+            return
+        }
+
+        // Entered here so the commit block waits for every save
+        for _ in patches {
+            dispatch_group_enter(group)
+        }
+
+        dispatch_async(BatchWriter.submitQueue) {
+            for patch in patches {
+                BatchWriter.save(patch, group: group, finish: finish)
+            }
+        }
+    }
+
+    private class func save(patch: ObjectPatch, group: dispatch_group_t, finish: ([KiiObject], [KiiObject], NSError?) -> Void) {
+
+        // The SDK creates the object when it does not exist yet
+        let save = { (object : KiiObject?, error : NSError?) -> Void in
+            if error != nil {
+                finish([], [patch.object], error)
+            } else {
+                finish([patch.object], [], nil)
+            }
+            dispatch_group_leave(group)
+        }
+
+        // Saves wait behind any interactive SDK request
+        RequestScheduler.shared.with(.Bulk) {
+            if patch.object.objectURI == nil {
+                LSObjectPatchMarkClean(patch.ref)
+                patch.object.saveAllFields(true, withBlock: save)
+            } else {
+                patch.save({ (error : NSError?) -> Void in save(patch.object, error) })
+            }
+        }
+    }
+
+    // "kiicloud://groups/ID/buckets/locations/objects/ID" without the scheme
+    class func pathOf(object: KiiObject) -> String? {
+
+        guard let uri = object.objectURI, range = uri.rangeOfString("kiicloud://") else {
+            return nil
+        }
+
+        return uri.substringFromIndex(range.endIndex)
+    }
+}
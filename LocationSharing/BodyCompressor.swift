@@ -0,0 +1,83 @@
+//
+//  BodyCompressor.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-05.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// Compresses request bodies for Transport, gzip by default or deflate primed
+// with a dictionary for servers that hold the same dictionary.
+//
+// Kii Cloud does not know any dictionary: a body deflated with one can only
+// be read by a server, or a proxy in front of Kii Cloud, that loads the same
+// bytes when the stream asks for them. Against any other host use gzip.
+class BodyCompressor: NSObject {
+
+    // The Content-Encoding of compressed bodies
+    let encoding: String
+
+    // Shorter bodies are sent as they are
+    let minimumLength: Int
+
+    private let ref: LSDeflaterRef
+    private let lock = NSLock()
+
+    init?(dictionary: NSData? = nil, level: Int32 = 6, minimumLength: Int = 64) {
+
+        ref = LSDeflaterCreate(level, dictionary?.bytes ?? nil, dictionary?.length ?? 0)
+
+        if ref == nil {
+            return nil
+        }
+
+        self.encoding = dictionary == nil ? "gzip" : "deflate"
+        self.minimumLength = minimumLength
+
+        super.init()
+    }
+
+    deinit {
+        LSDeflaterDestroy(ref)
+    }
+
+    // Primed with the built in dictionary for location objects and queries.
+    // Only for a receiver holding LSDeflaterLocationDictionary, see above.
+    class func locationObjects() -> BodyCompressor? {
+
+        var length = 0
+        let bytes = LSDeflaterLocationDictionary(&length)
+
+        return BodyCompressor(dictionary: NSData(bytes: bytes, length: length))
+    }
+
+    // The Adler-32 of the dictionary, which the receiver finds in the header
+    var dictionaryID: UInt32 {
+        return LSDeflaterDictionaryID(ref)
+    }
+
+    // nil when the body is too short or would not get any shorter
+    func compress(body: NSData) -> NSData? {
+
+        if body.length < minimumLength {
+            return nil
+        }
+
+        lock.lock()
+        defer { lock.unlock() }
+
+        let buffer = NSMutableData(length: LSDeflaterBound(ref, body.length))!
+
+        let length = LSDeflaterCompress(ref, body.bytes, body.length, buffer.mutableBytes, buffer.length)
+
+        if length == 0 || length >= body.length {
+            return nil
+        }
+
+        buffer.length = length
+
+        return buffer
+    }
+}
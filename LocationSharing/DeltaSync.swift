@@ -0,0 +1,130 @@
+//
+//  DeltaSync.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-12.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// Keeps the member table current by fetching only the objects modified since
+// the last sync. The high-water mark is the largest _modified seen; the query
+// uses >= so objects saved in the same millisecond as the mark are not lost,
+// at the cost of fetching those few again.
+//
+// A clause narrows the sync to part of the bucket, e.g. a map tile. The same
+// clause is compiled into a LocalClause, so what the query holds can be
+// asked of the member table again without a round trip.
+//
+// Pages come through QueryPageCursor and are read straight into the table,
+// so no KiiObject is built for a result. They are fetched on a background
+// queue and loaded on the main queue, where the table is used.
+//
+// Deleted objects are not seen, call reset() to do a full sync.
+class DeltaSync: NSObject {
+
+    // The bucket, e.g. "groups/{groupID}/buckets/{name}"
+    let path: String
+
+    let members: MemberTable
+
+    // In the JSON form of the query REST API; objects outside it are never
+    // fetched, nil for the whole bucket
+    let clause: [String: AnyObject]?
+
+    let transport: Transport
+
+    // Milliseconds, 0 before the first sync
+    private(set) var highWaterMark: Int64 = 0
+
+    private(set) var syncing = false
+
+    // Completions of the calls made while a sync was running
+    private var waiting = [(rows: [Int], error: NSError?) -> Void]()
+
+    private lazy var local: LocalClause? = LocalClause(dictionary: self.clause ?? ["type": "all"])
+
+    private static let fetchQueue = dispatch_queue_create("LocationSharing.DeltaSync", DISPATCH_QUEUE_CONCURRENT)
+
+    init(path: String, members: MemberTable, clause: [String: AnyObject]? = nil, transport: Transport = Transport.shared) {
+        self.path = path
+        self.members = members
+        self.clause = clause
+        self.transport = transport
+        super.init()
+    }
+
+    func reset() {
+        highWaterMark = 0
+    }
+
+    // The rows of the table the clause matches, as the query would return
+    // them from the members loaded so far; ascending
+    func cachedRows() -> [Int] {
+        return local?.rows(members) ?? []
+    }
+
+    func query() -> [String: AnyObject] {
+
+        var clauses = [[String: AnyObject]]()
+
+        if let clause = clause {
+            clauses.append(clause)
+        }
+
+        if highWaterMark > 0 {
+            clauses.append(["type": "range", "field": "_modified", "lowerLimit": NSNumber(longLong: highWaterMark), "lowerIncluded": true])
+        }
+
+        if clauses.count > 1 {
+            return ["type": "and", "clauses": clauses]
+        }
+
+        return clauses.first ?? ["type": "all"]
+    }
+
+    // Merges every changed object into the table and passes the rows it touched.
+    // A call made while a sync is running joins it: its completion is called
+    // with the result of that sync, and the next call picks up the rest.
+    // The queries go out with the priority and deadline, see Transport.
+    func sync(priority: RequestScheduler.Priority = .Interactive, deadline: NSTimeInterval? = nil, completion: (rows: [Int], error: NSError?) -> Void) {
+
+        if syncing {
+            waiting.append(completion)
+            return
+        }
+
+        syncing = true
+
+        // Ascending, so the mark can move forward after every page
+        let cursor = QueryPageCursor(path: path, clause: query(), orderBy: "_modified", transport: transport, priority: priority, deadline: deadline)
+
+        dispatch_async(DeltaSync.fetchQueue) {
+
+            var rows = [Int]()
+
+            while let page = cursor.next() {
+                dispatch_sync(dispatch_get_main_queue()) {
+                    rows.appendContentsOf(self.members.load(page))
+                    self.highWaterMark = max(self.highWaterMark, LSQueryPageMaxModified(page.ref))
+                }
+            }
+
+            let error = cursor.error
+
+            dispatch_async(dispatch_get_main_queue()) {
+
+                let joined = self.waiting
+                self.waiting.removeAll()
+                self.syncing = false
+
+                completion(rows: rows, error: error)
+
+                for completion in joined {
+                    completion(rows: rows, error: error)
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,61 @@
+//
+//  GeoCell.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-08.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import MapKit
+import UIKit
+
+class GeoCell: NSObject {
+
+    // Field holding the geohash next to "location" in the locations bucket
+    static let fieldName = "geohash"
+
+    // 7 characters is a cell of about 150 m x 150 m
+    static let precision: UInt32 = 7
+
+    class func geohash(latitude: CLLocationDegrees, longitude: CLLocationDegrees, precision: UInt32 = GeoCell.precision) -> String {
+        return geohashString(LSGeohashEncode(latitude, longitude, precision), precision: precision)
+    }
+
+    class func geohashString(code: UInt64, precision: UInt32) -> String {
+
+        var buffer = [CChar](count: Int(precision) + 1, repeatedValue: 0)
+
+        LSGeohashToString(code, precision, &buffer)
+
+        return String.fromCString(buffer)!
+    }
+
+    // The cell of the point and its 8 neighbors
+    class func neighborhood(latitude: CLLocationDegrees, longitude: CLLocationDegrees, precision: UInt32 = GeoCell.precision) -> [String] {
+
+        let code = LSGeohashEncode(latitude, longitude, precision)
+
+        var neighbors = [UInt64](count: 8, repeatedValue: 0)
+
+        LSGeohashNeighbors(code, precision, &neighbors)
+
+        var cells = [geohashString(code, precision: precision)]
+
+        for neighbor in neighbors {
+            let cell = geohashString(neighbor, precision: precision)
+            if !cells.contains(cell) {
+                cells.append(cell)
+            }
+        }
+
+        return cells
+    }
+
+    // Prefix query for the objects around a point, cheaper on the server than geoDistance
+    class func nearbyClause(latitude: CLLocationDegrees, longitude: CLLocationDegrees, precision: UInt32 = GeoCell.precision) -> KiiClause {
+
+        let clauses = neighborhood(latitude, longitude: longitude, precision: precision).map { KiiClause.startsWith(fieldName, value: $0) }
+
+        return KiiClause.orClauses(clauses)!
+    }
+}
@@ -0,0 +1,114 @@
+//
+//  LSAnnotationDiff.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-18.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSAnnotationDiff.h"
+
+#include <algorithm>
+
+// seen holds the generation an index was last found in, 0 when it is not on
+// the map. Anything on the map from the previous update that the table no
+// longer has is left with an older generation and becomes a delete.
+void LSAnnotationDiff::update(const LSMemberTable &table)
+{
+    inserts.clear();
+    deletes.clear();
+    moves.clear();
+
+    if (++generation == 0) {
+        // Wrapped around: clear the old marks so they cannot match.
+        std::fill(seen.begin(), seen.end(), 0);
+        for (uint32_t user : shown) {
+            seen[user] = 1;
+        }
+        generation = 2;
+    }
+    uint32_t previous = generation - 1;
+
+    if (seen.size() < table.userCount()) {
+        latitudes.resize(table.userCount());
+        longitudes.resize(table.userCount());
+        seen.resize(table.userCount(), 0);
+    }
+
+    for (size_t row = 0; row < table.size(); row++) {
+        uint32_t user = table.userIndex[row];
+        double lat = table.latitude[row];
+        double lon = table.longitude[row];
+        if (seen[user] == 0) {
+            inserts.push_back(user);
+        } else if (latitudes[user] != lat || longitudes[user] != lon) {
+            moves.push_back(user);
+        }
+        latitudes[user] = lat;
+        longitudes[user] = lon;
+        seen[user] = generation;
+    }
+
+    for (uint32_t user : shown) {
+        if (seen[user] == previous) {
+            deletes.push_back(user);
+            seen[user] = 0;
+        }
+    }
+
+    // Everything in the table is on the map now.
+    shown.clear();
+    shown.reserve(table.size());
+    for (size_t row = 0; row < table.size(); row++) {
+        shown.push_back(table.userIndex[row]);
+    }
+}
+
+void LSAnnotationDiff::reset()
+{
+    std::fill(seen.begin(), seen.end(), 0);
+    shown.clear();
+    inserts.clear();
+    deletes.clear();
+    moves.clear();
+}
+
+#pragma mark - C interface
+
+LSAnnotationDiffRef LSAnnotationDiffCreate(void)
+{
+    return new LSAnnotationDiff();
+}
+
+void LSAnnotationDiffDestroy(LSAnnotationDiffRef diff)
+{
+    delete diff;
+}
+
+void LSAnnotationDiffUpdate(LSAnnotationDiffRef diff, LSMemberTableRef table)
+{
+    diff->update(*table);
+}
+
+void LSAnnotationDiffReset(LSAnnotationDiffRef diff)
+{
+    diff->reset();
+}
+
+const uint32_t *LSAnnotationDiffInserts(LSAnnotationDiffRef diff, size_t *count)
+{
+    *count = diff->inserts.size();
+    return diff->inserts.data();
+}
+
+const uint32_t *LSAnnotationDiffDeletes(LSAnnotationDiffRef diff, size_t *count)
+{
+    *count = diff->deletes.size();
+    return diff->deletes.data();
+}
+
+const uint32_t *LSAnnotationDiffMoves(LSAnnotationDiffRef diff, size_t *count)
+{
+    *count = diff->moves.size();
+    return diff->moves.data();
+}
@@ -0,0 +1,69 @@
+//
+//  LSAnnotationDiff.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-18.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSAnnotationDiff_h
+#define LSAnnotationDiff_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "LSMemberTable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Tells which map annotations to add, remove or move so the map matches the
+// member table, instead of removing and adding them all.
+//
+// Annotations are keyed by member table user index. Update joins the table
+// against the members on the map in one pass over each, records the changes
+// and takes the table as what is on the map now. The change lists hold user
+// indices and stay valid until the next update.
+
+typedef struct LSAnnotationDiff *LSAnnotationDiffRef;
+
+LSAnnotationDiffRef LSAnnotationDiffCreate(void);
+void LSAnnotationDiffDestroy(LSAnnotationDiffRef diff);
+
+void LSAnnotationDiffUpdate(LSAnnotationDiffRef diff, LSMemberTableRef table);
+// Forgets the map, so the next update inserts every member.
+void LSAnnotationDiffReset(LSAnnotationDiffRef diff);
+
+const uint32_t *LSAnnotationDiffInserts(LSAnnotationDiffRef diff, size_t *count);
+const uint32_t *LSAnnotationDiffDeletes(LSAnnotationDiffRef diff, size_t *count);
+// Members still on the map whose coordinate changed.
+const uint32_t *LSAnnotationDiffMoves(LSAnnotationDiffRef diff, size_t *count);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+struct LSAnnotationDiff {
+    std::vector<uint32_t> inserts;
+    std::vector<uint32_t> deletes;
+    std::vector<uint32_t> moves;
+
+    void update(const LSMemberTable &table);
+    void reset();
+
+private:
+    // Indexed by user index. User indices are dense, so the join needs no
+    // hashing beyond the index itself.
+    std::vector<double> latitudes;
+    std::vector<double> longitudes;
+    std::vector<uint32_t> seen;
+    // Members on the map, in no particular order.
+    std::vector<uint32_t> shown;
+    uint32_t generation = 0;
+};
+
+#endif
+
+#endif /* LSAnnotationDiff_h */
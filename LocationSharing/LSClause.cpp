@@ -0,0 +1,770 @@
+//
+//  LSClause.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-10.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSClause.h"
+#include "LSGeoDistance.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+namespace {
+
+#pragma mark - JSON
+
+struct Value {
+    enum Type { Null, Boolean, Number, String, Array, Object };
+
+    Type type = Null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<Value> items;
+    std::vector<std::pair<std::string, Value>> members;
+
+    const Value *find(const char *key) const
+    {
+        for (const auto &member : members) {
+            if (member.first == key) {
+                return &member.second;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// Just enough JSON for query dictionaries. Clauses nest, so the depth is
+// capped to keep a hostile string from exhausting the stack.
+class Parser {
+public:
+    Parser(const char *json, size_t length) : cursor(json), end(json + length) {}
+
+    bool parse(Value &value)
+    {
+        return parseValue(value, 0) && (skipSpace(), cursor == end);
+    }
+
+private:
+    static const int kMaxDepth = 64;
+
+    const char *cursor;
+    const char *end;
+
+    void skipSpace()
+    {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r')) {
+            cursor++;
+        }
+    }
+
+    bool consume(char c)
+    {
+        skipSpace();
+        if (cursor < end && *cursor == c) {
+            cursor++;
+            return true;
+        }
+        return false;
+    }
+
+    bool literal(const char *word)
+    {
+        size_t length = std::strlen(word);
+        if (static_cast<size_t>(end - cursor) < length || std::memcmp(cursor, word, length) != 0) {
+            return false;
+        }
+        cursor += length;
+        return true;
+    }
+
+    bool parseValue(Value &value, int depth)
+    {
+        if (depth > kMaxDepth) {
+            return false;
+        }
+        skipSpace();
+        if (cursor == end) {
+            return false;
+        }
+        switch (*cursor) {
+            case '{':
+                return parseObject(value, depth);
+            case '[':
+                return parseArray(value, depth);
+            case '"':
+                value.type = Value::String;
+                return parseString(value.string);
+            case 't':
+                value.type = Value::Boolean;
+                value.boolean = true;
+                return literal("true");
+            case 'f':
+                value.type = Value::Boolean;
+                return literal("false");
+            case 'n':
+                return literal("null");
+            default:
+                return parseNumber(value);
+        }
+    }
+
+    bool parseObject(Value &value, int depth)
+    {
+        value.type = Value::Object;
+        cursor++;
+        if (consume('}')) {
+            return true;
+        }
+        do {
+            std::pair<std::string, Value> member;
+            skipSpace();
+            if (!parseString(member.first) || !consume(':') || !parseValue(member.second, depth + 1)) {
+                return false;
+            }
+            value.members.push_back(std::move(member));
+        } while (consume(','));
+        return consume('}');
+    }
+
+    bool parseArray(Value &value, int depth)
+    {
+        value.type = Value::Array;
+        cursor++;
+        if (consume(']')) {
+            return true;
+        }
+        do {
+            Value item;
+            if (!parseValue(item, depth + 1)) {
+                return false;
+            }
+            value.items.push_back(std::move(item));
+        } while (consume(','));
+        return consume(']');
+    }
+
+    bool parseNumber(Value &value)
+    {
+        // strtod needs a terminated buffer; numbers are short.
+        char buffer[64];
+        size_t length = 0;
+        while (cursor + length < end && length < sizeof(buffer) - 1 && std::strchr("+-.0123456789eE", cursor[length])) {
+            length++;
+        }
+        if (length == 0) {
+            return false;
+        }
+        std::memcpy(buffer, cursor, length);
+        buffer[length] = '\0';
+        char *stop = nullptr;
+        value.type = Value::Number;
+        value.number = std::strtod(buffer, &stop);
+        cursor += length;
+        return stop == buffer + length;
+    }
+
+    bool parseHex(uint32_t &code)
+    {
+        if (end - cursor < 4) {
+            return false;
+        }
+        code = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = *cursor++;
+            code <<= 4;
+            if (c >= '0' && c <= '9') {
+                code |= static_cast<uint32_t>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                code |= static_cast<uint32_t>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                code |= static_cast<uint32_t>(c - 'A' + 10);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void appendUTF8(std::string &out, uint32_t code)
+    {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    bool parseString(std::string &out)
+    {
+        if (cursor == end || *cursor != '"') {
+            return false;
+        }
+        cursor++;
+        while (cursor < end) {
+            char c = *cursor++;
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (cursor == end) {
+                return false;
+            }
+            c = *cursor++;
+            switch (c) {
+                case '"': case '\\': case '/': out += c; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    uint32_t code;
+                    if (!parseHex(code)) {
+                        return false;
+                    }
+                    if (code >= 0xD800 && code < 0xDC00) {
+                        uint32_t low;
+                        if (!literal("\\u") || !parseHex(low) || low < 0xDC00 || low >= 0xE000) {
+                            return false;
+                        }
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUTF8(out, code);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return false;
+    }
+};
+
+#pragma mark - Compiler
+
+LSClause::Column columnFor(const Value *field)
+{
+    if (!field || field->type != Value::String) {
+        return LSClause::ColumnNone;
+    }
+    if (field->string == "userID") {
+        return LSClause::ColumnUserID;
+    }
+    if (field->string == "location") {
+        return LSClause::ColumnLocation;
+    }
+    if (field->string == "_modified") {
+        return LSClause::ColumnModified;
+    }
+    return LSClause::ColumnNone;
+}
+
+bool readPoint(const Value *point, double &latitude, double &longitude)
+{
+    if (!point) {
+        return false;
+    }
+    const Value *lat = point->find("lat");
+    const Value *lon = point->find("lon");
+    if (!lat || !lon || lat->type != Value::Number || lon->type != Value::Number) {
+        return false;
+    }
+    latitude = lat->number;
+    longitude = lon->number;
+    return true;
+}
+
+class Compiler {
+public:
+    explicit Compiler(LSClause &clause) : clause(clause) {}
+
+    bool compile(const Value &value, int depth = 0)
+    {
+        if (value.type != Value::Object || depth > 64) {
+            return false;
+        }
+        const Value *type = value.find("type");
+        if (!type || type->type != Value::String) {
+            return false;
+        }
+
+        size_t position = clause.program.size();
+        LSClause::Instruction instruction = { LSClause::OpFalse, columnFor(value.find("field")), 0, 1, 0, 0 };
+        clause.program.push_back(instruction);
+
+        bool compiled = true;
+        const std::string &name = type->string;
+        if (name == "all") {
+            clause.program[position].op = LSClause::OpTrue;
+        } else if (name == "and" || name == "or") {
+            compiled = compileChildren(position, name == "and" ? LSClause::OpAnd : LSClause::OpOr, value.find("clauses"), depth);
+        } else if (name == "not") {
+            const Value *child = value.find("clause");
+            clause.program[position].op = LSClause::OpNot;
+            compiled = child && compile(*child, depth + 1);
+        } else if (name == "eq") {
+            compiled = compileEquals(position, value.find("value"));
+        } else if (name == "range") {
+            compiled = compileRange(position, value);
+        } else if (name == "in") {
+            compiled = compileIn(position, value.find("values"));
+        } else if (name == "prefix") {
+            compiled = compilePrefix(position, value.find("prefix"));
+        } else if (name == "hasField") {
+            if (clause.program[position].column != LSClause::ColumnNone) {
+                clause.program[position].op = LSClause::OpHasField;
+            }
+        } else if (name == "geobox") {
+            compiled = compileGeoBox(position, value.find("box"));
+        } else if (name == "geodistance") {
+            compiled = compileGeoDistance(position, value);
+        } else {
+            compiled = false;
+        }
+
+        clause.program[position].skip = static_cast<uint32_t>(clause.program.size() - position);
+        return compiled;
+    }
+
+private:
+    LSClause &clause;
+
+    LSClause::Instruction &at(size_t position) { return clause.program[position]; }
+
+    uint32_t addNumber(double number)
+    {
+        clause.numbers.push_back(number);
+        return static_cast<uint32_t>(clause.numbers.size() - 1);
+    }
+
+    uint32_t addString(const std::string &string)
+    {
+        clause.strings.push_back(string);
+        return static_cast<uint32_t>(clause.strings.size() - 1);
+    }
+
+    bool compileChildren(size_t position, LSClause::Op op, const Value *children, int depth)
+    {
+        if (!children || children->type != Value::Array) {
+            return false;
+        }
+        at(position).op = op;
+        at(position).count = static_cast<uint32_t>(children->items.size());
+        for (const Value &child : children->items) {
+            if (!compile(child, depth + 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // A value of the wrong type for the column compiles to false, like a
+    // server side comparison that finds nothing.
+    bool compileEquals(size_t position, const Value *value)
+    {
+        if (!value) {
+            return false;
+        }
+        LSClause::Instruction &instruction = at(position);
+        if (instruction.column == LSClause::ColumnUserID && value->type == Value::String) {
+            instruction.op = LSClause::OpStringEquals;
+            instruction.operand = addString(value->string);
+        } else if (instruction.column == LSClause::ColumnModified && value->type == Value::Number) {
+            instruction.op = LSClause::OpNumberRange;
+            instruction.flags = LSClause::LowerSet | LSClause::LowerIncluded | LSClause::UpperSet | LSClause::UpperIncluded;
+            instruction.operand = addNumber(value->number);
+            addNumber(value->number);
+        }
+        return true;
+    }
+
+    bool compileRange(size_t position, const Value &value)
+    {
+        const Value *lower = value.find("lowerLimit");
+        const Value *upper = value.find("upperLimit");
+        const Value *lowerIncluded = value.find("lowerIncluded");
+        const Value *upperIncluded = value.find("upperIncluded");
+        if (!lower && !upper) {
+            return false;
+        }
+
+        LSClause::Instruction &instruction = at(position);
+        Value::Type type = instruction.column == LSClause::ColumnUserID ? Value::String : Value::Number;
+        if (instruction.column == LSClause::ColumnLocation || instruction.column == LSClause::ColumnNone
+            || (lower && lower->type != type) || (upper && upper->type != type)) {
+            return true;
+        }
+
+        uint16_t flags = 0;
+        if (lower) {
+            flags |= LSClause::LowerSet;
+            if (!lowerIncluded || lowerIncluded->boolean) {
+                flags |= LSClause::LowerIncluded;
+            }
+        }
+        if (upper) {
+            flags |= LSClause::UpperSet;
+            if (!upperIncluded || upperIncluded->boolean) {
+                flags |= LSClause::UpperIncluded;
+            }
+        }
+        instruction.flags = flags;
+
+        if (type == Value::String) {
+            instruction.op = LSClause::OpStringRange;
+            instruction.operand = addString(lower ? lower->string : std::string());
+            addString(upper ? upper->string : std::string());
+        } else {
+            instruction.op = LSClause::OpNumberRange;
+            instruction.operand = addNumber(lower ? lower->number : 0);
+            addNumber(upper ? upper->number : 0);
+        }
+        return true;
+    }
+
+    bool compileIn(size_t position, const Value *values)
+    {
+        if (!values || values->type != Value::Array) {
+            return false;
+        }
+        LSClause::Instruction &instruction = at(position);
+        if (instruction.column == LSClause::ColumnUserID) {
+            instruction.op = LSClause::OpStringIn;
+            instruction.operand = static_cast<uint32_t>(clause.strings.size());
+            for (const Value &item : values->items) {
+                if (item.type == Value::String) {
+                    addString(item.string);
+                }
+            }
+            instruction.count = static_cast<uint32_t>(clause.strings.size() - instruction.operand);
+        } else if (instruction.column == LSClause::ColumnModified) {
+            // Sorted so rows can be looked up with a binary search.
+            std::vector<double> sorted;
+            for (const Value &item : values->items) {
+                if (item.type == Value::Number) {
+                    sorted.push_back(item.number);
+                }
+            }
+            std::sort(sorted.begin(), sorted.end());
+            instruction.op = LSClause::OpNumberIn;
+            instruction.operand = static_cast<uint32_t>(clause.numbers.size());
+            instruction.count = static_cast<uint32_t>(sorted.size());
+            clause.numbers.insert(clause.numbers.end(), sorted.begin(), sorted.end());
+        }
+        return true;
+    }
+
+    bool compilePrefix(size_t position, const Value *prefix)
+    {
+        if (!prefix || prefix->type != Value::String) {
+            return false;
+        }
+        LSClause::Instruction &instruction = at(position);
+        if (instruction.column == LSClause::ColumnUserID) {
+            instruction.op = LSClause::OpStringPrefix;
+            instruction.operand = addString(prefix->string);
+        }
+        return true;
+    }
+
+    bool compileGeoBox(size_t position, const Value *box)
+    {
+        double northEastLatitude, northEastLongitude, southWestLatitude, southWestLongitude;
+        if (!box || !readPoint(box->find("ne"), northEastLatitude, northEastLongitude)
+            || !readPoint(box->find("sw"), southWestLatitude, southWestLongitude)) {
+            return false;
+        }
+        LSClause::Instruction &instruction = at(position);
+        if (instruction.column == LSClause::ColumnLocation) {
+            instruction.op = LSClause::OpGeoBox;
+            instruction.operand = addNumber(northEastLatitude);
+            addNumber(northEastLongitude);
+            addNumber(southWestLatitude);
+            addNumber(southWestLongitude);
+        }
+        return true;
+    }
+
+    bool compileGeoDistance(size_t position, const Value &value)
+    {
+        double latitude, longitude;
+        const Value *radius = value.find("radius");
+        if (!readPoint(value.find("center"), latitude, longitude) || !radius || radius->type != Value::Number) {
+            return false;
+        }
+        LSClause::Instruction &instruction = at(position);
+        if (instruction.column == LSClause::ColumnLocation) {
+            instruction.op = LSClause::OpGeoDistance;
+            instruction.operand = addNumber(latitude);
+            addNumber(longitude);
+            addNumber(radius->number);
+        }
+        return true;
+    }
+};
+
+template <class T>
+bool inRange(const T &value, const T &lower, const T &upper, uint16_t flags)
+{
+    if (flags & LSClause::LowerSet) {
+        if ((flags & LSClause::LowerIncluded) ? value < lower : !(lower < value)) {
+            return false;
+        }
+    }
+    if (flags & LSClause::UpperSet) {
+        if ((flags & LSClause::UpperIncluded) ? upper < value : !(value < upper)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+#pragma mark - Compile
+
+bool LSClause::compile(const char *json, size_t length)
+{
+    program.clear();
+    numbers.clear();
+    strings.clear();
+
+    Value root;
+    if (!Parser(json, length).parse(root)) {
+        return false;
+    }
+
+    // A whole query carries its clause in bucketQuery.
+    const Value *clause = &root;
+    if (const Value *query = root.find("bucketQuery")) {
+        clause = query->find("clause");
+        if (!clause) {
+            return false;
+        }
+    }
+    return Compiler(*this).compile(*clause);
+}
+
+#pragma mark - Evaluate
+
+// Each instruction narrows a selection vector of rows, so every predicate is
+// one pass over its column and and/or stop as soon as nothing is left to
+// decide. Selections stay sorted, which keeps the set operations linear.
+void LSClause::evaluate(const LSMemberTable &table, std::vector<uint32_t> &rows) const
+{
+    rows.clear();
+    if (program.empty() || table.size() == 0) {
+        return;
+    }
+    std::vector<uint32_t> selection(table.size());
+    for (uint32_t row = 0; row < selection.size(); row++) {
+        selection[row] = row;
+    }
+    run(0, table, selection, rows);
+}
+
+uint32_t LSClause::run(uint32_t pc, const LSMemberTable &table, const std::vector<uint32_t> &selection, std::vector<uint32_t> &matches) const
+{
+    const Instruction &instruction = program[pc];
+    matches.clear();
+
+    switch (instruction.op) {
+        case OpTrue:
+            matches = selection;
+            break;
+        case OpFalse:
+            break;
+        case OpAnd: {
+            std::vector<uint32_t> current = selection;
+            std::vector<uint32_t> next;
+            uint32_t child = pc + 1;
+            for (uint32_t i = 0; i < instruction.count && !current.empty(); i++) {
+                child = run(child, table, current, next);
+                current.swap(next);
+            }
+            matches.swap(current);
+            break;
+        }
+        case OpOr: {
+            std::vector<uint32_t> remaining = selection;
+            std::vector<uint32_t> hits, merged, rest;
+            uint32_t child = pc + 1;
+            for (uint32_t i = 0; i < instruction.count && !remaining.empty(); i++) {
+                child = run(child, table, remaining, hits);
+                merged.clear();
+                std::set_union(matches.begin(), matches.end(), hits.begin(), hits.end(), std::back_inserter(merged));
+                matches.swap(merged);
+                rest.clear();
+                std::set_difference(remaining.begin(), remaining.end(), hits.begin(), hits.end(), std::back_inserter(rest));
+                remaining.swap(rest);
+            }
+            break;
+        }
+        case OpNot: {
+            std::vector<uint32_t> hits;
+            run(pc + 1, table, selection, hits);
+            std::set_difference(selection.begin(), selection.end(), hits.begin(), hits.end(), std::back_inserter(matches));
+            break;
+        }
+        default:
+            runLeaf(instruction, table, selection, matches);
+            break;
+    }
+    return pc + instruction.skip;
+}
+
+void LSClause::runLeaf(const Instruction &instruction, const LSMemberTable &table, const std::vector<uint32_t> &selection, std::vector<uint32_t> &matches) const
+{
+    switch (instruction.op) {
+        case OpHasField:
+            // Every row has all three columns.
+            matches = selection;
+            break;
+        case OpStringEquals: {
+            // User IDs are unique, so this is a lookup rather than a scan.
+            int64_t row = table.findRow(strings[instruction.operand]);
+            if (row >= 0 && std::binary_search(selection.begin(), selection.end(), static_cast<uint32_t>(row))) {
+                matches.push_back(static_cast<uint32_t>(row));
+            }
+            break;
+        }
+        case OpStringIn: {
+            std::vector<uint32_t> found;
+            for (uint32_t i = 0; i < instruction.count; i++) {
+                int64_t row = table.findRow(strings[instruction.operand + i]);
+                if (row >= 0) {
+                    found.push_back(static_cast<uint32_t>(row));
+                }
+            }
+            std::sort(found.begin(), found.end());
+            found.erase(std::unique(found.begin(), found.end()), found.end());
+            std::set_intersection(selection.begin(), selection.end(), found.begin(), found.end(), std::back_inserter(matches));
+            break;
+        }
+        case OpStringPrefix: {
+            const std::string &prefix = strings[instruction.operand];
+            for (uint32_t row : selection) {
+                if (table.userID(table.userIndex[row]).compare(0, prefix.size(), prefix) == 0) {
+                    matches.push_back(row);
+                }
+            }
+            break;
+        }
+        case OpStringRange: {
+            const std::string &lower = strings[instruction.operand];
+            const std::string &upper = strings[instruction.operand + 1];
+            for (uint32_t row : selection) {
+                if (inRange(table.userID(table.userIndex[row]), lower, upper, instruction.flags)) {
+                    matches.push_back(row);
+                }
+            }
+            break;
+        }
+        case OpNumberRange: {
+            double lower = numbers[instruction.operand];
+            double upper = numbers[instruction.operand + 1];
+            const int64_t *timestamps = table.timestamp.data();
+            for (uint32_t row : selection) {
+                if (inRange(static_cast<double>(timestamps[row]), lower, upper, instruction.flags)) {
+                    matches.push_back(row);
+                }
+            }
+            break;
+        }
+        case OpNumberIn: {
+            const double *first = numbers.data() + instruction.operand;
+            const double *last = first + instruction.count;
+            const int64_t *timestamps = table.timestamp.data();
+            for (uint32_t row : selection) {
+                if (std::binary_search(first, last, static_cast<double>(timestamps[row]))) {
+                    matches.push_back(row);
+                }
+            }
+            break;
+        }
+        case OpGeoBox: {
+            double northEastLatitude = numbers[instruction.operand];
+            double northEastLongitude = numbers[instruction.operand + 1];
+            double southWestLatitude = numbers[instruction.operand + 2];
+            double southWestLongitude = numbers[instruction.operand + 3];
+            // The box crosses the 180th meridian when west is east of east.
+            bool wraps = southWestLongitude > northEastLongitude;
+            const double *latitudes = table.latitude.data();
+            const double *longitudes = table.longitude.data();
+            for (uint32_t row : selection) {
+                double lat = latitudes[row];
+                double lon = longitudes[row];
+                bool inLongitude = wraps ? (lon >= southWestLongitude || lon <= northEastLongitude)
+                                         : (lon >= southWestLongitude && lon <= northEastLongitude);
+                if (inLongitude && lat >= southWestLatitude && lat <= northEastLatitude) {
+                    matches.push_back(row);
+                }
+            }
+            break;
+        }
+        case OpGeoDistance: {
+            double radius = numbers[instruction.operand + 2];
+            // Gather the selected rows so the distances go through the batch kernel.
+            std::vector<double> lats(selection.size()), lons(selection.size()), distances(selection.size());
+            for (size_t i = 0; i < selection.size(); i++) {
+                lats[i] = table.latitude[selection[i]];
+                lons[i] = table.longitude[selection[i]];
+            }
+            LSGeoDistanceBatch(numbers[instruction.operand], numbers[instruction.operand + 1], lats.data(), lons.data(),
+                               selection.size(), distances.data(), LSGeoDistanceHaversine);
+            for (size_t i = 0; i < selection.size(); i++) {
+                if (distances[i] <= radius) {
+                    matches.push_back(selection[i]);
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+#pragma mark - C interface
+
+LSClauseRef LSClauseCompile(const char *json, size_t length)
+{
+    LSClause *clause = new LSClause();
+    if (!clause->compile(json, length)) {
+        delete clause;
+        return nullptr;
+    }
+    return clause;
+}
+
+void LSClauseDestroy(LSClauseRef clause)
+{
+    delete clause;
+}
+
+size_t LSClauseEvaluate(LSClauseRef clause, LSMemberTableRef table, uint32_t *rows, size_t capacity)
+{
+    std::vector<uint32_t> matches;
+    clause->evaluate(*table, matches);
+    std::copy(matches.begin(), matches.begin() + std::min(capacity, matches.size()), rows);
+    return matches.size();
+}
@@ -0,0 +1,109 @@
+//
+//  LSClause.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-10.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSClause_h
+#define LSClause_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "LSMemberTable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Local evaluation of KiiClause queries against the member table.
+//
+// A clause is compiled from the JSON the query REST API takes (the form
+// KiiQuery queryWithDictionary: accepts), either a bare clause or a whole
+// query with "bucketQuery". Supported types are all, eq, not, and, or, range,
+// in, prefix, hasField, geobox and geodistance.
+//
+// The fields the table holds are "userID", "location" and "_modified".
+// Predicates on any other field never match.
+
+typedef struct LSClause *LSClauseRef;
+
+// Returns NULL when the JSON is not a clause this evaluator understands.
+LSClauseRef LSClauseCompile(const char *json, size_t length);
+void LSClauseDestroy(LSClauseRef clause);
+
+// Writes the matching rows in ascending order. Returns the number of
+// matches and writes at most capacity of them.
+size_t LSClauseEvaluate(LSClauseRef clause, LSMemberTableRef table, uint32_t *rows, size_t capacity);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <vector>
+
+struct LSClause {
+    enum Op : uint8_t {
+        OpTrue,
+        OpFalse,
+        OpAnd,
+        OpOr,
+        OpNot,
+        OpHasField,
+        OpStringEquals,
+        OpStringIn,
+        OpStringPrefix,
+        OpStringRange,
+        OpNumberRange,
+        OpNumberIn,
+        OpGeoBox,
+        OpGeoDistance
+    };
+
+    enum Column : uint8_t {
+        ColumnNone,
+        ColumnUserID,
+        ColumnLocation,
+        ColumnModified
+    };
+
+    enum RangeFlags : uint16_t {
+        LowerSet = 1,
+        LowerIncluded = 2,
+        UpperSet = 4,
+        UpperIncluded = 8
+    };
+
+    // Clauses are laid out in prefix order. skip is the length of the subtree
+    // rooted at the instruction, so a finished branch jumps straight past the
+    // children it no longer needs.
+    struct Instruction {
+        Op op;
+        Column column;
+        uint16_t flags;
+        uint32_t skip;
+        // First constant in numbers or strings, depending on op.
+        uint32_t operand;
+        // Children of and/or, values of in.
+        uint32_t count;
+    };
+
+    std::vector<Instruction> program;
+    std::vector<double> numbers;
+    std::vector<std::string> strings;
+
+    bool compile(const char *json, size_t length);
+
+    // rows is filled with the matches in ascending order.
+    void evaluate(const LSMemberTable &table, std::vector<uint32_t> &rows) const;
+
+private:
+    uint32_t run(uint32_t pc, const LSMemberTable &table, const std::vector<uint32_t> &selection, std::vector<uint32_t> &matches) const;
+    void runLeaf(const Instruction &instruction, const LSMemberTable &table, const std::vector<uint32_t> &selection, std::vector<uint32_t> &matches) const;
+};
+
+#endif
+
+#endif /* LSClause_h */
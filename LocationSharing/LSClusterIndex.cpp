@@ -0,0 +1,241 @@
+//
+//  LSClusterIndex.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-19.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSClusterIndex.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+const double kMercatorLimit = 85.05112878;
+const double kScale = 4294967296.0;
+
+#pragma mark - Mercator
+
+// Web Mercator in [0, 1), x eastwards and y southwards, as 32 bit fractions.
+uint32_t fixedX(double longitude)
+{
+    double x = (longitude + 180.0) / 360.0;
+    return static_cast<uint32_t>(std::min(std::max(x * kScale, 0.0), kScale - 1.0));
+}
+
+uint32_t fixedY(double latitude)
+{
+    double clamped = std::min(std::max(latitude, -kMercatorLimit), kMercatorLimit);
+    double sine = std::sin(clamped * kPi / 180.0);
+    double y = 0.5 - std::log((1.0 + sine) / (1.0 - sine)) / (4.0 * kPi);
+    return static_cast<uint32_t>(std::min(std::max(y * kScale, 0.0), kScale - 1.0));
+}
+
+double longitudeOf(double x)
+{
+    return x / kScale * 360.0 - 180.0;
+}
+
+double latitudeOf(double y)
+{
+    return std::atan(std::sinh(kPi * (1.0 - 2.0 * y / kScale))) * 180.0 / kPi;
+}
+
+inline unsigned levelBits(unsigned zoom)
+{
+    return zoom + LSClusterIndex::kCellShift;
+}
+
+inline uint64_t cellKey(uint64_t cellX, uint64_t cellY)
+{
+    return (cellX << 32) | cellY;
+}
+
+} // namespace
+
+#pragma mark - Updates
+
+void LSClusterIndex::add(uint32_t pointID, uint32_t x, uint32_t y)
+{
+    for (unsigned zoom = 0; zoom < kLevels; zoom++) {
+        unsigned shift = 32 - levelBits(zoom);
+        Cell &cell = levels[zoom][cellKey(x >> shift, y >> shift)];
+        cell.count++;
+        cell.pointXor ^= pointID;
+        cell.sumX += x;
+        cell.sumY += y;
+    }
+}
+
+void LSClusterIndex::subtract(uint32_t pointID, uint32_t x, uint32_t y)
+{
+    for (unsigned zoom = 0; zoom < kLevels; zoom++) {
+        unsigned shift = 32 - levelBits(zoom);
+        auto found = levels[zoom].find(cellKey(x >> shift, y >> shift));
+        Cell &cell = found->second;
+        if (--cell.count == 0) {
+            levels[zoom].erase(found);
+            continue;
+        }
+        cell.pointXor ^= pointID;
+        cell.sumX -= x;
+        cell.sumY -= y;
+    }
+}
+
+void LSClusterIndex::load(const uint32_t *ids, const double *lats, const double *lons, size_t count)
+{
+    clear();
+    for (size_t i = 0; i < count; i++) {
+        move(ids[i], lats[i], lons[i]);
+    }
+}
+
+void LSClusterIndex::move(uint32_t pointID, double lat, double lon)
+{
+    if (pointID >= present.size()) {
+        xs.resize(pointID + 1);
+        ys.resize(pointID + 1);
+        present.resize(pointID + 1, false);
+    }
+
+    uint32_t x = fixedX(lon);
+    uint32_t y = fixedY(lat);
+
+    if (present[pointID]) {
+        // A move within the finest cell only changes the sums, but it is
+        // just as cheap to treat every move the same.
+        subtract(pointID, xs[pointID], ys[pointID]);
+    } else {
+        present[pointID] = true;
+        pointCount++;
+    }
+
+    xs[pointID] = x;
+    ys[pointID] = y;
+    add(pointID, x, y);
+}
+
+void LSClusterIndex::remove(uint32_t pointID)
+{
+    if (pointID >= present.size() || !present[pointID]) {
+        return;
+    }
+    subtract(pointID, xs[pointID], ys[pointID]);
+    present[pointID] = false;
+    pointCount--;
+}
+
+void LSClusterIndex::clear()
+{
+    for (unsigned zoom = 0; zoom < kLevels; zoom++) {
+        levels[zoom].clear();
+    }
+    xs.clear();
+    ys.clear();
+    present.clear();
+    pointCount = 0;
+}
+
+#pragma mark - Queries
+
+void LSClusterIndex::collect(unsigned zoom, uint64_t minX, uint64_t maxX, uint64_t minY, uint64_t maxY, std::vector<LSCluster> &clusters) const
+{
+    const std::unordered_map<uint64_t, Cell> &level = levels[zoom];
+
+    auto emit = [&clusters](uint64_t key, const Cell &cell) {
+        LSCluster cluster;
+        cluster.count = cell.count;
+        cluster.pointID = cell.pointXor;
+        cluster.cell = key;
+        cluster.longitude = longitudeOf(static_cast<double>(cell.sumX) / cell.count);
+        cluster.latitude = latitudeOf(static_cast<double>(cell.sumY) / cell.count);
+        clusters.push_back(cluster);
+    };
+
+    // Probe the cells in view, or walk the occupied ones if there are fewer.
+    uint64_t inView = (maxX - minX + 1) * (maxY - minY + 1);
+    if (inView <= level.size()) {
+        for (uint64_t cellX = minX; cellX <= maxX; cellX++) {
+            for (uint64_t cellY = minY; cellY <= maxY; cellY++) {
+                auto found = level.find(cellKey(cellX, cellY));
+                if (found != level.end()) {
+                    emit(found->first, found->second);
+                }
+            }
+        }
+    } else {
+        for (const auto &entry : level) {
+            uint64_t cellX = entry.first >> 32;
+            uint64_t cellY = entry.first & 0xFFFFFFFFULL;
+            if (cellX >= minX && cellX <= maxX && cellY >= minY && cellY <= maxY) {
+                emit(entry.first, entry.second);
+            }
+        }
+    }
+}
+
+void LSClusterIndex::query(unsigned zoom, double northEastLatitude, double northEastLongitude, double southWestLatitude, double southWestLongitude, std::vector<LSCluster> &clusters) const
+{
+    zoom = std::min(zoom, static_cast<unsigned>(LSClusterIndexMaxZoom));
+    unsigned shift = 32 - levelBits(zoom);
+
+    uint64_t minY = fixedY(northEastLatitude) >> shift;
+    uint64_t maxY = fixedY(southWestLatitude) >> shift;
+    uint64_t west = fixedX(southWestLongitude) >> shift;
+    uint64_t east = fixedX(northEastLongitude) >> shift;
+
+    if (southWestLongitude > northEastLongitude) {
+        uint64_t last = (1ULL << levelBits(zoom)) - 1;
+        collect(zoom, west, last, minY, maxY, clusters);
+        // Cells touching both sides would be listed twice.
+        if (west > 0) {
+            collect(zoom, 0, std::min(east, west - 1), minY, maxY, clusters);
+        }
+    } else {
+        collect(zoom, west, east, minY, maxY, clusters);
+    }
+}
+
+#pragma mark - C interface
+
+LSClusterIndexRef LSClusterIndexCreate(void)
+{
+    return new LSClusterIndex();
+}
+
+void LSClusterIndexDestroy(LSClusterIndexRef index)
+{
+    delete index;
+}
+
+size_t LSClusterIndexCount(LSClusterIndexRef index)
+{
+    return index->size();
+}
+
+void LSClusterIndexLoadMembers(LSClusterIndexRef index, LSMemberTableRef table)
+{
+    index->load(table->userIndex.data(), table->latitude.data(), table->longitude.data(), table->size());
+}
+
+void LSClusterIndexMove(LSClusterIndexRef index, uint32_t pointID, double latitude, double longitude)
+{
+    index->move(pointID, latitude, longitude);
+}
+
+void LSClusterIndexRemove(LSClusterIndexRef index, uint32_t pointID)
+{
+    index->remove(pointID);
+}
+
+size_t LSClusterIndexQuery(LSClusterIndexRef index, unsigned zoom, double northEastLatitude, double northEastLongitude, double southWestLatitude, double southWestLongitude, LSCluster *clusters, size_t capacity)
+{
+    std::vector<LSCluster> found;
+    index->query(zoom, northEastLatitude, northEastLongitude, southWestLatitude, southWestLongitude, found);
+    std::copy(found.begin(), found.begin() + std::min(capacity, found.size()), clusters);
+    return found.size();
+}
@@ -0,0 +1,105 @@
+//
+//  LSClusterIndex.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-19.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSClusterIndex_h
+#define LSClusterIndex_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "LSMemberTable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pins grouped into clusters for every map zoom level.
+//
+// Each zoom level has a grid of Web Mercator cells a quarter of a 256 point
+// tile wide (64 points on screen); the grid of one level splits every cell of
+// the level above in four. A cell keeps the count and coordinate sums of its
+// points, so moving a point updates one cell per level and a query only
+// reads the cells in view.
+//
+// Points are identified by the caller (the member table user index).
+
+#define LSClusterIndexMaxZoom 20
+
+typedef struct LSClusterIndex *LSClusterIndexRef;
+
+typedef struct {
+    double latitude;
+    double longitude;
+    uint32_t count;
+    // The point itself when count is 1.
+    uint32_t pointID;
+    // The cell at the zoom level, stable while the cell has points, so
+    // callers can tell the same cluster apart from one query to the next.
+    uint64_t cell;
+} LSCluster;
+
+LSClusterIndexRef LSClusterIndexCreate(void);
+void LSClusterIndexDestroy(LSClusterIndexRef index);
+
+size_t LSClusterIndexCount(LSClusterIndexRef index);
+
+void LSClusterIndexLoadMembers(LSClusterIndexRef index, LSMemberTableRef table);
+// Inserts the point if it is not indexed yet.
+void LSClusterIndexMove(LSClusterIndexRef index, uint32_t pointID, double latitude, double longitude);
+void LSClusterIndexRemove(LSClusterIndexRef index, uint32_t pointID);
+
+// Clusters whose cell overlaps the box at the zoom level, centered on the
+// mean of their points. Boxes crossing the 180th meridian have a south west
+// longitude greater than the north east one. Returns the number of clusters
+// and writes at most capacity of them.
+size_t LSClusterIndexQuery(LSClusterIndexRef index, unsigned zoom, double northEastLatitude, double northEastLongitude, double southWestLatitude, double southWestLongitude, LSCluster *clusters, size_t capacity);
+
+#ifdef __cplusplus
+}
+
+#include <unordered_map>
+#include <vector>
+
+struct LSClusterIndex {
+    // Cells at zoom z are tiles of level z + kCellShift.
+    static const unsigned kCellShift = 2;
+    static const unsigned kLevels = LSClusterIndexMaxZoom + 1;
+
+    struct Cell {
+        uint32_t count;
+        // XOR of the IDs inside, which is the ID when there is one.
+        uint32_t pointXor;
+        // Mercator coordinates in units of 2^-32, summed exactly.
+        uint64_t sumX;
+        uint64_t sumY;
+    };
+
+    size_t size() const { return pointCount; }
+
+    void load(const uint32_t *ids, const double *lats, const double *lons, size_t count);
+    void move(uint32_t pointID, double lat, double lon);
+    void remove(uint32_t pointID);
+    void clear();
+
+    void query(unsigned zoom, double northEastLatitude, double northEastLongitude, double southWestLatitude, double southWestLongitude, std::vector<LSCluster> &clusters) const;
+
+private:
+    std::unordered_map<uint64_t, Cell> levels[kLevels];
+    std::vector<uint32_t> xs;
+    std::vector<uint32_t> ys;
+    std::vector<bool> present;
+    size_t pointCount = 0;
+
+    void add(uint32_t pointID, uint32_t x, uint32_t y);
+    void subtract(uint32_t pointID, uint32_t x, uint32_t y);
+    void collect(unsigned zoom, uint64_t minX, uint64_t maxX, uint64_t minY, uint64_t maxY, std::vector<LSCluster> &clusters) const;
+};
+
+#endif
+
+#endif /* LSClusterIndex_h */
@@ -0,0 +1,134 @@
+//
+//  LSDeflater.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-05.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSDeflater.h"
+
+#include <cstring>
+
+namespace {
+
+// Window bits of a zlib stream; adding 16 asks for a gzip wrapper instead.
+const int kWindowBits = 15;
+const int kGzip = 16;
+const int kMemoryLevel = 8;
+
+#pragma mark - Dictionary
+
+// Strings of location objects and query requests, taken from what BatchWriter
+// and the query cursors send. zlib finds matches closer to the end of the
+// dictionary with shorter distances, so the most common strings are last.
+const char kLocationDictionary[] =
+    "{\"bucketQuery\":{\"clause\":{\"type\":\"all\"}},\"bestEffortLimit\":100"
+    ",\"paginationKey\":\""
+    "\"clause\":{\"type\":\"geodistance\",\"field\":\"location\",\"center\":{\"_type\":\"point\",\"lat\":"
+    "\"clause\":{\"type\":\"geobox\",\"field\":\"location\",\"box\":{\"ne\":{\"_type\":\"point\",\"lat\":"
+    "\"clause\":{\"type\":\"range\",\"field\":\"_modified\",\"lowerLimit\":"
+    ",\"radius\":,\"putDistanceInto\":\"distance\""
+    "\"sw\":{\"_type\":\"point\",\"lat\":"
+    "{\"requests\":[{\"method\":\"PATCH\",\"path\":\"groups/mygroup1/buckets/locations/objects/\",\"body\":"
+    ",\"_created\":14,\"_version\":\"1\""
+    "{\"_id\":\"\",\"_modified\":14"
+    "{\"userID\":\"\",\"location\":{\"_type\":\"point\",\"lat\":,\"lon\":-}}";
+
+}
+
+#pragma mark - Deflater
+
+LSDeflater::LSDeflater()
+{
+    std::memset(&stream, 0, sizeof(stream));
+}
+
+LSDeflater::~LSDeflater()
+{
+    if (ready) {
+        deflateEnd(&stream);
+    }
+}
+
+bool LSDeflater::setUp(int level, const char *bytes, size_t length)
+{
+    bool primed = bytes != NULL && length > 0;
+    int windowBits = primed ? kWindowBits : kWindowBits + kGzip;
+
+    if (deflateInit2(&stream, level, Z_DEFLATED, windowBits, kMemoryLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    ready = true;
+
+    if (primed) {
+        dictionary.assign(bytes, length);
+        dictionaryID = static_cast<uint32_t>(adler32(adler32(0, Z_NULL, 0), reinterpret_cast<const Bytef *>(bytes), static_cast<uInt>(length)));
+    }
+    return true;
+}
+
+size_t LSDeflater::bound(size_t length)
+{
+    // deflateBound covers the gzip wrapper but not the dictionary ID
+    return deflateBound(&stream, static_cast<uLong>(length)) + 4;
+}
+
+size_t LSDeflater::compress(const uint8_t *bytes, size_t length, uint8_t *buffer, size_t capacity)
+{
+    if (!ready || deflateReset(&stream) != Z_OK) {
+        return 0;
+    }
+    // A reset forgets the dictionary, so it is set again for every body
+    if (!dictionary.empty() && deflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(dictionary.data()), static_cast<uInt>(dictionary.size())) != Z_OK) {
+        return 0;
+    }
+
+    stream.next_in = const_cast<Bytef *>(bytes);
+    stream.avail_in = static_cast<uInt>(length);
+    stream.next_out = buffer;
+    stream.avail_out = static_cast<uInt>(capacity);
+
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        return 0;
+    }
+    return static_cast<size_t>(stream.total_out);
+}
+
+#pragma mark - C interface
+
+LSDeflaterRef LSDeflaterCreate(int level, const void *dictionary, size_t dictionaryLength)
+{
+    LSDeflater *deflater = new LSDeflater();
+    if (!deflater->setUp(level, static_cast<const char *>(dictionary), dictionaryLength)) {
+        delete deflater;
+        return NULL;
+    }
+    return deflater;
+}
+
+void LSDeflaterDestroy(LSDeflaterRef deflater)
+{
+    delete deflater;
+}
+
+size_t LSDeflaterBound(LSDeflaterRef deflater, size_t length)
+{
+    return deflater->bound(length);
+}
+
+size_t LSDeflaterCompress(LSDeflaterRef deflater, const void *bytes, size_t length, void *buffer, size_t capacity)
+{
+    return deflater->compress(static_cast<const uint8_t *>(bytes), length, static_cast<uint8_t *>(buffer), capacity);
+}
+
+uint32_t LSDeflaterDictionaryID(LSDeflaterRef deflater)
+{
+    return deflater->dictionaryID;
+}
+
+const void *LSDeflaterLocationDictionary(size_t *length)
+{
+    *length = sizeof(kLocationDictionary) - 1;
+    return kLocationDictionary;
+}
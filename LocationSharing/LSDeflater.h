@@ -0,0 +1,78 @@
+//
+//  LSDeflater.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-05.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSDeflater_h
+#define LSDeflater_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Compresses request bodies with zlib, reusing one stream so a body costs a
+// reset instead of allocating the window and hash tables again.
+//
+// Without a dictionary the output is gzip, for Content-Encoding: gzip. With
+// one it is a zlib stream primed with the dictionary, for Content-Encoding:
+// deflate; the stream header carries the dictionary ID (its Adler-32) so the
+// receiver can tell which dictionary to load. Bodies of a few hundred bytes
+// barely shrink on their own, but most of a location object is keys and
+// values the dictionary already holds.
+//
+// A deflater is not thread safe.
+
+typedef struct LSDeflater *LSDeflaterRef;
+
+// level is a zlib level, 0 to 9 or -1 for the default. The dictionary is
+// copied. Returns NULL when zlib cannot be set up.
+LSDeflaterRef LSDeflaterCreate(int level, const void *dictionary, size_t dictionaryLength);
+void LSDeflaterDestroy(LSDeflaterRef deflater);
+
+// Capacity enough for any body of the given length.
+size_t LSDeflaterBound(LSDeflaterRef deflater, size_t length);
+// Returns the compressed length, 0 when it did not fit in capacity.
+size_t LSDeflaterCompress(LSDeflaterRef deflater, const void *bytes, size_t length, void *buffer, size_t capacity);
+
+// 0 without a dictionary.
+uint32_t LSDeflaterDictionaryID(LSDeflaterRef deflater);
+
+// Built in dictionary for the JSON of location objects and bucket queries.
+const void *LSDeflaterLocationDictionary(size_t *length);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+
+#include <zlib.h>
+
+struct LSDeflater {
+    z_stream stream;
+    std::string dictionary;
+    uint32_t dictionaryID = 0;
+
+    LSDeflater();
+    ~LSDeflater();
+
+    bool setUp(int level, const char *dictionary, size_t dictionaryLength);
+    size_t bound(size_t length);
+    size_t compress(const uint8_t *bytes, size_t length, uint8_t *buffer, size_t capacity);
+
+private:
+    bool ready = false;
+
+    LSDeflater(const LSDeflater &);
+    LSDeflater &operator=(const LSDeflater &);
+};
+
+#endif
+
+#endif /* LSDeflater_h */
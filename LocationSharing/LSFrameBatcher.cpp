@@ -0,0 +1,110 @@
+//
+//  LSFrameBatcher.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-30.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSFrameBatcher.h"
+
+#include <algorithm>
+
+namespace {
+
+// Time a frame can cover, see LSLocationFrame.h.
+const int64_t kMaxSpan = 40950;
+
+} // namespace
+
+#pragma mark - Batching
+
+bool LSFrameBatcher::add(const LSLocationRecord &record, int64_t now)
+{
+    auto found = slots.find(record.userKey);
+    if (found != slots.end()) {
+        LSLocationRecord &queued = pending[found->second];
+        if (record.timestamp > queued.timestamp) {
+            queued = record;
+        }
+    } else {
+        if (pending.empty()) {
+            deadline = now + window;
+        }
+        slots.emplace(record.userKey, pending.size());
+        pending.push_back(record);
+    }
+    return pending.size() >= maxRecords;
+}
+
+void LSFrameBatcher::reindex()
+{
+    slots.clear();
+    for (size_t i = 0; i < pending.size(); i++) {
+        slots[pending[i].userKey] = i;
+    }
+}
+
+size_t LSFrameBatcher::take(uint8_t *buffer, size_t capacity)
+{
+    if (pending.empty()) {
+        return 0;
+    }
+
+    std::stable_sort(pending.begin(), pending.end(), [](const LSLocationRecord &a, const LSLocationRecord &b) {
+        return a.timestamp < b.timestamp;
+    });
+    reindex();
+
+    size_t count = 1;
+    size_t limit = std::min(pending.size(), std::max(maxRecords, size_t(1)));
+    while (count < limit && pending[count].timestamp - pending[0].timestamp <= kMaxSpan) {
+        count++;
+    }
+
+    size_t size = LSLocationFrameEncode(pending.data(), count, buffer, capacity);
+    if (size == 0 || !buffer || size > capacity) {
+        return size;
+    }
+
+    pending.erase(pending.begin(), pending.begin() + count);
+    reindex();
+    // What is left was due with the batch it came in.
+    if (pending.empty()) {
+        deadline = INT64_MAX;
+    }
+
+    return size;
+}
+
+#pragma mark - C interface
+
+LSFrameBatcherRef LSFrameBatcherCreate(int64_t window, size_t maxRecords)
+{
+    return new LSFrameBatcher(window, std::min(maxRecords, size_t(LSLocationFrameMaxRecords)));
+}
+
+void LSFrameBatcherDestroy(LSFrameBatcherRef batcher)
+{
+    delete batcher;
+}
+
+bool LSFrameBatcherAdd(LSFrameBatcherRef batcher, const LSLocationRecord *record, int64_t now)
+{
+    return batcher->add(*record, now);
+}
+
+size_t LSFrameBatcherCount(LSFrameBatcherRef batcher)
+{
+    return batcher->pending.size();
+}
+
+int64_t LSFrameBatcherDeadline(LSFrameBatcherRef batcher)
+{
+    return batcher->deadline;
+}
+
+size_t LSFrameBatcherTake(LSFrameBatcherRef batcher, uint8_t *buffer, size_t capacity)
+{
+    return batcher->take(buffer, capacity);
+}
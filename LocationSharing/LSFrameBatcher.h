@@ -0,0 +1,73 @@
+//
+//  LSFrameBatcher.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-30.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSFrameBatcher_h
+#define LSFrameBatcher_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "LSLocationFrame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Collects location records for a topic and hands them out as location
+// frames, so a tick that moves many members sends one push message.
+//
+// A batch is due window ms after its first record or as soon as it holds
+// maxRecords members. A member queued twice keeps only its newest record.
+// Times are in ms.
+
+typedef struct LSFrameBatcher *LSFrameBatcherRef;
+
+LSFrameBatcherRef LSFrameBatcherCreate(int64_t window, size_t maxRecords);
+void LSFrameBatcherDestroy(LSFrameBatcherRef batcher);
+
+// Returns true when the batch is full and should be taken right away.
+bool LSFrameBatcherAdd(LSFrameBatcherRef batcher, const LSLocationRecord *record, int64_t now);
+
+size_t LSFrameBatcherCount(LSFrameBatcherRef batcher);
+
+// When the pending batch has to go out, INT64_MAX when there is none.
+int64_t LSFrameBatcherDeadline(LSFrameBatcherRef batcher);
+
+// Encodes the oldest pending records, at most maxRecords spanning at most
+// what one frame holds, and returns the size of the frame; 0 when nothing is
+// pending. When the frame does not fit in capacity bytes nothing is taken.
+// Call until it returns 0 to send everything.
+size_t LSFrameBatcherTake(LSFrameBatcherRef batcher, uint8_t *buffer, size_t capacity);
+
+#ifdef __cplusplus
+}
+
+#include <unordered_map>
+#include <vector>
+
+struct LSFrameBatcher {
+    int64_t window;
+    size_t maxRecords;
+    int64_t deadline = INT64_MAX;
+    std::vector<LSLocationRecord> pending;
+    // Slot in pending by user key.
+    std::unordered_map<uint32_t, size_t> slots;
+
+    LSFrameBatcher(int64_t windowLength, size_t max) : window(windowLength), maxRecords(max) {}
+
+    bool add(const LSLocationRecord &record, int64_t now);
+    size_t take(uint8_t *buffer, size_t capacity);
+
+private:
+    void reindex();
+};
+
+#endif
+
+#endif /* LSFrameBatcher_h */
@@ -0,0 +1,299 @@
+//
+//  LSGeoCell.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-08.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSGeoCell.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+const double kMercatorLimit = 85.05112878;
+const char kBase32[] = "0123456789bcdefghjkmnpqrstuvwxyz";
+
+#pragma mark - Bits
+
+// Moves the low 32 bits of value to the even bit positions.
+inline uint64_t spread(uint64_t value)
+{
+#if defined(__BMI2__)
+    return _pdep_u64(value, 0x5555555555555555ULL);
+#else
+    value &= 0xFFFFFFFFULL;
+    value = (value | (value << 16)) & 0x0000FFFF0000FFFFULL;
+    value = (value | (value << 8)) & 0x00FF00FF00FF00FFULL;
+    value = (value | (value << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    value = (value | (value << 2)) & 0x3333333333333333ULL;
+    value = (value | (value << 1)) & 0x5555555555555555ULL;
+    return value;
+#endif
+}
+
+// Inverse of spread: gathers the even bits into the low 32 bits.
+inline uint64_t compact(uint64_t value)
+{
+#if defined(__BMI2__)
+    return _pext_u64(value, 0x5555555555555555ULL);
+#else
+    value &= 0x5555555555555555ULL;
+    value = (value | (value >> 1)) & 0x3333333333333333ULL;
+    value = (value | (value >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    value = (value | (value >> 4)) & 0x00FF00FF00FF00FFULL;
+    value = (value | (value >> 8)) & 0x0000FFFF0000FFFFULL;
+    value = (value | (value >> 16)) & 0x00000000FFFFFFFFULL;
+    return value;
+#endif
+}
+
+// Cell number of value on a grid of 2^bits cells over [0, 1), clamped.
+inline uint64_t quantize(double fraction, unsigned bits)
+{
+    double cells = static_cast<double>(1ULL << bits);
+    double cell = std::min(std::max(std::floor(fraction * cells), 0.0), cells - 1.0);
+    return static_cast<uint64_t>(cell);
+}
+
+#pragma mark - Geohash layout
+
+// Geohash bits alternate starting with longitude, so longitude gets the extra
+// bit when the total is odd.
+struct GeohashLayout {
+    unsigned longitudeBits;
+    unsigned latitudeBits;
+    unsigned odd;
+
+    explicit GeohashLayout(unsigned precision)
+    {
+        unsigned bits = 5 * std::min(std::max(precision, 1u), static_cast<unsigned>(LSGeohashMaxPrecision));
+        longitudeBits = (bits + 1) / 2;
+        latitudeBits = bits / 2;
+        odd = bits & 1;
+    }
+
+    uint64_t interleave(uint64_t x, uint64_t y) const
+    {
+        return (spread(x) << (1 - odd)) | (spread(y) << odd);
+    }
+
+    uint64_t longitudeCell(uint64_t code) const { return compact(code >> (1 - odd)); }
+    uint64_t latitudeCell(uint64_t code) const { return compact(code >> odd); }
+};
+
+inline double mercatorY(double latitude)
+{
+    double clamped = std::min(std::max(latitude, -kMercatorLimit), kMercatorLimit);
+    double sine = std::sin(clamped * kPi / 180.0);
+    return 0.5 - std::log((1.0 + sine) / (1.0 - sine)) / (4.0 * kPi);
+}
+
+inline double mercatorLatitude(double y)
+{
+    return std::atan(std::sinh(kPi * (1.0 - 2.0 * y))) * 180.0 / kPi;
+}
+
+inline unsigned clampLevel(unsigned level)
+{
+    return std::min(std::max(level, 1u), static_cast<unsigned>(LSQuadKeyMaxLevel));
+}
+
+// Shared by both cell kinds: step the cell coordinates and interleave again.
+// north is the direction in which y grows towards the north pole.
+template <class Interleave>
+void neighbors(uint64_t x, uint64_t y, unsigned xBits, unsigned yBits, int north, Interleave interleave, uint64_t *out)
+{
+    static const int dx[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+    static const int dy[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+    uint64_t xMask = (1ULL << xBits) - 1;
+    int64_t yMax = static_cast<int64_t>((1ULL << yBits) - 1);
+    for (int i = 0; i < 8; i++) {
+        uint64_t nx = (x + static_cast<uint64_t>(static_cast<int64_t>(dx[i]))) & xMask;
+        int64_t ny = std::min(std::max(static_cast<int64_t>(y) + north * dy[i], static_cast<int64_t>(0)), yMax);
+        out[i] = interleave(nx, static_cast<uint64_t>(ny));
+    }
+}
+
+} // namespace
+
+#pragma mark - Geohash
+
+uint64_t LSGeohashEncode(double latitude, double longitude, unsigned precision)
+{
+    GeohashLayout layout(precision);
+    uint64_t x = quantize((longitude + 180.0) / 360.0, layout.longitudeBits);
+    uint64_t y = quantize((latitude + 90.0) / 180.0, layout.latitudeBits);
+    return layout.interleave(x, y);
+}
+
+void LSGeohashEncodeBatch(const double *latitudes, const double *longitudes, size_t count, unsigned precision, uint64_t *codes)
+{
+    GeohashLayout layout(precision);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t x = quantize((longitudes[i] + 180.0) / 360.0, layout.longitudeBits);
+        uint64_t y = quantize((latitudes[i] + 90.0) / 180.0, layout.latitudeBits);
+        codes[i] = layout.interleave(x, y);
+    }
+}
+
+LSGeoCellBounds LSGeohashDecode(uint64_t code, unsigned precision)
+{
+    GeohashLayout layout(precision);
+    double width = 360.0 / static_cast<double>(1ULL << layout.longitudeBits);
+    double height = 180.0 / static_cast<double>(1ULL << layout.latitudeBits);
+    double x = static_cast<double>(layout.longitudeCell(code));
+    double y = static_cast<double>(layout.latitudeCell(code));
+
+    LSGeoCellBounds bounds;
+    bounds.minLatitude = -90.0 + y * height;
+    bounds.maxLatitude = bounds.minLatitude + height;
+    bounds.minLongitude = -180.0 + x * width;
+    bounds.maxLongitude = bounds.minLongitude + width;
+    return bounds;
+}
+
+void LSGeohashDecodeBatch(const uint64_t *codes, size_t count, unsigned precision, double *latitudes, double *longitudes)
+{
+    GeohashLayout layout(precision);
+    double width = 360.0 / static_cast<double>(1ULL << layout.longitudeBits);
+    double height = 180.0 / static_cast<double>(1ULL << layout.latitudeBits);
+    for (size_t i = 0; i < count; i++) {
+        latitudes[i] = -90.0 + (static_cast<double>(layout.latitudeCell(codes[i])) + 0.5) * height;
+        longitudes[i] = -180.0 + (static_cast<double>(layout.longitudeCell(codes[i])) + 0.5) * width;
+    }
+}
+
+void LSGeohashNeighbors(uint64_t code, unsigned precision, uint64_t *out)
+{
+    GeohashLayout layout(precision);
+    neighbors(layout.longitudeCell(code), layout.latitudeCell(code), layout.longitudeBits, layout.latitudeBits, 1,
+              [&layout](uint64_t x, uint64_t y) { return layout.interleave(x, y); }, out);
+}
+
+void LSGeohashToString(uint64_t code, unsigned precision, char *buffer)
+{
+    precision = std::min(std::max(precision, 1u), static_cast<unsigned>(LSGeohashMaxPrecision));
+    for (unsigned i = 0; i < precision; i++) {
+        buffer[i] = kBase32[(code >> (5 * (precision - 1 - i))) & 31];
+    }
+    buffer[precision] = '\0';
+}
+
+unsigned LSGeohashFromString(const char *string, uint64_t *code)
+{
+    uint64_t value = 0;
+    unsigned precision = 0;
+    for (; string[precision] != '\0'; precision++) {
+        if (precision == LSGeohashMaxPrecision) {
+            return 0;
+        }
+        const char *found = std::find(kBase32, kBase32 + 32, string[precision]);
+        if (found == kBase32 + 32) {
+            return 0;
+        }
+        value = (value << 5) | static_cast<uint64_t>(found - kBase32);
+    }
+    *code = value;
+    return precision;
+}
+
+#pragma mark - Quad keys
+
+namespace {
+
+// Quad key digits are the x bit plus twice the y bit, most significant first.
+inline uint64_t interleaveTile(uint64_t x, uint64_t y)
+{
+    return spread(x) | (spread(y) << 1);
+}
+
+} // namespace
+
+uint64_t LSQuadKeyEncode(double latitude, double longitude, unsigned level)
+{
+    level = clampLevel(level);
+    return interleaveTile(quantize((longitude + 180.0) / 360.0, level), quantize(mercatorY(latitude), level));
+}
+
+void LSQuadKeyEncodeBatch(const double *latitudes, const double *longitudes, size_t count, unsigned level, uint64_t *keys)
+{
+    level = clampLevel(level);
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = interleaveTile(quantize((longitudes[i] + 180.0) / 360.0, level), quantize(mercatorY(latitudes[i]), level));
+    }
+}
+
+LSGeoCellBounds LSQuadKeyDecode(uint64_t key, unsigned level)
+{
+    level = clampLevel(level);
+    double tiles = static_cast<double>(1ULL << level);
+    double x = static_cast<double>(compact(key));
+    double y = static_cast<double>(compact(key >> 1));
+
+    LSGeoCellBounds bounds;
+    bounds.minLongitude = x / tiles * 360.0 - 180.0;
+    bounds.maxLongitude = (x + 1.0) / tiles * 360.0 - 180.0;
+    bounds.maxLatitude = mercatorLatitude(y / tiles);
+    bounds.minLatitude = mercatorLatitude((y + 1.0) / tiles);
+    return bounds;
+}
+
+void LSQuadKeyDecodeBatch(const uint64_t *keys, size_t count, unsigned level, double *latitudes, double *longitudes)
+{
+    level = clampLevel(level);
+    double tiles = static_cast<double>(1ULL << level);
+    for (size_t i = 0; i < count; i++) {
+        latitudes[i] = mercatorLatitude((static_cast<double>(compact(keys[i] >> 1)) + 0.5) / tiles);
+        longitudes[i] = (static_cast<double>(compact(keys[i])) + 0.5) / tiles * 360.0 - 180.0;
+    }
+}
+
+void LSQuadKeyNeighbors(uint64_t key, unsigned level, uint64_t *out)
+{
+    level = clampLevel(level);
+    // Tile rows grow southwards.
+    neighbors(compact(key), compact(key >> 1), level, level, -1, [](uint64_t x, uint64_t y) { return interleaveTile(x, y); }, out);
+}
+
+uint64_t LSQuadKeyFromTile(uint32_t x, uint32_t y, unsigned level)
+{
+    uint64_t mask = (1ULL << clampLevel(level)) - 1;
+    return interleaveTile(x & mask, y & mask);
+}
+
+void LSQuadKeyTile(uint64_t key, uint32_t *x, uint32_t *y)
+{
+    *x = static_cast<uint32_t>(compact(key));
+    *y = static_cast<uint32_t>(compact(key >> 1));
+}
+
+void LSQuadKeyToString(uint64_t key, unsigned level, char *buffer)
+{
+    level = clampLevel(level);
+    for (unsigned i = 0; i < level; i++) {
+        buffer[i] = static_cast<char>('0' + ((key >> (2 * (level - 1 - i))) & 3));
+    }
+    buffer[level] = '\0';
+}
+
+unsigned LSQuadKeyFromString(const char *string, uint64_t *key)
+{
+    uint64_t value = 0;
+    unsigned level = 0;
+    for (; string[level] != '\0'; level++) {
+        if (level == LSQuadKeyMaxLevel || string[level] < '0' || string[level] > '3') {
+            return 0;
+        }
+        value = (value << 2) | static_cast<uint64_t>(string[level] - '0');
+    }
+    *key = value;
+    return level;
+}
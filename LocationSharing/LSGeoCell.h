@@ -0,0 +1,66 @@
+//
+//  LSGeoCell.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-08.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSGeoCell_h
+#define LSGeoCell_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Grid cells for coordinates, as geohashes and as Bing style quad keys.
+//
+// A geohash of precision p (1 to 12 characters) is kept as its 5 * p bits,
+// longitude first. A quad key of level l (1 to 30) is kept as its 2 * l bits
+// on the Web Mercator tile grid. Both are prefixes of the finer cells they
+// contain, so the string forms work with KiiClause startsWith.
+//
+// Neighbors are returned in the order N, NE, E, SE, S, SW, W, NW. Longitude
+// wraps around; at the poles the cell itself stands in for the missing row.
+
+#define LSGeohashMaxPrecision 12
+#define LSQuadKeyMaxLevel 30
+
+typedef struct {
+    double minLatitude;
+    double minLongitude;
+    double maxLatitude;
+    double maxLongitude;
+} LSGeoCellBounds;
+
+uint64_t LSGeohashEncode(double latitude, double longitude, unsigned precision);
+void LSGeohashEncodeBatch(const double *latitudes, const double *longitudes, size_t count, unsigned precision, uint64_t *codes);
+LSGeoCellBounds LSGeohashDecode(uint64_t code, unsigned precision);
+// Writes the cell centers.
+void LSGeohashDecodeBatch(const uint64_t *codes, size_t count, unsigned precision, double *latitudes, double *longitudes);
+void LSGeohashNeighbors(uint64_t code, unsigned precision, uint64_t *neighbors);
+// buffer needs precision + 1 bytes.
+void LSGeohashToString(uint64_t code, unsigned precision, char *buffer);
+// Returns 0 when the string is not a geohash.
+unsigned LSGeohashFromString(const char *string, uint64_t *code);
+
+uint64_t LSQuadKeyEncode(double latitude, double longitude, unsigned level);
+void LSQuadKeyEncodeBatch(const double *latitudes, const double *longitudes, size_t count, unsigned level, uint64_t *keys);
+LSGeoCellBounds LSQuadKeyDecode(uint64_t key, unsigned level);
+void LSQuadKeyDecodeBatch(const uint64_t *keys, size_t count, unsigned level, double *latitudes, double *longitudes);
+void LSQuadKeyNeighbors(uint64_t key, unsigned level, uint64_t *neighbors);
+// Tile column x (from 180 W) and row y (from the north), each below 2^level.
+uint64_t LSQuadKeyFromTile(uint32_t x, uint32_t y, unsigned level);
+void LSQuadKeyTile(uint64_t key, uint32_t *x, uint32_t *y);
+// buffer needs level + 1 bytes.
+void LSQuadKeyToString(uint64_t key, unsigned level, char *buffer);
+unsigned LSQuadKeyFromString(const char *string, uint64_t *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LSGeoCell_h */
@@ -0,0 +1,280 @@
+//
+//  LSGeoDistance.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-03.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSGeoDistance.h"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+const double kRadians = kPi / 180.0;
+const double kMeanRadius = 6371008.8;
+const double kEquatorialRadius = 6378137.0;
+const double kFlattening = 1.0 / 298.257223563;
+// Adding and subtracting 1.5 * 2^52 rounds to the nearest integer without a
+// rounding instruction, which SSE2 does not have.
+const double kRoundMagic = 6755399441055744.0;
+const double kTiny = 1e-300;
+
+#pragma mark - Lanes
+
+// Every instruction set gets the same handful of operations so the kernels
+// below are written once. The iOS slices are compiled separately, so the
+// choice is made by the preprocessor and never at run time.
+
+struct ScalarLanes {
+    typedef double V;
+    static const size_t width = 1;
+    static V load(const double *p) { return *p; }
+    static void store(double *p, V v) { *p = v; }
+    static V set(double x) { return x; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+    static V div(V a, V b) { return a / b; }
+    static V sqrt(V a) { return std::sqrt(a); }
+    static V min(V a, V b) { return a < b ? a : b; }
+    static V max(V a, V b) { return a > b ? a : b; }
+};
+
+#if defined(__AVX__)
+struct VectorLanes {
+    typedef __m256d V;
+    static const size_t width = 4;
+    static V load(const double *p) { return _mm256_loadu_pd(p); }
+    static void store(double *p, V v) { _mm256_storeu_pd(p, v); }
+    static V set(double x) { return _mm256_set1_pd(x); }
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    static V div(V a, V b) { return _mm256_div_pd(a, b); }
+    static V sqrt(V a) { return _mm256_sqrt_pd(a); }
+    static V min(V a, V b) { return _mm256_min_pd(a, b); }
+    static V max(V a, V b) { return _mm256_max_pd(a, b); }
+};
+#elif defined(__SSE2__)
+struct VectorLanes {
+    typedef __m128d V;
+    static const size_t width = 2;
+    static V load(const double *p) { return _mm_loadu_pd(p); }
+    static void store(double *p, V v) { _mm_storeu_pd(p, v); }
+    static V set(double x) { return _mm_set1_pd(x); }
+    static V add(V a, V b) { return _mm_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+    static V div(V a, V b) { return _mm_div_pd(a, b); }
+    static V sqrt(V a) { return _mm_sqrt_pd(a); }
+    static V min(V a, V b) { return _mm_min_pd(a, b); }
+    static V max(V a, V b) { return _mm_max_pd(a, b); }
+};
+#elif defined(__aarch64__)
+struct VectorLanes {
+    typedef float64x2_t V;
+    static const size_t width = 2;
+    static V load(const double *p) { return vld1q_f64(p); }
+    static void store(double *p, V v) { vst1q_f64(p, v); }
+    static V set(double x) { return vdupq_n_f64(x); }
+    static V add(V a, V b) { return vaddq_f64(a, b); }
+    static V sub(V a, V b) { return vsubq_f64(a, b); }
+    static V mul(V a, V b) { return vmulq_f64(a, b); }
+    static V div(V a, V b) { return vdivq_f64(a, b); }
+    static V sqrt(V a) { return vsqrtq_f64(a); }
+    static V min(V a, V b) { return vminq_f64(a, b); }
+    static V max(V a, V b) { return vmaxq_f64(a, b); }
+};
+#else
+// 32-bit ARM has no double precision vectors.
+typedef ScalarLanes VectorLanes;
+#endif
+
+#pragma mark - Polynomials
+
+// sin(x) for |x| <= pi/2, Taylor series up to x^19 (error below 1e-15).
+template <class L>
+inline typename L::V sinHalfTurn(typename L::V x)
+{
+    typename L::V x2 = L::mul(x, x);
+    typename L::V p = L::set(-1.0 / 121645100408832000.0);
+    p = L::add(L::mul(p, x2), L::set(1.0 / 355687428096000.0));
+    p = L::add(L::mul(p, x2), L::set(-1.0 / 1307674368000.0));
+    p = L::add(L::mul(p, x2), L::set(1.0 / 6227020800.0));
+    p = L::add(L::mul(p, x2), L::set(-1.0 / 39916800.0));
+    p = L::add(L::mul(p, x2), L::set(1.0 / 362880.0));
+    p = L::add(L::mul(p, x2), L::set(-1.0 / 5040.0));
+    p = L::add(L::mul(p, x2), L::set(1.0 / 120.0));
+    p = L::add(L::mul(p, x2), L::set(-1.0 / 6.0));
+    p = L::add(L::mul(p, x2), L::set(1.0));
+    return L::mul(p, x);
+}
+
+// Wraps an angle in radians into [-pi, pi].
+template <class L>
+inline typename L::V wrapAngle(typename L::V x)
+{
+    typename L::V turns = L::mul(x, L::set(1.0 / (2.0 * kPi)));
+    turns = L::sub(L::add(turns, L::set(kRoundMagic)), L::set(kRoundMagic));
+    return L::sub(x, L::mul(turns, L::set(2.0 * kPi)));
+}
+
+// Central angle whose haversine is h * h, for h in [0, 1].
+//
+// asin is reduced with the half angle identity tan(t / 2) = tan(t) / (1 + sec(t))
+// until the argument is below tan(pi / 16), where a short atan series is exact
+// to double precision. Only sqrt and division are needed.
+template <class L>
+inline typename L::V centralAngle(typename L::V h)
+{
+    typename L::V one = L::set(1.0);
+    typename L::V c = L::sqrt(L::max(L::sub(one, L::mul(h, h)), L::set(0.0)));
+    typename L::V u = L::div(h, L::add(one, c));
+    typename L::V v = L::div(u, L::add(one, L::sqrt(L::add(one, L::mul(u, u)))));
+    typename L::V w = L::div(v, L::add(one, L::sqrt(L::add(one, L::mul(v, v)))));
+
+    typename L::V w2 = L::mul(w, w);
+    typename L::V p = L::set(1.0 / 21.0);
+    p = L::add(L::mul(p, w2), L::set(-1.0 / 19.0));
+    p = L::add(L::mul(p, w2), L::set(1.0 / 17.0));
+    p = L::add(L::mul(p, w2), L::set(-1.0 / 15.0));
+    p = L::add(L::mul(p, w2), L::set(1.0 / 13.0));
+    p = L::add(L::mul(p, w2), L::set(-1.0 / 11.0));
+    p = L::add(L::mul(p, w2), L::set(1.0 / 9.0));
+    p = L::add(L::mul(p, w2), L::set(-1.0 / 7.0));
+    p = L::add(L::mul(p, w2), L::set(1.0 / 5.0));
+    p = L::add(L::mul(p, w2), L::set(-1.0 / 3.0));
+    p = L::add(L::mul(p, w2), L::set(1.0));
+    p = L::mul(p, w);
+
+    // asin(h) = 8 atan(w), the central angle is twice that.
+    return L::mul(p, L::set(16.0));
+}
+
+#pragma mark - Kernels
+
+struct Center {
+    double latitude;
+    double longitude;
+    double cosLatitude;
+    double sinReduced;
+    double cosReduced;
+
+    Center(double lat, double lon)
+        : latitude(lat * kRadians), longitude(lon * kRadians)
+    {
+        cosLatitude = std::cos(latitude);
+        double denominator = std::sqrt(cosLatitude * cosLatitude + (1.0 - kFlattening) * (1.0 - kFlattening) * std::sin(latitude) * std::sin(latitude));
+        sinReduced = (1.0 - kFlattening) * std::sin(latitude) / denominator;
+        cosReduced = cosLatitude / denominator;
+    }
+};
+
+template <class L>
+inline typename L::V haversine(const Center &center, typename L::V lat, typename L::V lon)
+{
+    typename L::V half = L::set(0.5);
+    typename L::V phi = L::mul(lat, L::set(kRadians));
+    typename L::V dPhi = L::sub(phi, L::set(center.latitude));
+    typename L::V dLambda = wrapAngle<L>(L::sub(L::mul(lon, L::set(kRadians)), L::set(center.longitude)));
+
+    typename L::V sinPhi = sinHalfTurn<L>(L::mul(dPhi, half));
+    typename L::V sinLambda = sinHalfTurn<L>(L::mul(dLambda, half));
+    typename L::V sinHalfPhi = sinHalfTurn<L>(L::mul(phi, half));
+    typename L::V cosPhi = L::sub(L::set(1.0), L::mul(L::set(2.0), L::mul(sinHalfPhi, sinHalfPhi)));
+
+    typename L::V a = L::add(L::mul(sinPhi, sinPhi), L::mul(L::mul(L::set(center.cosLatitude), cosPhi), L::mul(sinLambda, sinLambda)));
+    a = L::min(L::max(a, L::set(0.0)), L::set(1.0));
+
+    return L::mul(centralAngle<L>(L::sqrt(a)), L::set(kMeanRadius));
+}
+
+template <class L>
+inline typename L::V vincenty(const Center &center, typename L::V lat, typename L::V lon)
+{
+    typename L::V one = L::set(1.0);
+    typename L::V half = L::set(0.5);
+    typename L::V tiny = L::set(kTiny);
+
+    typename L::V phi = L::mul(lat, L::set(kRadians));
+    typename L::V dLambda = wrapAngle<L>(L::sub(L::mul(lon, L::set(kRadians)), L::set(center.longitude)));
+
+    // Reduced latitude of the point, straight from sin and cos of phi.
+    typename L::V sinPhi = sinHalfTurn<L>(phi);
+    typename L::V sinHalfPhi = sinHalfTurn<L>(L::mul(phi, half));
+    typename L::V cosPhi = L::sub(one, L::mul(L::set(2.0), L::mul(sinHalfPhi, sinHalfPhi)));
+    typename L::V scaledSin = L::mul(sinPhi, L::set(1.0 - kFlattening));
+    typename L::V denominator = L::sqrt(L::add(L::mul(cosPhi, cosPhi), L::mul(scaledSin, scaledSin)));
+    typename L::V sinBeta = L::div(scaledSin, denominator);
+    typename L::V cosBeta = L::div(cosPhi, denominator);
+
+    typename L::V sinBeta1 = L::set(center.sinReduced);
+    typename L::V cosBeta1 = L::set(center.cosReduced);
+
+    // sin^2 of half the reduced latitude difference, without the cancellation
+    // of 1 - cos for nearby points.
+    typename L::V sinDiff = L::sub(L::mul(sinBeta, cosBeta1), L::mul(cosBeta, sinBeta1));
+    typename L::V cosDiff = L::add(L::mul(cosBeta, cosBeta1), L::mul(sinBeta, sinBeta1));
+    typename L::V sin2Q = L::div(L::mul(sinDiff, sinDiff), L::add(L::mul(L::set(2.0), L::add(one, cosDiff)), tiny));
+    typename L::V cosSum = L::sub(L::mul(cosBeta, cosBeta1), L::mul(sinBeta, sinBeta1));
+    typename L::V sin2P = L::mul(L::sub(one, cosSum), half);
+
+    typename L::V sinLambda = sinHalfTurn<L>(L::mul(dLambda, half));
+    typename L::V h2 = L::add(sin2Q, L::mul(L::mul(cosBeta, cosBeta1), L::mul(sinLambda, sinLambda)));
+    h2 = L::min(L::max(h2, L::set(0.0)), one);
+    typename L::V h = L::sqrt(h2);
+
+    typename L::V sigma = centralAngle<L>(h);
+    typename L::V sinSigma = L::mul(L::mul(L::set(2.0), h), L::sqrt(L::sub(one, h2)));
+
+    typename L::V x = L::div(L::mul(L::mul(L::sub(sigma, sinSigma), sin2P), L::sub(one, sin2Q)), L::add(L::sub(one, h2), tiny));
+    typename L::V y = L::div(L::mul(L::mul(L::add(sigma, sinSigma), L::sub(one, sin2P)), sin2Q), L::add(h2, tiny));
+
+    typename L::V correction = L::mul(L::set(kFlattening * 0.5), L::add(x, y));
+    return L::mul(L::sub(sigma, correction), L::set(kEquatorialRadius));
+}
+
+template <class L>
+inline typename L::V distance(const Center &center, typename L::V lat, typename L::V lon, LSGeoDistanceMode mode)
+{
+    if (mode == LSGeoDistanceVincenty) {
+        return vincenty<L>(center, lat, lon);
+    }
+    return haversine<L>(center, lat, lon);
+}
+
+template <class L>
+size_t distanceBatch(const Center &center, const double *latitudes, const double *longitudes, size_t count, double *distances, LSGeoDistanceMode mode)
+{
+    size_t i = 0;
+    for (; i + L::width <= count; i += L::width) {
+        L::store(distances + i, distance<L>(center, L::load(latitudes + i), L::load(longitudes + i), mode));
+    }
+    return i;
+}
+
+} // namespace
+
+double LSGeoDistance(double latitude1, double longitude1, double latitude2, double longitude2, LSGeoDistanceMode mode)
+{
+    return distance<ScalarLanes>(Center(latitude1, longitude1), latitude2, longitude2, mode);
+}
+
+void LSGeoDistanceBatch(double centerLatitude, double centerLongitude, const double *latitudes, const double *longitudes, size_t count, double *distances, LSGeoDistanceMode mode)
+{
+    Center center(centerLatitude, centerLongitude);
+
+    size_t done = distanceBatch<VectorLanes>(center, latitudes, longitudes, count, distances, mode);
+    distanceBatch<ScalarLanes>(center, latitudes + done, longitudes + done, count - done, distances + done, mode);
+}
@@ -0,0 +1,39 @@
+//
+//  LSGeoDistance.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-03.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSGeoDistance_h
+#define LSGeoDistance_h
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Distances are in meters, coordinates in degrees like KiiGeoPoint.
+//
+// Haversine works on a sphere of the mean earth radius and matches what
+// KiiClause geoDistance reports. Vincenty uses Lambert's closed form on the
+// WGS-84 ellipsoid, which stays within about 10 m of the iterative Vincenty
+// result but has no loop and therefore vectorizes.
+
+typedef enum {
+    LSGeoDistanceHaversine,
+    LSGeoDistanceVincenty
+} LSGeoDistanceMode;
+
+double LSGeoDistance(double latitude1, double longitude1, double latitude2, double longitude2, LSGeoDistanceMode mode);
+
+// Writes the distance from the center to every point into distances.
+void LSGeoDistanceBatch(double centerLatitude, double centerLongitude, const double *latitudes, const double *longitudes, size_t count, double *distances, LSGeoDistanceMode mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LSGeoDistance_h */
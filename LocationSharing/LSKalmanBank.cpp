@@ -0,0 +1,229 @@
+//
+//  LSKalmanBank.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-25.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSKalmanBank.h"
+
+#include <algorithm>
+#include <cmath>
+
+const int64_t LSKalmanBank::kUnset;
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+const double kMeanRadius = 6371008.8;
+const double kMetersPerDegree = kMeanRadius * kPi / 180.0;
+
+// Velocity is unknown on the first fix, people rarely move faster than this.
+const double kInitialVelocityVariance = 25.0;
+const double kMinimumAccuracy = 1.0;
+
+#pragma mark - Local frame
+
+inline double metersPerDegreeEast(double originLatitude)
+{
+    return kMetersPerDegree * std::max(std::cos(originLatitude * kPi / 180.0), 1e-6);
+}
+
+inline double wrapLongitude(double longitude)
+{
+    if (longitude >= 180.0) {
+        longitude -= 360.0;
+    } else if (longitude < -180.0) {
+        longitude += 360.0;
+    }
+    return longitude;
+}
+
+inline void toDegrees(double originLatitude, double originLongitude, double east, double north, double &latitude, double &longitude)
+{
+    latitude = std::min(std::max(originLatitude + north / kMetersPerDegree, -90.0), 90.0);
+    longitude = wrapLongitude(originLongitude + east / metersPerDegreeEast(originLatitude));
+}
+
+} // namespace
+
+#pragma mark - Filters
+
+void LSKalmanBank::reserve(uint32_t filterID)
+{
+    if (filterID < time.size()) {
+        return;
+    }
+    size_t size = static_cast<size_t>(filterID) + 1;
+    originLatitude.resize(size);
+    originLongitude.resize(size);
+    east.resize(size);
+    north.resize(size);
+    eastVelocity.resize(size);
+    northVelocity.resize(size);
+    positionVariance.resize(size);
+    covariance.resize(size);
+    velocityVariance.resize(size);
+    time.resize(size, kUnset);
+}
+
+void LSKalmanBank::start(uint32_t filterID, int64_t ts, double lat, double lon, double variance)
+{
+    originLatitude[filterID] = lat;
+    originLongitude[filterID] = lon;
+    east[filterID] = 0.0;
+    north[filterID] = 0.0;
+    eastVelocity[filterID] = 0.0;
+    northVelocity[filterID] = 0.0;
+    positionVariance[filterID] = variance;
+    covariance[filterID] = 0.0;
+    velocityVariance[filterID] = kInitialVelocityVariance;
+    time[filterID] = ts;
+}
+
+bool LSKalmanBank::update(uint32_t filterID, int64_t ts, double lat, double lon, double accuracy)
+{
+    reserve(filterID);
+
+    accuracy = std::max(accuracy, kMinimumAccuracy);
+    double r = accuracy * accuracy;
+
+    int64_t last = time[filterID];
+    if (last == kUnset || ts - last > maxGap) {
+        start(filterID, ts, lat, lon, r);
+        return true;
+    }
+    if (ts <= last) {
+        return false;
+    }
+
+    // Predict to the fix with white noise acceleration.
+    double dt = static_cast<double>(ts - last) / 1000.0;
+    double p00 = positionVariance[filterID];
+    double p01 = covariance[filterID];
+    double p11 = velocityVariance[filterID];
+    double q = processNoise;
+
+    p00 += dt * (2.0 * p01 + dt * p11) + q * dt * dt * dt / 3.0;
+    p01 += dt * p11 + q * dt * dt / 2.0;
+    p11 += q * dt;
+
+    double e = east[filterID] + eastVelocity[filterID] * dt;
+    double n = north[filterID] + northVelocity[filterID] * dt;
+
+    // The fix in the frame of the filter.
+    double measuredEast = wrapLongitude(lon - originLongitude[filterID]) * metersPerDegreeEast(originLatitude[filterID]);
+    double measuredNorth = (lat - originLatitude[filterID]) * kMetersPerDegree;
+
+    double s = p00 + r;
+    double k0 = p00 / s;
+    double k1 = p01 / s;
+
+    double innovationEast = measuredEast - e;
+    double innovationNorth = measuredNorth - n;
+
+    e += k0 * innovationEast;
+    n += k0 * innovationNorth;
+    eastVelocity[filterID] += k1 * innovationEast;
+    northVelocity[filterID] += k1 * innovationNorth;
+
+    velocityVariance[filterID] = p11 - k1 * p01;
+    covariance[filterID] = (1.0 - k0) * p01;
+    positionVariance[filterID] = (1.0 - k0) * p00;
+
+    // Move the origin to the estimate, so the flat frame stays small.
+    double estimateLatitude, estimateLongitude;
+    toDegrees(originLatitude[filterID], originLongitude[filterID], e, n, estimateLatitude, estimateLongitude);
+    originLatitude[filterID] = estimateLatitude;
+    originLongitude[filterID] = estimateLongitude;
+    east[filterID] = 0.0;
+    north[filterID] = 0.0;
+    time[filterID] = ts;
+
+    return true;
+}
+
+void LSKalmanBank::reset(uint32_t filterID)
+{
+    if (filterID < time.size()) {
+        time[filterID] = kUnset;
+    }
+}
+
+bool LSKalmanBank::predict(uint32_t filterID, int64_t ts, double &lat, double &lon) const
+{
+    if (!has(filterID)) {
+        return false;
+    }
+    double dt = static_cast<double>(std::min(std::max(ts - time[filterID], int64_t(0)), maxHorizon)) / 1000.0;
+    toDegrees(originLatitude[filterID], originLongitude[filterID], east[filterID] + eastVelocity[filterID] * dt, north[filterID] + northVelocity[filterID] * dt, lat, lon);
+    return true;
+}
+
+void LSKalmanBank::predict(const uint32_t *filterIDs, const double *lats, const double *lons, size_t count, int64_t ts, double *outLats, double *outLons) const
+{
+    for (size_t i = 0; i < count; i++) {
+        if (!predict(filterIDs[i], ts, outLats[i], outLons[i])) {
+            outLats[i] = lats[i];
+            outLons[i] = lons[i];
+        }
+    }
+}
+
+#pragma mark - C interface
+
+LSKalmanBankRef LSKalmanBankCreate(double processNoise)
+{
+    return new LSKalmanBank(processNoise);
+}
+
+void LSKalmanBankDestroy(LSKalmanBankRef bank)
+{
+    delete bank;
+}
+
+void LSKalmanBankSetMaxHorizon(LSKalmanBankRef bank, int64_t horizon)
+{
+    bank->maxHorizon = std::max(horizon, int64_t(0));
+}
+
+void LSKalmanBankSetMaxGap(LSKalmanBankRef bank, int64_t gap)
+{
+    bank->maxGap = std::max(gap, int64_t(0));
+}
+
+bool LSKalmanBankUpdate(LSKalmanBankRef bank, uint32_t filterID, int64_t timestamp, double latitude, double longitude, double accuracy)
+{
+    return bank->update(filterID, timestamp, latitude, longitude, accuracy);
+}
+
+size_t LSKalmanBankUpdateMembers(LSKalmanBankRef bank, LSMemberTableRef table, double accuracy)
+{
+    size_t updated = 0;
+    for (size_t row = 0; row < table->size(); row++) {
+        uint32_t user = table->userIndex[row];
+        if (bank->has(user) && table->timestamp[row] <= bank->lastTime(user)) {
+            continue;
+        }
+        if (bank->update(user, table->timestamp[row], table->latitude[row], table->longitude[row], accuracy)) {
+            updated++;
+        }
+    }
+    return updated;
+}
+
+void LSKalmanBankReset(LSKalmanBankRef bank, uint32_t filterID)
+{
+    bank->reset(filterID);
+}
+
+bool LSKalmanBankPredict(LSKalmanBankRef bank, uint32_t filterID, int64_t timestamp, double *latitude, double *longitude)
+{
+    return bank->predict(filterID, timestamp, *latitude, *longitude);
+}
+
+void LSKalmanBankPredictMembers(LSKalmanBankRef bank, LSMemberTableRef table, int64_t timestamp, double *latitudes, double *longitudes)
+{
+    bank->predict(table->userIndex.data(), table->latitude.data(), table->longitude.data(), table->size(), timestamp, latitudes, longitudes);
+}
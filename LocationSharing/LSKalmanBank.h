@@ -0,0 +1,106 @@
+//
+//  LSKalmanBank.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-25.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSKalmanBank_h
+#define LSKalmanBank_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "LSMemberTable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Constant velocity Kalman filters for every member, smoothing GPS noise and
+// predicting where a pin is between two server updates.
+//
+// Each filter tracks position and velocity east and north, in meters around
+// its last fix. Measurements are isotropic, so both axes share one 2 x 2
+// covariance and a filter is 7 doubles. The state is kept in columns indexed
+// by the member table user index, so a tick over every member is a few
+// straight loops.
+//
+// processNoise is the acceleration noise density in m^2/s^3; 1 suits people
+// walking, larger values follow turns and stops faster. Times are in ms.
+
+typedef struct LSKalmanBank *LSKalmanBankRef;
+
+LSKalmanBankRef LSKalmanBankCreate(double processNoise);
+void LSKalmanBankDestroy(LSKalmanBankRef bank);
+
+// Longest extrapolation past the last fix, pins stop there until the next
+// update arrives. 10 s by default.
+void LSKalmanBankSetMaxHorizon(LSKalmanBankRef bank, int64_t horizon);
+
+// Filters restart from the fix after a gap this long. 60 s by default.
+void LSKalmanBankSetMaxGap(LSKalmanBankRef bank, int64_t gap);
+
+// Feeds one fix with its horizontal accuracy in meters. Fixes not newer than
+// the last one of the filter are ignored, returns whether it was used.
+bool LSKalmanBankUpdate(LSKalmanBankRef bank, uint32_t filterID, int64_t timestamp, double latitude, double longitude, double accuracy);
+
+// Feeds the row of every member whose timestamp moved past its filter.
+// Returns the number of filters updated.
+size_t LSKalmanBankUpdateMembers(LSKalmanBankRef bank, LSMemberTableRef table, double accuracy);
+
+void LSKalmanBankReset(LSKalmanBankRef bank, uint32_t filterID);
+
+// Returns false when the filter has no fix yet.
+bool LSKalmanBankPredict(LSKalmanBankRef bank, uint32_t filterID, int64_t timestamp, double *latitude, double *longitude);
+
+// Predicted location of every row of the table at the time. Members without
+// a filter get their table location.
+void LSKalmanBankPredictMembers(LSKalmanBankRef bank, LSMemberTableRef table, int64_t timestamp, double *latitudes, double *longitudes);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+struct LSKalmanBank {
+    double processNoise = 1.0;
+    int64_t maxHorizon = 10000;
+    int64_t maxGap = 60000;
+
+    explicit LSKalmanBank(double noise) : processNoise(noise) {}
+
+    bool update(uint32_t filterID, int64_t ts, double lat, double lon, double accuracy);
+    void reset(uint32_t filterID);
+    bool predict(uint32_t filterID, int64_t ts, double &lat, double &lon) const;
+    void predict(const uint32_t *filterIDs, const double *lats, const double *lons, size_t count, int64_t ts, double *outLats, double *outLons) const;
+
+    bool has(uint32_t filterID) const { return filterID < time.size() && time[filterID] != kUnset; }
+    int64_t lastTime(uint32_t filterID) const { return filterID < time.size() ? time[filterID] : kUnset; }
+
+private:
+    static const int64_t kUnset = INT64_MIN;
+
+    // Origin of each filter, the last fix folded into the state.
+    std::vector<double> originLatitude;
+    std::vector<double> originLongitude;
+    // Offset and velocity in meters from the origin.
+    std::vector<double> east;
+    std::vector<double> north;
+    std::vector<double> eastVelocity;
+    std::vector<double> northVelocity;
+    // Shared covariance of both axes: position, cross term and velocity.
+    std::vector<double> positionVariance;
+    std::vector<double> covariance;
+    std::vector<double> velocityVariance;
+    std::vector<int64_t> time;
+
+    void reserve(uint32_t filterID);
+    void start(uint32_t filterID, int64_t ts, double lat, double lon, double variance);
+};
+
+#endif
+
+#endif /* LSKalmanBank_h */
@@ -0,0 +1,253 @@
+//
+//  LSLocationFrame.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-29.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSLocationFrame.h"
+
+#include <algorithm>
+#include <cmath>
+
+const uint32_t LSLocationFrameDecoder::kAmbiguous;
+
+namespace {
+
+const uint8_t kMagic = 0x4c;
+const uint8_t kVersion = 1;
+
+const double kPositionSteps = 67108864.0; // 2^26
+const uint64_t kPositionMask = (1 << 26) - 1;
+const uint8_t kUnknown = 255;
+const int64_t kTimeUnit = 10;
+const int64_t kMaxTimeSteps = 4095;
+
+#pragma mark - Fields
+
+uint64_t quantizeLatitude(double latitude)
+{
+    double clamped = std::min(std::max(latitude, -90.0), 90.0);
+    return static_cast<uint64_t>(std::lround((clamped + 90.0) / 180.0 * (kPositionSteps - 1.0)));
+}
+
+uint64_t quantizeLongitude(double longitude)
+{
+    double turns = (longitude + 180.0) / 360.0;
+    turns -= std::floor(turns);
+    return static_cast<uint64_t>(std::lround(turns * kPositionSteps)) & kPositionMask;
+}
+
+uint64_t quantizeHeading(double heading, double speed)
+{
+    if (heading < 0.0 || speed <= 0.0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(std::lround(heading / 360.0 * 256.0)) & 0xff;
+}
+
+uint64_t quantizeSpeed(double speed)
+{
+    if (speed < 0.0 || std::isnan(speed)) {
+        return kUnknown;
+    }
+    return static_cast<uint64_t>(std::min(std::lround(speed * 4.0), 254L));
+}
+
+uint64_t quantizeAccuracy(double accuracy)
+{
+    if (accuracy < 0.0 || std::isnan(accuracy) || accuracy > 254.0) {
+        return kUnknown;
+    }
+    return static_cast<uint64_t>(std::lround(accuracy));
+}
+
+inline void storeLittleEndian(uint8_t *bytes, uint64_t value, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++) {
+        bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+inline uint64_t loadLittleEndian(const uint8_t *bytes, unsigned count)
+{
+    uint64_t value = 0;
+    for (unsigned i = 0; i < count; i++) {
+        value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+#pragma mark - Records
+
+// The first 64 bits hold the key, the latitude and 6 bits of the longitude,
+// the other 56 the rest.
+void encodeRecord(const LSLocationRecord &record, int64_t base, uint8_t *bytes)
+{
+    uint64_t longitude = quantizeLongitude(record.longitude);
+    uint64_t low = record.userKey | (quantizeLatitude(record.latitude) << 32) | ((longitude & 0x3f) << 58);
+    uint64_t high = (longitude >> 6)
+        | (quantizeHeading(record.heading, record.speed) << 20)
+        | (quantizeSpeed(record.speed) << 28)
+        | (quantizeAccuracy(record.accuracy) << 36)
+        | (static_cast<uint64_t>((record.timestamp - base) / kTimeUnit) << 44);
+    storeLittleEndian(bytes, low, 8);
+    storeLittleEndian(bytes + 8, high, 7);
+}
+
+void decodeRecord(const uint8_t *bytes, int64_t base, LSLocationRecord &record)
+{
+    uint64_t low = loadLittleEndian(bytes, 8);
+    uint64_t high = loadLittleEndian(bytes + 8, 7);
+
+    record.userKey = static_cast<uint32_t>(low);
+    record.latitude = static_cast<double>((low >> 32) & kPositionMask) / (kPositionSteps - 1.0) * 180.0 - 90.0;
+    uint64_t longitude = (low >> 58) | ((high & 0xfffff) << 6);
+    record.longitude = static_cast<double>(longitude) / kPositionSteps * 360.0 - 180.0;
+
+    uint64_t speed = (high >> 28) & 0xff;
+    record.speed = speed == kUnknown ? -1.0 : static_cast<double>(speed) / 4.0;
+    record.heading = record.speed > 0.0 ? static_cast<double>((high >> 20) & 0xff) / 256.0 * 360.0 : -1.0;
+    uint64_t accuracy = (high >> 36) & 0xff;
+    record.accuracy = accuracy == kUnknown ? -1.0 : static_cast<double>(accuracy);
+    record.timestamp = base + static_cast<int64_t>((high >> 44) & 0xfff) * kTimeUnit;
+}
+
+inline int64_t baseOf(const uint8_t *bytes)
+{
+    return static_cast<int64_t>(loadLittleEndian(bytes + 4, 8));
+}
+
+} // namespace
+
+#pragma mark - Decoder
+
+void LSLocationFrameDecoder::refresh()
+{
+    for (; hashed < table->userCount(); hashed++) {
+        uint32_t user = static_cast<uint32_t>(hashed);
+        uint32_t key = LSLocationFrameUserKey(table->userID(user).c_str());
+        auto inserted = users.emplace(key, user);
+        if (!inserted.second) {
+            inserted.first->second = kAmbiguous;
+        }
+    }
+}
+
+void LSLocationFrameDecoder::apply(const uint8_t *bytes, size_t length, std::vector<uint32_t> &rows)
+{
+    int64_t count = LSLocationFrameCount(bytes, length);
+    if (count <= 0) {
+        return;
+    }
+
+    refresh();
+
+    int64_t base = baseOf(bytes);
+    const uint8_t *record = bytes + LSLocationFrameHeaderSize;
+
+    for (int64_t i = 0; i < count; i++, record += LSLocationFrameRecordSize) {
+        // The key alone decides whether the record is worth decoding.
+        auto found = users.find(static_cast<uint32_t>(loadLittleEndian(record, 4)));
+        if (found == users.end() || found->second == kAmbiguous) {
+            continue;
+        }
+        int64_t row = table->rowForUserIndex(found->second);
+        if (row < 0) {
+            continue;
+        }
+        LSLocationRecord decoded;
+        decodeRecord(record, base, decoded);
+        if (decoded.timestamp <= table->timestamp[row]) {
+            continue;
+        }
+        table->set(static_cast<uint32_t>(row), decoded.latitude, decoded.longitude, decoded.timestamp);
+        rows.push_back(static_cast<uint32_t>(row));
+    }
+}
+
+#pragma mark - C interface
+
+uint32_t LSLocationFrameUserKey(const char *userID)
+{
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = reinterpret_cast<const unsigned char *>(userID); *c; c++) {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return hash;
+}
+
+size_t LSLocationFrameEncode(const LSLocationRecord *records, size_t count, uint8_t *buffer, size_t capacity)
+{
+    if (count > LSLocationFrameMaxRecords) {
+        return 0;
+    }
+
+    int64_t base = 0;
+    if (count > 0) {
+        auto range = std::minmax_element(records, records + count, [](const LSLocationRecord &a, const LSLocationRecord &b) {
+            return a.timestamp < b.timestamp;
+        });
+        base = range.first->timestamp;
+        if ((range.second->timestamp - base) / kTimeUnit > kMaxTimeSteps) {
+            return 0;
+        }
+    }
+
+    size_t size = LSLocationFrameHeaderSize + count * LSLocationFrameRecordSize;
+    if (!buffer || size > capacity) {
+        return size;
+    }
+
+    buffer[0] = kMagic;
+    buffer[1] = kVersion;
+    storeLittleEndian(buffer + 2, count, 2);
+    storeLittleEndian(buffer + 4, static_cast<uint64_t>(base), 8);
+
+    for (size_t i = 0; i < count; i++) {
+        encodeRecord(records[i], base, buffer + LSLocationFrameHeaderSize + i * LSLocationFrameRecordSize);
+    }
+
+    return size;
+}
+
+int64_t LSLocationFrameCount(const uint8_t *bytes, size_t length)
+{
+    if (length < LSLocationFrameHeaderSize || bytes[0] != kMagic || bytes[1] != kVersion) {
+        return -1;
+    }
+    size_t count = static_cast<size_t>(loadLittleEndian(bytes + 2, 2));
+    if (length != LSLocationFrameHeaderSize + count * LSLocationFrameRecordSize) {
+        return -1;
+    }
+    return static_cast<int64_t>(count);
+}
+
+bool LSLocationFrameRecordAt(const uint8_t *bytes, size_t length, size_t index, LSLocationRecord *record)
+{
+    int64_t count = LSLocationFrameCount(bytes, length);
+    if (count < 0 || index >= static_cast<size_t>(count)) {
+        return false;
+    }
+    decodeRecord(bytes + LSLocationFrameHeaderSize + index * LSLocationFrameRecordSize, baseOf(bytes), *record);
+    return true;
+}
+
+LSLocationFrameDecoderRef LSLocationFrameDecoderCreate(LSMemberTableRef table)
+{
+    return new LSLocationFrameDecoder(table);
+}
+
+void LSLocationFrameDecoderDestroy(LSLocationFrameDecoderRef decoder)
+{
+    delete decoder;
+}
+
+size_t LSLocationFrameDecoderApply(LSLocationFrameDecoderRef decoder, const uint8_t *bytes, size_t length, uint32_t *rows, size_t capacity)
+{
+    std::vector<uint32_t> moved;
+    decoder->apply(bytes, length, moved);
+    std::copy(moved.begin(), moved.begin() + std::min(moved.size(), capacity), rows);
+    return moved.size();
+}
@@ -0,0 +1,106 @@
+//
+//  LSLocationFrame.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-29.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSLocationFrame_h
+#define LSLocationFrame_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "LSMemberTable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Binary location updates for push payloads, 15 bytes per member.
+//
+// A frame is a 12 byte header (magic, version, record count, base time in
+// ms) followed by fixed 120 bit records, little endian:
+//
+//   user key      32  FNV-1a hash of the user ID
+//   latitude      26  about 0.3 m
+//   longitude     26  about 0.6 m at the equator
+//   heading        8  1.4 degrees
+//   speed          8  0.25 m/s up to 63.5, 255 when unknown
+//   accuracy       8  meters up to 254, 255 when unknown or worse
+//   time          12  10 ms after the base time, up to 40.95 s
+//
+// Times are in server time, the base of the _modified times the member table
+// is loaded with, so a record and a saved object compare (see ServerClock).
+//
+// Member table user indices are local to each device, so records carry a
+// hash of the user ID instead; a receiver matches it against the members it
+// knows and ignores the others (and the rare keys two of its members share).
+
+#define LSLocationFrameHeaderSize 12
+#define LSLocationFrameRecordSize 15
+#define LSLocationFrameMaxRecords 65535
+
+typedef struct {
+    uint32_t userKey;
+    double latitude;
+    double longitude;
+    // Degrees clockwise from north, negative when unknown.
+    double heading;
+    // Negative when unknown, like CLLocation.
+    double speed;
+    double accuracy;
+    int64_t timestamp;
+} LSLocationRecord;
+
+uint32_t LSLocationFrameUserKey(const char *userID);
+
+// Encodes the records and returns the size of the frame, writing it only
+// when it fits in capacity bytes. Returns 0 when there are too many records
+// or they span more than the 40.95 s a frame can hold.
+size_t LSLocationFrameEncode(const LSLocationRecord *records, size_t count, uint8_t *buffer, size_t capacity);
+
+// Returns the number of records, -1 when the bytes are not a frame.
+int64_t LSLocationFrameCount(const uint8_t *bytes, size_t length);
+// Decodes one record in place, false when index is out of range.
+bool LSLocationFrameRecordAt(const uint8_t *bytes, size_t length, size_t index, LSLocationRecord *record);
+
+// Matches user keys to the members of one table.
+typedef struct LSLocationFrameDecoder *LSLocationFrameDecoderRef;
+
+LSLocationFrameDecoderRef LSLocationFrameDecoderCreate(LSMemberTableRef table);
+void LSLocationFrameDecoderDestroy(LSLocationFrameDecoderRef decoder);
+
+// Writes every record newer than the location of its member straight into
+// the table, without copying the frame. Returns the number of rows moved
+// and writes at most capacity of them.
+size_t LSLocationFrameDecoderApply(LSLocationFrameDecoderRef decoder, const uint8_t *bytes, size_t length, uint32_t *rows, size_t capacity);
+
+#ifdef __cplusplus
+}
+
+#include <unordered_map>
+#include <vector>
+
+struct LSLocationFrameDecoder {
+    LSMemberTable *table;
+    // User index by key, kAmbiguous when two members share the key.
+    std::unordered_map<uint32_t, uint32_t> users;
+    // Members of the table hashed so far.
+    size_t hashed = 0;
+
+    static const uint32_t kAmbiguous = UINT32_MAX;
+
+    explicit LSLocationFrameDecoder(LSMemberTable *memberTable) : table(memberTable) {}
+
+    void apply(const uint8_t *bytes, size_t length, std::vector<uint32_t> &rows);
+
+private:
+    void refresh();
+};
+
+#endif
+
+#endif /* LSLocationFrame_h */
@@ -0,0 +1,347 @@
+//
+//  LSMQTTCodec.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-26.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSMQTTCodec.h"
+
+#include <cstring>
+#include <string>
+
+namespace {
+
+const size_t kMaxRemainingLength = 268435455;
+const size_t kMaxStringLength = 65535;
+
+#pragma mark - Encoding
+
+struct Packet {
+    std::vector<uint8_t> body;
+    bool valid = true;
+
+    void byte(uint8_t value)
+    {
+        body.push_back(value);
+    }
+
+    void word(uint16_t value)
+    {
+        body.push_back(static_cast<uint8_t>(value >> 8));
+        body.push_back(static_cast<uint8_t>(value & 0xff));
+    }
+
+    void string(const char *value)
+    {
+        size_t length = value ? std::strlen(value) : 0;
+        if (length > kMaxStringLength) {
+            valid = false;
+            return;
+        }
+        word(static_cast<uint16_t>(length));
+        body.insert(body.end(), value, value + length);
+    }
+
+    void bytes(const uint8_t *value, size_t length)
+    {
+        body.insert(body.end(), value, value + length);
+    }
+
+    // Prepends the fixed header and copies the packet out when it fits.
+    size_t finish(uint8_t header, uint8_t *buffer, size_t capacity) const
+    {
+        if (!valid || body.size() > kMaxRemainingLength) {
+            return 0;
+        }
+        uint8_t fixed[5];
+        size_t fixedLength = 0;
+        fixed[fixedLength++] = header;
+        size_t remaining = body.size();
+        do {
+            uint8_t digit = remaining % 128;
+            remaining /= 128;
+            fixed[fixedLength++] = remaining > 0 ? (digit | 0x80) : digit;
+        } while (remaining > 0);
+
+        size_t size = fixedLength + body.size();
+        if (buffer && size <= capacity) {
+            std::memcpy(buffer, fixed, fixedLength);
+            if (!body.empty()) {
+                std::memcpy(buffer + fixedLength, body.data(), body.size());
+            }
+        }
+        return size;
+    }
+};
+
+inline uint16_t readWord(const uint8_t *bytes)
+{
+    return static_cast<uint16_t>((bytes[0] << 8) | bytes[1]);
+}
+
+} // namespace
+
+#pragma mark - Decoding
+
+void LSMQTTDecoder::feed(const uint8_t *bytes, size_t length)
+{
+    if (failed) {
+        return;
+    }
+    // Packets handed out so far are no longer referenced.
+    if (offset > 0) {
+        buffer.erase(buffer.begin(), buffer.begin() + offset);
+        offset = 0;
+    }
+    buffer.insert(buffer.end(), bytes, bytes + length);
+}
+
+bool LSMQTTDecoder::next(LSMQTTPacket &packet)
+{
+    if (failed) {
+        return false;
+    }
+
+    size_t available = buffer.size() - offset;
+    if (available < 2) {
+        return false;
+    }
+
+    const uint8_t *start = buffer.data() + offset;
+
+    // Remaining length, 1 to 4 bytes of 7 bits.
+    size_t remaining = 0;
+    size_t position = 1;
+    for (unsigned shift = 0;; shift += 7) {
+        if (position >= available) {
+            return false;
+        }
+        uint8_t digit = start[position++];
+        remaining |= static_cast<size_t>(digit & 0x7f) << shift;
+        if (!(digit & 0x80)) {
+            break;
+        }
+        if (position == 5) {
+            failed = true;
+            return false;
+        }
+    }
+
+    if (position + remaining > maxPacketSize) {
+        failed = true;
+        return false;
+    }
+    if (available - position < remaining) {
+        return false;
+    }
+
+    if (!parse(start[0], start + position, remaining, packet)) {
+        failed = true;
+        return false;
+    }
+
+    offset += position + remaining;
+    return true;
+}
+
+bool LSMQTTDecoder::parse(uint8_t header, const uint8_t *body, size_t length, LSMQTTPacket &packet) const
+{
+    std::memset(&packet, 0, sizeof(packet));
+    packet.type = header >> 4;
+    packet.flags = header & 0x0f;
+
+    switch (packet.type) {
+        case LSMQTTConnAck:
+            if (packet.flags != 0 || length != 2 || (body[0] & 0xfe)) {
+                return false;
+            }
+            packet.sessionPresent = body[0] & 1;
+            packet.returnCode = body[1];
+            return true;
+
+        case LSMQTTPublish: {
+            packet.qos = (packet.flags >> 1) & 3;
+            if (packet.qos == 3 || length < 2) {
+                return false;
+            }
+            size_t topicLength = readWord(body);
+            size_t position = 2 + topicLength;
+            if (packet.qos > 0) {
+                position += 2;
+            }
+            if (position > length) {
+                return false;
+            }
+            packet.topic = reinterpret_cast<const char *>(body + 2);
+            packet.topicLength = topicLength;
+            if (packet.qos > 0) {
+                packet.packetID = readWord(body + 2 + topicLength);
+            }
+            packet.payload = body + position;
+            packet.payloadLength = length - position;
+            return true;
+        }
+
+        case LSMQTTPubAck:
+        case LSMQTTPubRec:
+        case LSMQTTPubComp:
+        case LSMQTTUnsubAck:
+            if (packet.flags != 0 || length != 2) {
+                return false;
+            }
+            packet.packetID = readWord(body);
+            return true;
+
+        case LSMQTTPubRel:
+            if (packet.flags != 2 || length != 2) {
+                return false;
+            }
+            packet.packetID = readWord(body);
+            return true;
+
+        case LSMQTTSubAck:
+            if (packet.flags != 0 || length < 3) {
+                return false;
+            }
+            packet.packetID = readWord(body);
+            packet.returnCode = body[2];
+            packet.payload = body + 2;
+            packet.payloadLength = length - 2;
+            return true;
+
+        case LSMQTTPingReq:
+        case LSMQTTPingResp:
+        case LSMQTTDisconnect:
+            return packet.flags == 0 && length == 0;
+
+        // Client packets, decoded loosely for stand-in brokers in tests.
+        case LSMQTTConnect:
+            if (packet.flags != 0) {
+                return false;
+            }
+            packet.payload = body;
+            packet.payloadLength = length;
+            return true;
+
+        case LSMQTTSubscribe:
+        case LSMQTTUnsubscribe:
+            if (packet.flags != 2 || length < 2) {
+                return false;
+            }
+            packet.packetID = readWord(body);
+            packet.payload = body + 2;
+            packet.payloadLength = length - 2;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void LSMQTTDecoder::reset()
+{
+    buffer.clear();
+    offset = 0;
+    failed = false;
+}
+
+#pragma mark - C interface
+
+size_t LSMQTTEncodeConnect(const char *clientID, const char *username, const char *password, uint16_t keepAlive, bool cleanSession, uint8_t *buffer, size_t capacity)
+{
+    Packet packet;
+    packet.string("MQTT");
+    packet.byte(4);
+    uint8_t flags = cleanSession ? 0x02 : 0;
+    if (username) {
+        flags |= 0x80;
+    }
+    if (password) {
+        flags |= 0x40;
+    }
+    packet.byte(flags);
+    packet.word(keepAlive);
+    packet.string(clientID);
+    if (username) {
+        packet.string(username);
+    }
+    if (password) {
+        packet.string(password);
+    }
+    return packet.finish(LSMQTTConnect << 4, buffer, capacity);
+}
+
+size_t LSMQTTEncodePublish(const char *topic, uint16_t packetID, uint8_t qos, bool retain, const uint8_t *payload, size_t length, uint8_t *buffer, size_t capacity)
+{
+    if (qos > 2 || (qos > 0 && packetID == 0)) {
+        return 0;
+    }
+    Packet packet;
+    packet.string(topic);
+    if (qos > 0) {
+        packet.word(packetID);
+    }
+    packet.bytes(payload, length);
+    return packet.finish(static_cast<uint8_t>((LSMQTTPublish << 4) | (qos << 1) | (retain ? 1 : 0)), buffer, capacity);
+}
+
+size_t LSMQTTEncodeSubscribe(uint16_t packetID, const char *topic, uint8_t qos, uint8_t *buffer, size_t capacity)
+{
+    if (qos > 2 || packetID == 0) {
+        return 0;
+    }
+    Packet packet;
+    packet.word(packetID);
+    packet.string(topic);
+    packet.byte(qos);
+    return packet.finish((LSMQTTSubscribe << 4) | 2, buffer, capacity);
+}
+
+size_t LSMQTTEncodePubAck(uint16_t packetID, uint8_t *buffer, size_t capacity)
+{
+    Packet packet;
+    packet.word(packetID);
+    return packet.finish(LSMQTTPubAck << 4, buffer, capacity);
+}
+
+size_t LSMQTTEncodePingReq(uint8_t *buffer, size_t capacity)
+{
+    return Packet().finish(LSMQTTPingReq << 4, buffer, capacity);
+}
+
+size_t LSMQTTEncodeDisconnect(uint8_t *buffer, size_t capacity)
+{
+    return Packet().finish(LSMQTTDisconnect << 4, buffer, capacity);
+}
+
+LSMQTTDecoderRef LSMQTTDecoderCreate(size_t maxPacketSize)
+{
+    return new LSMQTTDecoder(maxPacketSize);
+}
+
+void LSMQTTDecoderDestroy(LSMQTTDecoderRef decoder)
+{
+    delete decoder;
+}
+
+void LSMQTTDecoderFeed(LSMQTTDecoderRef decoder, const uint8_t *bytes, size_t length)
+{
+    decoder->feed(bytes, length);
+}
+
+bool LSMQTTDecoderNext(LSMQTTDecoderRef decoder, LSMQTTPacket *packet)
+{
+    return decoder->next(*packet);
+}
+
+bool LSMQTTDecoderFailed(LSMQTTDecoderRef decoder)
+{
+    return decoder->failed;
+}
+
+void LSMQTTDecoderReset(LSMQTTDecoderRef decoder)
+{
+    decoder->reset();
+}
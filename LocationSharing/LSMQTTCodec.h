@@ -0,0 +1,111 @@
+//
+//  LSMQTTCodec.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-26.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSMQTTCodec_h
+#define LSMQTTCodec_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// MQTT 3.1.1 packets, the part a client needs to hold a push connection to
+// Kii Cloud: connect, subscribe, publish with QoS 0 and 1, keep alive.
+//
+// Encoders return the size of the packet and only write it when it fits in
+// capacity bytes; 0 means the arguments cannot be encoded (a string longer
+// than 65535 bytes, a packet over 256 MB).
+//
+// The decoder takes bytes as they come off the socket and hands out whole
+// packets. Packet fields point into the decoder and stay valid until the
+// next Feed.
+
+typedef enum {
+    LSMQTTConnect = 1,
+    LSMQTTConnAck = 2,
+    LSMQTTPublish = 3,
+    LSMQTTPubAck = 4,
+    LSMQTTPubRec = 5,
+    LSMQTTPubRel = 6,
+    LSMQTTPubComp = 7,
+    LSMQTTSubscribe = 8,
+    LSMQTTSubAck = 9,
+    LSMQTTUnsubscribe = 10,
+    LSMQTTUnsubAck = 11,
+    LSMQTTPingReq = 12,
+    LSMQTTPingResp = 13,
+    LSMQTTDisconnect = 14
+} LSMQTTPacketType;
+
+typedef struct {
+    uint8_t type;
+    // Low nibble of the fixed header, DUP, QoS and RETAIN for a publish.
+    uint8_t flags;
+    uint8_t qos;
+    // Return code of a CONNACK, first granted QoS of a SUBACK.
+    uint8_t returnCode;
+    bool sessionPresent;
+    uint16_t packetID;
+    const char *topic;
+    size_t topicLength;
+    // Message of a publish, rest of the body for packets a client only sends.
+    const uint8_t *payload;
+    size_t payloadLength;
+} LSMQTTPacket;
+
+// Any of username and password may be NULL.
+size_t LSMQTTEncodeConnect(const char *clientID, const char *username, const char *password, uint16_t keepAlive, bool cleanSession, uint8_t *buffer, size_t capacity);
+// packetID is ignored for QoS 0.
+size_t LSMQTTEncodePublish(const char *topic, uint16_t packetID, uint8_t qos, bool retain, const uint8_t *payload, size_t length, uint8_t *buffer, size_t capacity);
+size_t LSMQTTEncodeSubscribe(uint16_t packetID, const char *topic, uint8_t qos, uint8_t *buffer, size_t capacity);
+size_t LSMQTTEncodePubAck(uint16_t packetID, uint8_t *buffer, size_t capacity);
+size_t LSMQTTEncodePingReq(uint8_t *buffer, size_t capacity);
+size_t LSMQTTEncodeDisconnect(uint8_t *buffer, size_t capacity);
+
+typedef struct LSMQTTDecoder *LSMQTTDecoderRef;
+
+// Packets larger than maxPacketSize make the stream malformed.
+LSMQTTDecoderRef LSMQTTDecoderCreate(size_t maxPacketSize);
+void LSMQTTDecoderDestroy(LSMQTTDecoderRef decoder);
+
+void LSMQTTDecoderFeed(LSMQTTDecoderRef decoder, const uint8_t *bytes, size_t length);
+// Takes the next whole packet, false when more bytes are needed or the
+// stream is malformed.
+bool LSMQTTDecoderNext(LSMQTTDecoderRef decoder, LSMQTTPacket *packet);
+// Once malformed, nothing more is decoded and the connection should close.
+bool LSMQTTDecoderFailed(LSMQTTDecoderRef decoder);
+void LSMQTTDecoderReset(LSMQTTDecoderRef decoder);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+struct LSMQTTDecoder {
+    size_t maxPacketSize;
+    std::vector<uint8_t> buffer;
+    // Start of the first packet not handed out yet.
+    size_t offset = 0;
+    bool failed = false;
+
+    explicit LSMQTTDecoder(size_t maxSize) : maxPacketSize(maxSize) {}
+
+    void feed(const uint8_t *bytes, size_t length);
+    bool next(LSMQTTPacket &packet);
+    void reset();
+
+private:
+    bool parse(uint8_t header, const uint8_t *body, size_t length, LSMQTTPacket &packet) const;
+};
+
+#endif
+
+#endif /* LSMQTTCodec_h */
@@ -0,0 +1,174 @@
+//
+//  LSMemberTable.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-01.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSMemberTable.h"
+
+#include <algorithm>
+
+uint32_t LSMemberTable::internUserID(const std::string &userID)
+{
+    auto found = userIndexByID.find(userID);
+    if (found != userIndexByID.end()) {
+        return found->second;
+    }
+    uint32_t user = static_cast<uint32_t>(userIDs.size());
+    userIDs.push_back(userID);
+    userIndexByID.emplace(userID, user);
+    rowByUser.push_back(-1);
+    return user;
+}
+
+uint32_t LSMemberTable::upsert(const std::string &userID, double lat, double lon, int64_t ts)
+{
+    return upsertUserIndex(internUserID(userID), lat, lon, ts);
+}
+
+uint32_t LSMemberTable::upsertUserIndex(uint32_t user, double lat, double lon, int64_t ts)
+{
+    int64_t existing = rowForUserIndex(user);
+    if (existing >= 0) {
+        uint32_t row = static_cast<uint32_t>(existing);
+        // An older copy, such as a page fetched before a push or a local
+        // move, must not take the member back.
+        if (ts >= timestamp[row]) {
+            set(row, lat, lon, ts);
+        }
+        return row;
+    }
+
+    uint32_t row = static_cast<uint32_t>(size());
+    latitude.push_back(lat);
+    longitude.push_back(lon);
+    userIndex.push_back(user);
+    timestamp.push_back(ts);
+    rowByUser[user] = row;
+    return row;
+}
+
+void LSMemberTable::set(uint32_t row, double lat, double lon, int64_t ts)
+{
+    latitude[row] = lat;
+    longitude[row] = lon;
+    timestamp[row] = ts;
+}
+
+int64_t LSMemberTable::findRow(const std::string &userID) const
+{
+    auto found = userIndexByID.find(userID);
+    if (found == userIndexByID.end()) {
+        return -1;
+    }
+    return rowByUser[found->second];
+}
+
+int64_t LSMemberTable::rowForUserIndex(uint32_t user) const
+{
+    if (user >= rowByUser.size()) {
+        return -1;
+    }
+    return rowByUser[user];
+}
+
+void LSMemberTable::removeRow(uint32_t row)
+{
+    // Swap the last row into the hole so the columns stay dense.
+    uint32_t last = static_cast<uint32_t>(size() - 1);
+    rowByUser[userIndex[row]] = -1;
+    if (row != last) {
+        latitude[row] = latitude[last];
+        longitude[row] = longitude[last];
+        userIndex[row] = userIndex[last];
+        timestamp[row] = timestamp[last];
+        rowByUser[userIndex[row]] = row;
+    }
+    latitude.pop_back();
+    longitude.pop_back();
+    userIndex.pop_back();
+    timestamp.pop_back();
+}
+
+void LSMemberTable::clear()
+{
+    latitude.clear();
+    longitude.clear();
+    userIndex.clear();
+    timestamp.clear();
+    std::fill(rowByUser.begin(), rowByUser.end(), -1);
+}
+
+#pragma mark - C interface
+
+LSMemberTableRef LSMemberTableCreate(void)
+{
+    return new LSMemberTable();
+}
+
+void LSMemberTableDestroy(LSMemberTableRef table)
+{
+    delete table;
+}
+
+size_t LSMemberTableCount(LSMemberTableRef table)
+{
+    return table->size();
+}
+
+void LSMemberTableClear(LSMemberTableRef table)
+{
+    table->clear();
+}
+
+uint32_t LSMemberTableUpsert(LSMemberTableRef table, const char *userID, double latitude, double longitude, int64_t timestamp)
+{
+    return table->upsert(userID, latitude, longitude, timestamp);
+}
+
+void LSMemberTableSetLocation(LSMemberTableRef table, uint32_t row, double latitude, double longitude, int64_t timestamp)
+{
+    table->set(row, latitude, longitude, timestamp);
+}
+
+int64_t LSMemberTableFindRow(LSMemberTableRef table, const char *userID)
+{
+    return table->findRow(userID);
+}
+
+void LSMemberTableRemoveRow(LSMemberTableRef table, uint32_t row)
+{
+    table->removeRow(row);
+}
+
+const double *LSMemberTableLatitudes(LSMemberTableRef table)
+{
+    return table->latitude.data();
+}
+
+const double *LSMemberTableLongitudes(LSMemberTableRef table)
+{
+    return table->longitude.data();
+}
+
+const uint32_t *LSMemberTableUserIndices(LSMemberTableRef table)
+{
+    return table->userIndex.data();
+}
+
+const int64_t *LSMemberTableTimestamps(LSMemberTableRef table)
+{
+    return table->timestamp.data();
+}
+
+const char *LSMemberTableUserID(LSMemberTableRef table, uint32_t userIndex)
+{
+    return table->userID(userIndex).c_str();
+}
+
+int64_t LSMemberTableRowForUserIndex(LSMemberTableRef table, uint32_t userIndex)
+{
+    return table->rowForUserIndex(userIndex);
+}
@@ -0,0 +1,86 @@
+//
+//  LSMemberTable.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-01.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSMemberTable_h
+#define LSMemberTable_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Column store for the latest location of every group member.
+//
+// Each member owns one row. Rows are dense and may be reordered when a member
+// is removed, so keep the user index (stable for the lifetime of the table)
+// rather than the row when a member has to be referenced later.
+
+typedef struct LSMemberTable *LSMemberTableRef;
+
+LSMemberTableRef LSMemberTableCreate(void);
+void LSMemberTableDestroy(LSMemberTableRef table);
+
+size_t LSMemberTableCount(LSMemberTableRef table);
+void LSMemberTableClear(LSMemberTableRef table);
+
+// Inserts the member or updates its location, returns the row. A location
+// older than the one the table holds is ignored.
+uint32_t LSMemberTableUpsert(LSMemberTableRef table, const char *userID, double latitude, double longitude, int64_t timestamp);
+void LSMemberTableSetLocation(LSMemberTableRef table, uint32_t row, double latitude, double longitude, int64_t timestamp);
+// Returns the row of the member or -1.
+int64_t LSMemberTableFindRow(LSMemberTableRef table, const char *userID);
+void LSMemberTableRemoveRow(LSMemberTableRef table, uint32_t row);
+
+// Columns, valid until the next insert or removal.
+const double *LSMemberTableLatitudes(LSMemberTableRef table);
+const double *LSMemberTableLongitudes(LSMemberTableRef table);
+const uint32_t *LSMemberTableUserIndices(LSMemberTableRef table);
+const int64_t *LSMemberTableTimestamps(LSMemberTableRef table);
+
+// Interned user IDs, indexed by the values of the user index column.
+const char *LSMemberTableUserID(LSMemberTableRef table, uint32_t userIndex);
+int64_t LSMemberTableRowForUserIndex(LSMemberTableRef table, uint32_t userIndex);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct LSMemberTable {
+    std::vector<double> latitude;
+    std::vector<double> longitude;
+    std::vector<uint32_t> userIndex;
+    std::vector<int64_t> timestamp;
+
+    size_t size() const { return latitude.size(); }
+
+    uint32_t internUserID(const std::string &userID);
+    uint32_t upsert(const std::string &userID, double lat, double lon, int64_t ts);
+    uint32_t upsertUserIndex(uint32_t user, double lat, double lon, int64_t ts);
+    void set(uint32_t row, double lat, double lon, int64_t ts);
+    int64_t findRow(const std::string &userID) const;
+    int64_t rowForUserIndex(uint32_t user) const;
+    void removeRow(uint32_t row);
+    void clear();
+
+    const std::string &userID(uint32_t user) const { return userIDs[user]; }
+    size_t userCount() const { return userIDs.size(); }
+
+private:
+    std::vector<std::string> userIDs;
+    std::unordered_map<std::string, uint32_t> userIndexByID;
+    std::vector<int64_t> rowByUser;
+};
+
+#endif
+
+#endif /* LSMemberTable_h */
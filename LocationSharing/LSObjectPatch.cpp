@@ -0,0 +1,183 @@
+//
+//  LSObjectPatch.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-16.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSObjectPatch.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+#pragma mark - Encoding
+
+void appendString(std::string &out, const char *value)
+{
+    static const char kHex[] = "0123456789abcdef";
+    out += '"';
+    for (const char *c = value; *c; c++) {
+        unsigned char byte = static_cast<unsigned char>(*c);
+        if (byte == '"' || byte == '\\') {
+            out += '\\';
+            out += *c;
+        } else if (byte < 0x20) {
+            out += "\\u00";
+            out += kHex[byte >> 4];
+            out += kHex[byte & 15];
+        } else {
+            out += *c;
+        }
+    }
+    out += '"';
+}
+
+// Shortest decimal that reads back as the same double, so coordinates cost
+// as few bytes as their precision needs.
+void appendNumber(std::string &out, double value)
+{
+    if (!std::isfinite(value)) {
+        out += "null";
+        return;
+    }
+    char buffer[32];
+    for (int precision = 1; precision <= 17; precision++) {
+        std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+        if (std::strtod(buffer, nullptr) == value) {
+            break;
+        }
+    }
+    out += buffer;
+}
+
+bool set(LSObjectPatchRef patch, const char *key, const std::string &encoded)
+{
+    int slot = patch->set(key, encoded);
+    return slot >= 0 && ((patch->dirty >> slot) & 1);
+}
+
+} // namespace
+
+#pragma mark - Patch
+
+int LSObjectPatch::set(const std::string &key, const std::string &encoded)
+{
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i] == key) {
+            if (values[i] != encoded) {
+                values[i] = encoded;
+                dirty |= 1ULL << i;
+            }
+            return static_cast<int>(i);
+        }
+    }
+    if (keys.size() == LSObjectPatchMaxFields) {
+        return -1;
+    }
+    keys.push_back(key);
+    values.push_back(encoded);
+    dirty |= 1ULL << (keys.size() - 1);
+    return static_cast<int>(keys.size() - 1);
+}
+
+uint64_t LSObjectPatch::encode(std::string &body) const
+{
+    body += '{';
+    bool first = true;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (!((dirty >> i) & 1)) {
+            continue;
+        }
+        if (!first) {
+            body += ',';
+        }
+        first = false;
+        appendString(body, keys[i].c_str());
+        body += ':';
+        body += values[i];
+    }
+    body += '}';
+    return dirty;
+}
+
+#pragma mark - C interface
+
+LSObjectPatchRef LSObjectPatchCreate(void)
+{
+    return new LSObjectPatch();
+}
+
+void LSObjectPatchDestroy(LSObjectPatchRef patch)
+{
+    delete patch;
+}
+
+bool LSObjectPatchSetString(LSObjectPatchRef patch, const char *key, const char *value)
+{
+    std::string encoded;
+    appendString(encoded, value);
+    return set(patch, key, encoded);
+}
+
+bool LSObjectPatchSetNumber(LSObjectPatchRef patch, const char *key, double value)
+{
+    std::string encoded;
+    appendNumber(encoded, value);
+    return set(patch, key, encoded);
+}
+
+bool LSObjectPatchSetInteger(LSObjectPatchRef patch, const char *key, int64_t value)
+{
+    return set(patch, key, std::to_string(static_cast<long long>(value)));
+}
+
+bool LSObjectPatchSetBool(LSObjectPatchRef patch, const char *key, bool value)
+{
+    return set(patch, key, value ? "true" : "false");
+}
+
+bool LSObjectPatchSetGeoPoint(LSObjectPatchRef patch, const char *key, double latitude, double longitude)
+{
+    // Same shape as KiiGeoPoint on the wire.
+    std::string encoded = "{\"_type\":\"point\",\"lat\":";
+    appendNumber(encoded, latitude);
+    encoded += ",\"lon\":";
+    appendNumber(encoded, longitude);
+    encoded += '}';
+    return set(patch, key, encoded);
+}
+
+void LSObjectPatchMarkClean(LSObjectPatchRef patch)
+{
+    patch->dirty = 0;
+}
+
+uint64_t LSObjectPatchDirtyMask(LSObjectPatchRef patch)
+{
+    return patch->dirty;
+}
+
+size_t LSObjectPatchEncode(LSObjectPatchRef patch, char *buffer, size_t capacity, uint64_t *sent)
+{
+    std::string body;
+    uint64_t mask = patch->encode(body);
+    if (body.size() + 1 > capacity) {
+        return body.size();
+    }
+    std::memcpy(buffer, body.c_str(), body.size() + 1);
+    patch->dirty &= ~mask;
+    if (sent) {
+        *sent = mask;
+    }
+    return body.size();
+}
+
+void LSObjectPatchRestore(LSObjectPatchRef patch, uint64_t sent)
+{
+    patch->dirty |= sent;
+}
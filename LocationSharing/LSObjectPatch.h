@@ -0,0 +1,77 @@
+//
+//  LSObjectPatch.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-16.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSObjectPatch_h
+#define LSObjectPatch_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Field level change tracking for one KiiObject.
+//
+// Every field keeps its value encoded as JSON and one bit in a dirty mask,
+// set when a new value differs from the stored one. Encode writes the dirty
+// fields as the JSON body of a partial update and hands back their mask; if
+// the save fails, Restore marks them dirty again. Fields changed while a
+// save is in flight stay dirty on their own.
+//
+// An object tracks at most LSObjectPatchMaxFields fields; setting more fails.
+
+#define LSObjectPatchMaxFields 64
+
+typedef struct LSObjectPatch *LSObjectPatchRef;
+
+LSObjectPatchRef LSObjectPatchCreate(void);
+void LSObjectPatchDestroy(LSObjectPatchRef patch);
+
+// Return whether the field is dirty afterwards.
+bool LSObjectPatchSetString(LSObjectPatchRef patch, const char *key, const char *value);
+bool LSObjectPatchSetNumber(LSObjectPatchRef patch, const char *key, double value);
+bool LSObjectPatchSetInteger(LSObjectPatchRef patch, const char *key, int64_t value);
+bool LSObjectPatchSetBool(LSObjectPatchRef patch, const char *key, bool value);
+bool LSObjectPatchSetGeoPoint(LSObjectPatchRef patch, const char *key, double latitude, double longitude);
+
+// For values known to match the server, such as right after a fetch.
+void LSObjectPatchMarkClean(LSObjectPatchRef patch);
+
+uint64_t LSObjectPatchDirtyMask(LSObjectPatchRef patch);
+
+// Writes the dirty fields as a JSON object and returns its length. When the
+// body does not fit in capacity bytes (including the terminator) nothing is
+// written or cleared; call again with a larger buffer. Otherwise the fields
+// are marked clean and their mask is stored in sent.
+size_t LSObjectPatchEncode(LSObjectPatchRef patch, char *buffer, size_t capacity, uint64_t *sent);
+void LSObjectPatchRestore(LSObjectPatchRef patch, uint64_t sent);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <vector>
+
+struct LSObjectPatch {
+    std::vector<std::string> keys;
+    // Each value already encoded as JSON.
+    std::vector<std::string> values;
+    uint64_t dirty = 0;
+
+    // Returns the slot of the field, -1 when the object already tracks the
+    // maximum number of fields.
+    int set(const std::string &key, const std::string &encoded);
+    // Appends the dirty fields to body and returns their mask, leaving them dirty.
+    uint64_t encode(std::string &body) const;
+};
+
+#endif
+
+#endif /* LSObjectPatch_h */
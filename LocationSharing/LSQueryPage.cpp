@@ -0,0 +1,655 @@
+//
+//  LSQueryPage.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-02.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSQueryPage.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+#pragma mark - Byte classes
+
+// One bit per byte of a 64 byte block, bit i for byte i.
+struct Classes {
+    uint64_t quotes;
+    uint64_t backslashes;
+    uint64_t structurals;
+    uint64_t whitespace;
+};
+
+// Like the lanes of LSGeoDistance, every instruction set answers the same
+// question, which bytes of the block equal c, and the preprocessor picks one.
+
+struct ScalarBytes {
+    typedef const uint8_t *Block;
+    static Block load(const uint8_t *p) { return p; }
+    static uint64_t equal(Block block, uint8_t c)
+    {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < 64; i++) {
+            mask |= static_cast<uint64_t>(block[i] == c) << i;
+        }
+        return mask;
+    }
+};
+
+#if defined(__SSE2__)
+struct VectorBytes {
+    struct Block {
+        __m128i v[4];
+    };
+    static Block load(const uint8_t *p)
+    {
+        Block block;
+        for (int k = 0; k < 4; k++) {
+            block.v[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * k));
+        }
+        return block;
+    }
+    static uint64_t equal(const Block &block, uint8_t c)
+    {
+        __m128i needle = _mm_set1_epi8(static_cast<char>(c));
+        uint64_t mask = 0;
+        for (int k = 0; k < 4; k++) {
+            uint32_t bits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block.v[k], needle)));
+            mask |= static_cast<uint64_t>(bits) << (16 * k);
+        }
+        return mask;
+    }
+};
+#elif defined(__aarch64__)
+struct VectorBytes {
+    struct Block {
+        uint8x16_t v[4];
+    };
+    static Block load(const uint8_t *p)
+    {
+        Block block;
+        for (int k = 0; k < 4; k++) {
+            block.v[k] = vld1q_u8(p + 16 * k);
+        }
+        return block;
+    }
+    // NEON has no movemask: keep one weight per lane and add the lanes up
+    // pairwise until each half of the vector is one byte.
+    static uint64_t movemask(uint8x16_t v)
+    {
+        static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+        uint8x16_t masked = vandq_u8(v, vld1q_u8(weights));
+        uint8x8_t sum = vpadd_u8(vget_low_u8(masked), vget_high_u8(masked));
+        sum = vpadd_u8(sum, sum);
+        sum = vpadd_u8(sum, sum);
+        return vget_lane_u16(vreinterpret_u16_u8(sum), 0);
+    }
+    static uint64_t equal(const Block &block, uint8_t c)
+    {
+        uint8x16_t needle = vdupq_n_u8(c);
+        uint64_t mask = 0;
+        for (int k = 0; k < 4; k++) {
+            mask |= movemask(vceqq_u8(block.v[k], needle)) << (16 * k);
+        }
+        return mask;
+    }
+};
+#else
+typedef ScalarBytes VectorBytes;
+#endif
+
+template <class Bytes>
+Classes classify(const uint8_t *p)
+{
+    typename Bytes::Block block = Bytes::load(p);
+    Classes classes;
+    classes.quotes = Bytes::equal(block, '"');
+    classes.backslashes = Bytes::equal(block, '\\');
+    classes.structurals = Bytes::equal(block, '{') | Bytes::equal(block, '}') | Bytes::equal(block, '[') | Bytes::equal(block, ']') | Bytes::equal(block, ':') | Bytes::equal(block, ',');
+    classes.whitespace = Bytes::equal(block, ' ') | Bytes::equal(block, '\n') | Bytes::equal(block, '\r') | Bytes::equal(block, '\t');
+    return classes;
+}
+
+#pragma mark - Masks
+
+// The bytes escaped by a backslash, those after an odd run of backslashes.
+// A run starting on an even bit is added to the backslash mask, the carry of
+// the addition lands right after the run and the parity of where the run
+// started tells whether the run is odd. escaped carries a run that goes on
+// into the next block.
+uint64_t escapedBytes(uint64_t backslashes, uint64_t &escaped)
+{
+    const uint64_t evenBits = 0x5555555555555555ULL;
+
+    uint64_t first = escaped;
+    backslashes &= ~first;
+    uint64_t followsEscape = (backslashes << 1) | first;
+    uint64_t oddStarts = backslashes & ~evenBits & ~followsEscape;
+    uint64_t sequences = oddStarts + backslashes;
+    escaped = sequences < oddStarts ? 1 : 0;
+    uint64_t invert = sequences << 1;
+    return (evenBits ^ invert) & followsEscape;
+}
+
+// Bit i is the parity of the bits up to and including i, which over the
+// quote mask marks the bytes from an opening quote up to its closing one.
+uint64_t prefixXor(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+int lowestBit(uint64_t bits)
+{
+    return __builtin_ctzll(bits);
+}
+
+#pragma mark - Values
+
+bool equals(const char *begin, size_t length, const char *literal)
+{
+    return length == std::strlen(literal) && std::memcmp(begin, literal, length) == 0;
+}
+
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool readHex4(const char *p, const char *end, uint32_t &value)
+{
+    if (end - p < 4) {
+        return false;
+    }
+    value = 0;
+    for (int k = 0; k < 4; k++) {
+        int digit = hexValue(p[k]);
+        if (digit < 0) {
+            return false;
+        }
+        value = (value << 4) | static_cast<uint32_t>(digit);
+    }
+    return true;
+}
+
+void appendUTF8(std::string &out, uint32_t code)
+{
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xC0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xE0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+bool unescape(const char *p, const char *end, std::string &out)
+{
+    out.clear();
+    while (p < end) {
+        if (*p != '\\') {
+            out += *p++;
+            continue;
+        }
+        if (++p == end) {
+            return false;
+        }
+        char c = *p++;
+        switch (c) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t code;
+                if (!readHex4(p, end, code)) {
+                    return false;
+                }
+                p += 4;
+                uint32_t low;
+                if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u' && readHex4(p + 2, end, low) && low >= 0xDC00 && low < 0xE000) {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                appendUTF8(out, code);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+}
+
+#pragma mark - Structural index
+
+void LSQueryPage::indexBlock(const uint8_t *block, size_t offset)
+{
+    Classes classes = classify<VectorBytes>(block);
+
+    uint64_t quotes = classes.quotes & ~escapedBytes(classes.backslashes, previousEscaped);
+    // From each opening quote up to, not including, its closing quote
+    uint64_t inString = prefixXor(quotes) ^ previousInString;
+    previousInString = (inString >> 63) ? ~0ULL : 0;
+
+    uint64_t outside = ~(inString | quotes);
+    uint64_t scalars = ~(classes.structurals | classes.whitespace) & outside;
+    uint64_t scalarStarts = scalars & ~((scalars << 1) | previousScalar);
+    previousScalar = scalars >> 63;
+
+    uint64_t bits = (classes.structurals & outside) | quotes | scalarStarts;
+
+    while (bits) {
+        structurals.push_back(static_cast<uint32_t>(offset + lowestBit(bits)));
+        bits &= bits - 1;
+    }
+}
+
+void LSQueryPage::feed(const char *data, size_t length)
+{
+    if (finished) {
+        return;
+    }
+    bytes.insert(bytes.end(), data, data + length);
+    while (indexed + kBlockSize <= bytes.size()) {
+        indexBlock(reinterpret_cast<const uint8_t *>(&bytes[indexed]), indexed);
+        indexed += kBlockSize;
+    }
+}
+
+bool LSQueryPage::finish()
+{
+    if (finished) {
+        return valid;
+    }
+    finished = true;
+
+    // The tail is padded with whitespace, which is never indexed. An empty
+    // page has no tail, and no bytes to copy it from.
+    size_t remaining = bytes.size() - indexed;
+    if (remaining > 0) {
+        uint8_t tail[kBlockSize];
+        std::memset(tail, ' ', kBlockSize);
+        std::memcpy(tail, bytes.data() + indexed, remaining);
+        indexBlock(tail, indexed);
+        indexed = bytes.size();
+    }
+
+    // Numbers are read with strtod, which stops at the terminator
+    bytes.push_back('\0');
+
+    if (previousInString) {
+        return false;
+    }
+
+    size_t i = 0;
+    bool foundResults = false;
+
+    if (at(i++) != '{') {
+        return false;
+    }
+
+    while (at(i) != '}') {
+        const char *key;
+        size_t length;
+        if (!string(i, key, length) || at(i++) != ':') {
+            return false;
+        }
+        if (equals(key, length, "results")) {
+            if (at(i) != '[') {
+                return false;
+            }
+            resultsStart = i;
+            foundResults = true;
+            if (!skip(i)) {
+                return false;
+            }
+        } else if (equals(key, length, "nextPaginationKey") && at(i) == '"') {
+            if (!readString(i, nextPaginationKey)) {
+                return false;
+            }
+            hasNextPage = true;
+        } else if (!skip(i)) {
+            return false;
+        }
+        if (at(i) == ',') {
+            i++;
+        } else if (at(i) != '}') {
+            return false;
+        }
+    }
+
+    valid = foundResults && i + 1 == structurals.size();
+    return valid;
+}
+
+void LSQueryPage::reset()
+{
+    bytes.clear();
+    structurals.clear();
+    nextPaginationKey.clear();
+    hasNextPage = false;
+    rows.clear();
+    maxModified = 0;
+    indexed = 0;
+    finished = false;
+    valid = false;
+    resultsStart = 0;
+    previousEscaped = 0;
+    previousInString = 0;
+    previousScalar = 0;
+}
+
+#pragma mark - On demand walk
+
+bool LSQueryPage::string(size_t &i, const char *&begin, size_t &length) const
+{
+    if (at(i) != '"' || at(i + 1) != '"') {
+        return false;
+    }
+    begin = &bytes[structurals[i] + 1];
+    length = structurals[i + 1] - structurals[i] - 1;
+    i += 2;
+    return true;
+}
+
+bool LSQueryPage::skip(size_t &i) const
+{
+    switch (at(i)) {
+        case '"': {
+            const char *begin;
+            size_t length;
+            return string(i, begin, length);
+        }
+        case '{':
+        case '[': {
+            // Nothing inside strings is indexed, so brackets match by depth
+            size_t depth = 0;
+            do {
+                char c = at(i++);
+                if (c == '{' || c == '[') {
+                    depth++;
+                } else if (c == '}' || c == ']') {
+                    depth--;
+                } else if (c == '\0') {
+                    return false;
+                }
+            } while (depth > 0);
+            return true;
+        }
+        case '}':
+        case ']':
+        case ':':
+        case ',':
+        case '\0':
+            return false;
+        default:
+            i++;
+            return true;
+    }
+}
+
+bool LSQueryPage::readString(size_t &i, std::string &value) const
+{
+    const char *begin;
+    size_t length;
+    if (!string(i, begin, length)) {
+        return false;
+    }
+    if (std::memchr(begin, '\\', length) == NULL) {
+        value.assign(begin, length);
+        return true;
+    }
+    return unescape(begin, begin + length, value);
+}
+
+bool LSQueryPage::readNumber(size_t &i, double &value) const
+{
+    char c = at(i);
+    if (c != '-' && (c < '0' || c > '9')) {
+        return false;
+    }
+    const char *begin = &bytes[structurals[i]];
+    char *end;
+    value = std::strtod(begin, &end);
+    if (end == begin) {
+        return false;
+    }
+    i++;
+    return true;
+}
+
+bool LSQueryPage::readInteger(size_t &i, int64_t &value) const
+{
+    if (i >= structurals.size()) {
+        return false;
+    }
+    const char *p = &bytes[structurals[i]];
+    bool negative = *p == '-';
+    if (negative) {
+        p++;
+    }
+    if (*p < '0' || *p > '9') {
+        return false;
+    }
+    int64_t magnitude = 0;
+    while (*p >= '0' && *p <= '9') {
+        magnitude = magnitude * 10 + (*p++ - '0');
+    }
+    if (*p == '.' || *p == 'e' || *p == 'E') {
+        double number;
+        if (!readNumber(i, number)) {
+            return false;
+        }
+        value = static_cast<int64_t>(number);
+        return true;
+    }
+    value = negative ? -magnitude : magnitude;
+    i++;
+    return true;
+}
+
+bool LSQueryPage::readLocation(size_t &i, double &lat, double &lon, bool &found) const
+{
+    bool hasLat = false;
+    bool hasLon = false;
+
+    if (at(i) != '{') {
+        found = false;
+        return skip(i);
+    }
+    i++;
+
+    while (at(i) != '}') {
+        const char *key;
+        size_t length;
+        if (!string(i, key, length) || at(i++) != ':') {
+            return false;
+        }
+        if (equals(key, length, "lat")) {
+            if (!readNumber(i, lat)) {
+                return false;
+            }
+            hasLat = true;
+        } else if (equals(key, length, "lon")) {
+            if (!readNumber(i, lon)) {
+                return false;
+            }
+            hasLon = true;
+        } else if (!skip(i)) {
+            return false;
+        }
+        if (at(i) == ',') {
+            i++;
+        } else if (at(i) != '}') {
+            return false;
+        }
+    }
+    i++;
+
+    found = hasLat && hasLon;
+    return true;
+}
+
+bool LSQueryPage::loadResult(size_t &i, LSMemberTable &table)
+{
+    if (at(i) != '{') {
+        return skip(i);
+    }
+    i++;
+
+    std::string userID;
+    bool hasUserID = false;
+    double lat = 0;
+    double lon = 0;
+    bool hasLocation = false;
+    int64_t modified = 0;
+
+    while (at(i) != '}') {
+        const char *key;
+        size_t length;
+        if (!string(i, key, length) || at(i++) != ':') {
+            return false;
+        }
+        if (equals(key, length, "userID") && at(i) == '"') {
+            if (!readString(i, userID)) {
+                return false;
+            }
+            hasUserID = true;
+        } else if (equals(key, length, "location")) {
+            if (!readLocation(i, lat, lon, hasLocation)) {
+                return false;
+            }
+        } else if (equals(key, length, "_modified") && at(i) != '"') {
+            if (!readInteger(i, modified)) {
+                return false;
+            }
+        } else if (!skip(i)) {
+            return false;
+        }
+        if (at(i) == ',') {
+            i++;
+        } else if (at(i) != '}') {
+            return false;
+        }
+    }
+    i++;
+
+    if (hasUserID && hasLocation) {
+        rows.push_back(table.upsert(userID, lat, lon, modified));
+        if (modified > maxModified) {
+            maxModified = modified;
+        }
+    }
+    return true;
+}
+
+size_t LSQueryPage::load(LSMemberTable &table)
+{
+    rows.clear();
+    maxModified = 0;
+
+    if (!valid) {
+        return 0;
+    }
+
+    size_t i = resultsStart + 1;
+
+    while (at(i) != ']') {
+        if (!loadResult(i, table)) {
+            break;
+        }
+        if (at(i) == ',') {
+            i++;
+        } else if (at(i) != ']') {
+            break;
+        }
+    }
+
+    return rows.size();
+}
+
+#pragma mark - C interface
+
+LSQueryPageRef LSQueryPageCreate(void)
+{
+    return new LSQueryPage();
+}
+
+void LSQueryPageDestroy(LSQueryPageRef page)
+{
+    delete page;
+}
+
+void LSQueryPageFeed(LSQueryPageRef page, const void *bytes, size_t length)
+{
+    page->feed(static_cast<const char *>(bytes), length);
+}
+
+bool LSQueryPageFinish(LSQueryPageRef page)
+{
+    return page->finish();
+}
+
+void LSQueryPageReset(LSQueryPageRef page)
+{
+    page->reset();
+}
+
+const char *LSQueryPageNextPaginationKey(LSQueryPageRef page)
+{
+    return page->hasNextPage ? page->nextPaginationKey.c_str() : NULL;
+}
+
+size_t LSQueryPageLoad(LSQueryPageRef page, LSMemberTableRef table)
+{
+    return page->load(*table);
+}
+
+const uint32_t *LSQueryPageRows(LSQueryPageRef page, size_t *count)
+{
+    *count = page->rows.size();
+    return page->rows.data();
+}
+
+int64_t LSQueryPageMaxModified(LSQueryPageRef page)
+{
+    return page->maxModified;
+}
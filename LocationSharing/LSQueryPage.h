@@ -0,0 +1,112 @@
+//
+//  LSQueryPage.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-02.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSQueryPage_h
+#define LSQueryPage_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "LSMemberTable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Reads a page of a bucket query response straight into the member table,
+// without building a dictionary or a KiiObject per result.
+//
+// Parsing is done in two stages, like simdjson. Feed indexes the bytes 64 at
+// a time as they arrive: vector compares find the quotes, backslashes and
+// structural characters of a block, escaped quotes and everything inside
+// strings are masked out, and the positions left are the structural index.
+// Finish indexes the tail and walks the top level for nextPaginationKey, so
+// the next page can be requested before this one is loaded.
+//
+// Load then walks the index on demand: for each result it reads userID,
+// location lat and lon and _modified, and jumps over every other value by
+// matching brackets in the index, never looking at the bytes in between.
+// Results without a userID or a location are skipped.
+
+typedef struct LSQueryPage *LSQueryPageRef;
+
+LSQueryPageRef LSQueryPageCreate(void);
+void LSQueryPageDestroy(LSQueryPageRef page);
+
+void LSQueryPageFeed(LSQueryPageRef page, const void *bytes, size_t length);
+// Returns false when the bytes are not a query response.
+bool LSQueryPageFinish(LSQueryPageRef page);
+// Drops the bytes and the index to read another page.
+void LSQueryPageReset(LSQueryPageRef page);
+
+// NULL on the last page. Valid until the page is reset.
+const char *LSQueryPageNextPaginationKey(LSQueryPageRef page);
+
+// Upserts every result into the table, returns the number of rows loaded.
+size_t LSQueryPageLoad(LSQueryPageRef page, LSMemberTableRef table);
+
+// The row of every loaded result, in result order.
+const uint32_t *LSQueryPageRows(LSQueryPageRef page, size_t *count);
+// The latest _modified loaded, 0 when nothing was.
+int64_t LSQueryPageMaxModified(LSQueryPageRef page);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <vector>
+
+struct LSQueryPage {
+    static const size_t kBlockSize = 64;
+
+    std::vector<char> bytes;
+    // Offsets of structural characters, both quotes of every string and the
+    // first byte of every number and literal, in order.
+    std::vector<uint32_t> structurals;
+
+    std::string nextPaginationKey;
+    bool hasNextPage = false;
+
+    std::vector<uint32_t> rows;
+    int64_t maxModified = 0;
+
+    void feed(const char *data, size_t length);
+    bool finish();
+    void reset();
+
+    size_t load(LSMemberTable &table);
+
+private:
+    size_t indexed = 0;
+    bool finished = false;
+    bool valid = false;
+    // Structural index of the results array opening bracket
+    size_t resultsStart = 0;
+
+    // Carried from one block to the next
+    uint64_t previousEscaped = 0;
+    uint64_t previousInString = 0;
+    uint64_t previousScalar = 0;
+
+    void indexBlock(const uint8_t *block, size_t offset);
+
+    // The character at structural i, NUL past the end of the index
+    char at(size_t i) const { return i < structurals.size() ? bytes[structurals[i]] : '\0'; }
+    bool string(size_t &i, const char *&begin, size_t &length) const;
+    bool skip(size_t &i) const;
+    bool readString(size_t &i, std::string &value) const;
+    bool readNumber(size_t &i, double &value) const;
+    bool readInteger(size_t &i, int64_t &value) const;
+    bool readLocation(size_t &i, double &lat, double &lon, bool &found) const;
+    bool loadResult(size_t &i, LSMemberTable &table);
+};
+
+#endif
+
+#endif /* LSQueryPage_h */
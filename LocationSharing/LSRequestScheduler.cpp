@@ -0,0 +1,114 @@
+//
+//  LSRequestScheduler.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-01.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSRequestScheduler.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+const size_t kDefaultQueueLimit = 256;
+
+} // namespace
+
+#pragma mark - Scheduling
+
+LSRequestScheduler::LSRequestScheduler(size_t max) : maxRunning(std::max(max, size_t(1)))
+{
+    std::fill(limits, limits + LSRequestPriorityCount, kDefaultQueueLimit);
+}
+
+uint64_t LSRequestScheduler::submit(LSRequestPriority priority, int64_t deadline, uint64_t &displaced)
+{
+    displaced = 0;
+    uint64_t id = ++lastID;
+    std::set<Entry> &queue = queues[priority];
+    queue.insert(Entry{deadline, id});
+
+    if (queue.size() > limits[priority]) {
+        auto last = std::prev(queue.end());
+        displaced = last->id;
+        queue.erase(last);
+    }
+    return id;
+}
+
+uint64_t LSRequestScheduler::next()
+{
+    // One slot stays free for interactive requests.
+    size_t shared = maxRunning > 1 ? maxRunning - 1 : maxRunning;
+
+    for (int priority = 0; priority < LSRequestPriorityCount; priority++) {
+        std::set<Entry> &queue = queues[priority];
+        if (queue.empty()) {
+            continue;
+        }
+        size_t limit = priority == LSRequestPriorityInteractive ? maxRunning : shared;
+        if (running.size() >= limit) {
+            return 0;
+        }
+        uint64_t id = queue.begin()->id;
+        queue.erase(queue.begin());
+        running.emplace(id, static_cast<LSRequestPriority>(priority));
+        return id;
+    }
+    return 0;
+}
+
+void LSRequestScheduler::finish(uint64_t request)
+{
+    running.erase(request);
+}
+
+#pragma mark - C interface
+
+LSRequestSchedulerRef LSRequestSchedulerCreate(size_t maxRunning)
+{
+    return new LSRequestScheduler(maxRunning);
+}
+
+void LSRequestSchedulerDestroy(LSRequestSchedulerRef scheduler)
+{
+    delete scheduler;
+}
+
+void LSRequestSchedulerSetQueueLimit(LSRequestSchedulerRef scheduler, LSRequestPriority priority, size_t limit)
+{
+    scheduler->limits[priority] = std::max(limit, size_t(1));
+}
+
+uint64_t LSRequestSchedulerSubmit(LSRequestSchedulerRef scheduler, LSRequestPriority priority, int64_t deadline, uint64_t *displaced)
+{
+    uint64_t dropped;
+    uint64_t id = scheduler->submit(priority, deadline, dropped);
+    if (displaced) {
+        *displaced = dropped;
+    }
+    return id;
+}
+
+uint64_t LSRequestSchedulerNext(LSRequestSchedulerRef scheduler)
+{
+    return scheduler->next();
+}
+
+void LSRequestSchedulerFinish(LSRequestSchedulerRef scheduler, uint64_t request)
+{
+    scheduler->finish(request);
+}
+
+size_t LSRequestSchedulerPending(LSRequestSchedulerRef scheduler, LSRequestPriority priority)
+{
+    return scheduler->queues[priority].size();
+}
+
+size_t LSRequestSchedulerRunning(LSRequestSchedulerRef scheduler)
+{
+    return scheduler->running.size();
+}
@@ -0,0 +1,92 @@
+//
+//  LSRequestScheduler.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-01.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSRequestScheduler_h
+#define LSRequestScheduler_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decides which queued request runs next.
+//
+// Requests belong to a priority class and run interactive first, then
+// normal, then bulk; within a class the earliest deadline goes first, then
+// the oldest. At most maxRunning requests run at once and the last of those
+// slots is kept for interactive requests, so a map refresh never waits
+// behind a queue full of saves.
+//
+// Each class queue is bounded. Submitting to a full queue displaces its
+// least urgent request (latest deadline, newest), which may be the one just
+// submitted. Times are in ms.
+
+typedef enum {
+    LSRequestPriorityInteractive = 0,
+    LSRequestPriorityNormal = 1,
+    LSRequestPriorityBulk = 2
+} LSRequestPriority;
+
+#define LSRequestPriorityCount 3
+#define LSRequestNoDeadline INT64_MAX
+
+typedef struct LSRequestScheduler *LSRequestSchedulerRef;
+
+LSRequestSchedulerRef LSRequestSchedulerCreate(size_t maxRunning);
+void LSRequestSchedulerDestroy(LSRequestSchedulerRef scheduler);
+
+void LSRequestSchedulerSetQueueLimit(LSRequestSchedulerRef scheduler, LSRequestPriority priority, size_t limit);
+
+// Returns the ID of the new request, never 0. The ID of a displaced request
+// is stored in displaced, 0 when the queue had room.
+uint64_t LSRequestSchedulerSubmit(LSRequestSchedulerRef scheduler, LSRequestPriority priority, int64_t deadline, uint64_t *displaced);
+
+// Takes the request to start now, 0 when none may start.
+uint64_t LSRequestSchedulerNext(LSRequestSchedulerRef scheduler);
+void LSRequestSchedulerFinish(LSRequestSchedulerRef scheduler, uint64_t request);
+
+size_t LSRequestSchedulerPending(LSRequestSchedulerRef scheduler, LSRequestPriority priority);
+size_t LSRequestSchedulerRunning(LSRequestSchedulerRef scheduler);
+
+#ifdef __cplusplus
+}
+
+#include <set>
+#include <unordered_map>
+
+struct LSRequestScheduler {
+    struct Entry {
+        int64_t deadline;
+        uint64_t id;
+
+        // IDs grow, so they break deadline ties in submission order.
+        bool operator<(const Entry &other) const
+        {
+            return deadline != other.deadline ? deadline < other.deadline : id < other.id;
+        }
+    };
+
+    size_t maxRunning;
+    size_t limits[LSRequestPriorityCount];
+    std::set<Entry> queues[LSRequestPriorityCount];
+    // Class of every running request.
+    std::unordered_map<uint64_t, LSRequestPriority> running;
+    uint64_t lastID = 0;
+
+    explicit LSRequestScheduler(size_t max);
+
+    uint64_t submit(LSRequestPriority priority, int64_t deadline, uint64_t &displaced);
+    uint64_t next();
+    void finish(uint64_t request);
+};
+
+#endif
+
+#endif /* LSRequestScheduler_h */
@@ -0,0 +1,120 @@
+//
+//  LSResponseCache.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-06.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSResponseCache.h"
+
+#pragma mark - Cache
+
+const LSResponseCache::Entry *LSResponseCache::find(const std::string &key)
+{
+    auto found = entryByKey.find(key);
+    if (found == entryByKey.end()) {
+        return NULL;
+    }
+    entries.splice(entries.begin(), entries, found->second);
+    return &entries.front();
+}
+
+bool LSResponseCache::store(const std::string &key, const char *etag, const char *body, size_t length)
+{
+    remove(key);
+
+    size_t size = key.size() + std::char_traits<char>::length(etag) + length;
+    if (size > maxBytes) {
+        return false;
+    }
+    evict(size);
+
+    entries.push_front(Entry());
+    Entry &entry = entries.front();
+    entry.key = key;
+    entry.etag = etag;
+    entry.body.assign(body, length);
+
+    entryByKey[key] = entries.begin();
+    usedBytes += size;
+    return true;
+}
+
+void LSResponseCache::remove(const std::string &key)
+{
+    auto found = entryByKey.find(key);
+    if (found == entryByKey.end()) {
+        return;
+    }
+    usedBytes -= found->second->size();
+    entries.erase(found->second);
+    entryByKey.erase(found);
+}
+
+void LSResponseCache::clear()
+{
+    entries.clear();
+    entryByKey.clear();
+    usedBytes = 0;
+}
+
+void LSResponseCache::evict(size_t needed)
+{
+    while (!entries.empty() && usedBytes + needed > maxBytes) {
+        const Entry &last = entries.back();
+        usedBytes -= last.size();
+        entryByKey.erase(last.key);
+        entries.pop_back();
+    }
+}
+
+#pragma mark - C interface
+
+LSResponseCacheRef LSResponseCacheCreate(size_t maxBytes)
+{
+    return new LSResponseCache(maxBytes);
+}
+
+void LSResponseCacheDestroy(LSResponseCacheRef cache)
+{
+    delete cache;
+}
+
+const char *LSResponseCacheETag(LSResponseCacheRef cache, const void *key, size_t keyLength)
+{
+    const LSResponseCache::Entry *entry = cache->find(std::string(static_cast<const char *>(key), keyLength));
+    return entry ? entry->etag.c_str() : NULL;
+}
+
+const void *LSResponseCacheBody(LSResponseCacheRef cache, const void *key, size_t keyLength, size_t *length)
+{
+    const LSResponseCache::Entry *entry = cache->find(std::string(static_cast<const char *>(key), keyLength));
+    *length = entry ? entry->body.size() : 0;
+    return entry ? entry->body.data() : NULL;
+}
+
+bool LSResponseCacheStore(LSResponseCacheRef cache, const void *key, size_t keyLength, const char *etag, const void *body, size_t length)
+{
+    return cache->store(std::string(static_cast<const char *>(key), keyLength), etag, static_cast<const char *>(body), length);
+}
+
+void LSResponseCacheRemove(LSResponseCacheRef cache, const void *key, size_t keyLength)
+{
+    cache->remove(std::string(static_cast<const char *>(key), keyLength));
+}
+
+void LSResponseCacheClear(LSResponseCacheRef cache)
+{
+    cache->clear();
+}
+
+size_t LSResponseCacheCount(LSResponseCacheRef cache)
+{
+    return cache->count();
+}
+
+size_t LSResponseCacheBytes(LSResponseCacheRef cache)
+{
+    return cache->bytes();
+}
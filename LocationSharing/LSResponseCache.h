@@ -0,0 +1,86 @@
+//
+//  LSResponseCache.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-06.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSResponseCache_h
+#define LSResponseCache_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bodies of responses that came with an ETag, so a request can be sent with
+// If-None-Match and a 304 answered from here instead of downloading the body
+// again.
+//
+// Entries are keyed by the caller, by method, URI and request body. The
+// cache holds at most maxBytes of keys, ETags and bodies and evicts the least
+// recently used entries to make room; looking up an ETag counts as a use.
+// Pointers returned stay valid until the cache is next changed.
+
+typedef struct LSResponseCache *LSResponseCacheRef;
+
+LSResponseCacheRef LSResponseCacheCreate(size_t maxBytes);
+void LSResponseCacheDestroy(LSResponseCacheRef cache);
+
+// NULL when nothing is stored for the key.
+const char *LSResponseCacheETag(LSResponseCacheRef cache, const void *key, size_t keyLength);
+const void *LSResponseCacheBody(LSResponseCacheRef cache, const void *key, size_t keyLength, size_t *length);
+
+// Replaces what is stored for the key. Returns false, and forgets the key,
+// when the entry alone is larger than the cache.
+bool LSResponseCacheStore(LSResponseCacheRef cache, const void *key, size_t keyLength, const char *etag, const void *body, size_t length);
+void LSResponseCacheRemove(LSResponseCacheRef cache, const void *key, size_t keyLength);
+void LSResponseCacheClear(LSResponseCacheRef cache);
+
+size_t LSResponseCacheCount(LSResponseCacheRef cache);
+size_t LSResponseCacheBytes(LSResponseCacheRef cache);
+
+#ifdef __cplusplus
+}
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+struct LSResponseCache {
+    struct Entry {
+        std::string key;
+        std::string etag;
+        std::string body;
+
+        size_t size() const { return key.size() + etag.size() + body.size(); }
+    };
+
+    explicit LSResponseCache(size_t maxBytes) : maxBytes(maxBytes) {}
+
+    // Moves the entry to the front, NULL when there is none.
+    const Entry *find(const std::string &key);
+    bool store(const std::string &key, const char *etag, const char *body, size_t length);
+    void remove(const std::string &key);
+    void clear();
+
+    size_t count() const { return entries.size(); }
+    size_t bytes() const { return usedBytes; }
+
+private:
+    size_t maxBytes;
+    size_t usedBytes = 0;
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> entryByKey;
+
+    void evict(size_t needed);
+};
+
+#endif
+
+#endif /* LSResponseCache_h */
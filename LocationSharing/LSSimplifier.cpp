@@ -0,0 +1,191 @@
+//
+//  LSSimplifier.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-24.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+const double kMeanRadius = 6371008.8;
+
+// Local flat projection in meters around an origin, good to well under a
+// percent over the few kilometers a segment spans.
+struct Plane {
+    double latitude;
+    double longitude;
+    double metersPerDegreeX;
+    double metersPerDegreeY;
+
+    Plane(double originLatitude, double originLongitude)
+        : latitude(originLatitude), longitude(originLongitude)
+    {
+        metersPerDegreeY = kMeanRadius * kPi / 180.0;
+        metersPerDegreeX = metersPerDegreeY * std::cos(originLatitude * kPi / 180.0);
+    }
+
+    double x(double lon) const
+    {
+        double delta = lon - longitude;
+        // Take the short way across the 180th meridian.
+        if (delta > 180.0) {
+            delta -= 360.0;
+        } else if (delta < -180.0) {
+            delta += 360.0;
+        }
+        return delta * metersPerDegreeX;
+    }
+
+    double y(double lat) const { return (lat - latitude) * metersPerDegreeY; }
+};
+
+// Squared distance from point p to the segment from the origin to b.
+double segmentDistanceSquared(double px, double py, double bx, double by)
+{
+    double length = bx * bx + by * by;
+    double t = length > 0 ? std::min(std::max((px * bx + py * by) / length, 0.0), 1.0) : 0.0;
+    double dx = px - t * bx;
+    double dy = py - t * by;
+    return dx * dx + dy * dy;
+}
+
+} // namespace
+
+#pragma mark - Streaming
+
+void LSSimplifier::add(const Fix &fix)
+{
+    if (!started) {
+        started = true;
+        anchor = fix;
+        vertices.push_back(fix);
+        return;
+    }
+
+    Plane plane(anchor.latitude, anchor.longitude);
+    double bx = plane.x(fix.longitude);
+    double by = plane.y(fix.latitude);
+    double limit = tolerance * tolerance;
+
+    bool fits = window.size() < maxWindow;
+    for (size_t i = 0; fits && i < window.size(); i++) {
+        fits = segmentDistanceSquared(plane.x(window[i].longitude), plane.y(window[i].latitude), bx, by) <= limit;
+    }
+
+    if (!fits && !window.empty()) {
+        // The fix before this one ends the segment that still fit.
+        anchor = window.back();
+        vertices.push_back(anchor);
+        window.clear();
+    }
+    window.push_back(fix);
+}
+
+void LSSimplifier::flush()
+{
+    if (!window.empty()) {
+        anchor = window.back();
+        vertices.push_back(anchor);
+        window.clear();
+    }
+}
+
+#pragma mark - Douglas-Peucker
+
+size_t LSSimplifyPolyline(const double *latitudes, const double *longitudes, size_t count, double tolerance, uint8_t *keep)
+{
+    if (count == 0) {
+        return 0;
+    }
+    std::fill(keep, keep + count, 0);
+    keep[0] = 1;
+    keep[count - 1] = 1;
+    size_t kept = count > 1 ? 2 : 1;
+
+    double limit = tolerance * tolerance;
+    // An explicit stack: tracks of many thousand points would recurse deeply.
+    std::vector<std::pair<size_t, size_t>> stack;
+    if (count > 2) {
+        stack.push_back(std::make_pair(static_cast<size_t>(0), count - 1));
+    }
+    while (!stack.empty()) {
+        size_t first = stack.back().first;
+        size_t last = stack.back().second;
+        stack.pop_back();
+
+        Plane plane(latitudes[first], longitudes[first]);
+        double bx = plane.x(longitudes[last]);
+        double by = plane.y(latitudes[last]);
+
+        size_t farthest = first;
+        double farthestDistance = limit;
+        for (size_t i = first + 1; i < last; i++) {
+            double distance = segmentDistanceSquared(plane.x(longitudes[i]), plane.y(latitudes[i]), bx, by);
+            if (distance > farthestDistance) {
+                farthest = i;
+                farthestDistance = distance;
+            }
+        }
+
+        if (farthest != first) {
+            keep[farthest] = 1;
+            kept++;
+            if (farthest - first > 1) {
+                stack.push_back(std::make_pair(first, farthest));
+            }
+            if (last - farthest > 1) {
+                stack.push_back(std::make_pair(farthest, last));
+            }
+        }
+    }
+    return kept;
+}
+
+#pragma mark - C interface
+
+LSSimplifierRef LSSimplifierCreate(double tolerance, size_t maxWindow)
+{
+    LSSimplifier *simplifier = new LSSimplifier();
+    simplifier->tolerance = tolerance;
+    simplifier->maxWindow = std::max(maxWindow, static_cast<size_t>(1));
+    return simplifier;
+}
+
+void LSSimplifierDestroy(LSSimplifierRef simplifier)
+{
+    delete simplifier;
+}
+
+size_t LSSimplifierAdd(LSSimplifierRef simplifier, int64_t timestamp, double latitude, double longitude)
+{
+    LSSimplifier::Fix fix = { timestamp, latitude, longitude };
+    simplifier->add(fix);
+    return simplifier->vertices.size();
+}
+
+size_t LSSimplifierFlush(LSSimplifierRef simplifier)
+{
+    simplifier->flush();
+    return simplifier->vertices.size();
+}
+
+size_t LSSimplifierDrain(LSSimplifierRef simplifier, int64_t *timestamps, double *latitudes, double *longitudes, size_t capacity)
+{
+    size_t drained = std::min(capacity, simplifier->vertices.size());
+    for (size_t i = 0; i < drained; i++) {
+        const LSSimplifier::Fix &fix = simplifier->vertices.front();
+        timestamps[i] = fix.timestamp;
+        latitudes[i] = fix.latitude;
+        longitudes[i] = fix.longitude;
+        simplifier->vertices.pop_front();
+    }
+    return drained;
+}
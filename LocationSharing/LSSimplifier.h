@@ -0,0 +1,73 @@
+//
+//  LSSimplifier.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-24.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSSimplifier_h
+#define LSSimplifier_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Line simplification for location tracks, with the tolerance in meters.
+//
+// The streaming simplifier takes fixes one at a time. It keeps the last kept
+// vertex and the fixes after it; when the segment from that vertex to a new
+// fix passes farther than the tolerance from any fix in between, the fix
+// before the new one becomes a vertex. So every dropped fix is within the
+// tolerance of the output, and a vertex is known as soon as the track turns.
+// The window is capped at maxWindow fixes, after which a vertex is forced.
+//
+// LSSimplifyPolyline is Douglas-Peucker over a whole track, for drawing.
+
+typedef struct LSSimplifier *LSSimplifierRef;
+
+LSSimplifierRef LSSimplifierCreate(double tolerance, size_t maxWindow);
+void LSSimplifierDestroy(LSSimplifierRef simplifier);
+
+// Returns the number of vertices waiting to be drained.
+size_t LSSimplifierAdd(LSSimplifierRef simplifier, int64_t timestamp, double latitude, double longitude);
+// Makes the last fix a vertex, for the end of a track.
+size_t LSSimplifierFlush(LSSimplifierRef simplifier);
+// Moves up to capacity vertices out, oldest first, and returns how many.
+size_t LSSimplifierDrain(LSSimplifierRef simplifier, int64_t *timestamps, double *latitudes, double *longitudes, size_t capacity);
+
+// Sets keep[i] to 1 for the points that stay and 0 for the others, returns
+// how many stay. The first and last points always stay.
+size_t LSSimplifyPolyline(const double *latitudes, const double *longitudes, size_t count, double tolerance, uint8_t *keep);
+
+#ifdef __cplusplus
+}
+
+#include <deque>
+#include <vector>
+
+struct LSSimplifier {
+    struct Fix {
+        int64_t timestamp;
+        double latitude;
+        double longitude;
+    };
+
+    double tolerance;
+    size_t maxWindow;
+
+    std::vector<Fix> window;
+    std::deque<Fix> vertices;
+    bool started = false;
+    Fix anchor;
+
+    void add(const Fix &fix);
+    void flush();
+};
+
+#endif
+
+#endif /* LSSimplifier_h */
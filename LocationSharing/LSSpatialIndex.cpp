@@ -0,0 +1,662 @@
+//
+//  LSSpatialIndex.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-05.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSSpatialIndex.h"
+#include "LSGeoDistance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+const double kMeanRadius = 6371008.8;
+
+} // namespace
+
+#pragma mark - Box
+
+LSSpatialIndex::Box LSSpatialIndex::Box::empty()
+{
+    double inf = std::numeric_limits<double>::infinity();
+    Box box = { inf, inf, -inf, -inf };
+    return box;
+}
+
+LSSpatialIndex::Box LSSpatialIndex::Box::point(double latitude, double longitude)
+{
+    Box box = { latitude, longitude, latitude, longitude };
+    return box;
+}
+
+void LSSpatialIndex::Box::expand(const Box &other)
+{
+    minLatitude = std::min(minLatitude, other.minLatitude);
+    minLongitude = std::min(minLongitude, other.minLongitude);
+    maxLatitude = std::max(maxLatitude, other.maxLatitude);
+    maxLongitude = std::max(maxLongitude, other.maxLongitude);
+}
+
+bool LSSpatialIndex::Box::contains(double latitude, double longitude) const
+{
+    return latitude >= minLatitude && latitude <= maxLatitude && longitude >= minLongitude && longitude <= maxLongitude;
+}
+
+bool LSSpatialIndex::Box::intersects(const Box &other) const
+{
+    return other.minLatitude <= maxLatitude && other.maxLatitude >= minLatitude && other.minLongitude <= maxLongitude && other.maxLongitude >= minLongitude;
+}
+
+double LSSpatialIndex::Box::area() const
+{
+    return (maxLatitude - minLatitude) * (maxLongitude - minLongitude);
+}
+
+double LSSpatialIndex::Box::margin() const
+{
+    return (maxLatitude - minLatitude) + (maxLongitude - minLongitude);
+}
+
+double LSSpatialIndex::Box::distanceFrom(double latitude, double longitude) const
+{
+    if (contains(latitude, longitude)) {
+        return 0;
+    }
+
+    if (longitude >= minLongitude && longitude <= maxLongitude) {
+        // Along a meridian the distance is just the latitude difference.
+        double edge = latitude < minLatitude ? minLatitude : maxLatitude;
+        return std::fabs(latitude - edge) * kPi / 180.0 * kMeanRadius;
+    }
+
+    // Otherwise the closest point lies on the edge meridian nearer in
+    // longitude. Along it cos(d) = A sin(phi) + B cos(phi), which peaks at
+    // atan2(A, B); the best latitude in the box is that one clamped, or an end.
+    double toWest = std::fmod(std::fabs(longitude - minLongitude), 360.0);
+    double toEast = std::fmod(std::fabs(longitude - maxLongitude), 360.0);
+    toWest = std::min(toWest, 360.0 - toWest);
+    toEast = std::min(toEast, 360.0 - toEast);
+    double edge = toWest < toEast ? minLongitude : maxLongitude;
+
+    double phi = latitude * kPi / 180.0;
+    double deltaLambda = (edge - longitude) * kPi / 180.0;
+    double peak = std::atan2(std::sin(phi), std::cos(phi) * std::cos(deltaLambda)) * 180.0 / kPi;
+    double best = std::min(std::max(peak, minLatitude), maxLatitude);
+
+    double distance = LSGeoDistance(latitude, longitude, best, edge, LSGeoDistanceHaversine);
+    distance = std::min(distance, LSGeoDistance(latitude, longitude, minLatitude, edge, LSGeoDistanceHaversine));
+    distance = std::min(distance, LSGeoDistance(latitude, longitude, maxLatitude, edge, LSGeoDistanceHaversine));
+    return distance;
+}
+
+namespace {
+
+LSSpatialIndex::Box unite(LSSpatialIndex::Box a, const LSSpatialIndex::Box &b)
+{
+    a.expand(b);
+    return a;
+}
+
+} // namespace
+
+#pragma mark - Nodes
+
+int32_t LSSpatialIndex::allocateNode(bool leaf)
+{
+    int32_t index;
+    if (!freeNodes.empty()) {
+        index = freeNodes.back();
+        freeNodes.pop_back();
+    } else {
+        index = static_cast<int32_t>(nodes.size());
+        nodes.push_back(Node());
+    }
+    Node &node = nodes[index];
+    node.box = Box::empty();
+    node.parent = -1;
+    node.count = 0;
+    node.leaf = leaf;
+    return index;
+}
+
+void LSSpatialIndex::releaseNode(int32_t node)
+{
+    nodes[node].count = 0;
+    freeNodes.push_back(node);
+}
+
+void LSSpatialIndex::attach(int32_t node, uint32_t entry)
+{
+    if (nodes[node].leaf) {
+        leafOf[entry] = node;
+    } else {
+        nodes[entry].parent = node;
+    }
+}
+
+LSSpatialIndex::Box LSSpatialIndex::entryBox(const Node &node, uint32_t slot) const
+{
+    uint32_t entry = node.entries[slot];
+    if (node.leaf) {
+        return Box::point(latitudes[entry], longitudes[entry]);
+    }
+    return nodes[entry].box;
+}
+
+// Recomputes the boxes from node up to the root.
+void LSSpatialIndex::refresh(int32_t node)
+{
+    while (node >= 0) {
+        Node &current = nodes[node];
+        current.box = Box::empty();
+        for (uint32_t i = 0; i < current.count; i++) {
+            current.box.expand(entryBox(current, i));
+        }
+        node = current.parent;
+    }
+}
+
+#pragma mark - Insertion
+
+int32_t LSSpatialIndex::chooseLeaf(const Box &box) const
+{
+    int32_t node = root;
+    while (!nodes[node].leaf) {
+        const Node &current = nodes[node];
+        int32_t best = -1;
+        double bestArea = 0;
+        double bestMargin = 0;
+        for (uint32_t i = 0; i < current.count; i++) {
+            const Box &child = nodes[current.entries[i]].box;
+            Box grown = unite(child, box);
+            double area = grown.area() - child.area();
+            double margin = grown.margin() - child.margin();
+            if (best < 0 || area < bestArea || (area == bestArea && margin < bestMargin)) {
+                best = static_cast<int32_t>(current.entries[i]);
+                bestArea = area;
+                bestMargin = margin;
+            }
+        }
+        node = best;
+    }
+    return node;
+}
+
+void LSSpatialIndex::insert(int32_t node, uint32_t entry)
+{
+    Node &current = nodes[node];
+    current.entries[current.count++] = entry;
+    attach(node, entry);
+
+    if (current.count > kMaxEntries) {
+        split(node);
+        return;
+    }
+
+    Box box = entryBox(current, current.count - 1);
+    while (node >= 0) {
+        nodes[node].box.expand(box);
+        node = nodes[node].parent;
+    }
+}
+
+// Quadratic split using margins, which unlike areas are not zero for points.
+void LSSpatialIndex::split(int32_t node)
+{
+    const uint32_t total = kMaxEntries + 1;
+    uint32_t entries[total];
+    Box boxes[total];
+    for (uint32_t i = 0; i < total; i++) {
+        entries[i] = nodes[node].entries[i];
+        boxes[i] = entryBox(nodes[node], i);
+    }
+
+    uint32_t seedA = 0, seedB = 1;
+    double worst = -1;
+    for (uint32_t i = 0; i < total; i++) {
+        for (uint32_t j = i + 1; j < total; j++) {
+            double waste = unite(boxes[i], boxes[j]).margin() - boxes[i].margin() - boxes[j].margin();
+            if (waste > worst) {
+                worst = waste;
+                seedA = i;
+                seedB = j;
+            }
+        }
+    }
+
+    bool assigned[total] = { false };
+    bool inA[total] = { false };
+    assigned[seedA] = assigned[seedB] = true;
+    inA[seedA] = true;
+    Box boxA = boxes[seedA], boxB = boxes[seedB];
+    uint32_t countA = 1, countB = 1;
+
+    for (uint32_t remaining = total - 2; remaining > 0; remaining--) {
+        uint32_t pick = 0;
+        bool toA = true;
+        if (countA + remaining == kMinEntries || countB + remaining == kMinEntries) {
+            // One group needs every remaining entry to reach the minimum fill.
+            toA = countA + remaining == kMinEntries;
+            while (assigned[pick]) {
+                pick++;
+            }
+        } else {
+            double bestDifference = -1;
+            for (uint32_t i = 0; i < total; i++) {
+                if (assigned[i]) {
+                    continue;
+                }
+                double growA = unite(boxA, boxes[i]).margin() - boxA.margin();
+                double growB = unite(boxB, boxes[i]).margin() - boxB.margin();
+                double difference = std::fabs(growA - growB);
+                if (difference > bestDifference) {
+                    bestDifference = difference;
+                    pick = i;
+                    toA = growA < growB || (growA == growB && countA <= countB);
+                }
+            }
+        }
+        assigned[pick] = true;
+        inA[pick] = toA;
+        if (toA) {
+            boxA.expand(boxes[pick]);
+            countA++;
+        } else {
+            boxB.expand(boxes[pick]);
+            countB++;
+        }
+    }
+
+    int32_t sibling = allocateNode(nodes[node].leaf);
+    Node &first = nodes[node];
+    Node &second = nodes[sibling];
+    first.count = 0;
+    for (uint32_t i = 0; i < total; i++) {
+        if (inA[i]) {
+            first.entries[first.count++] = entries[i];
+        } else {
+            second.entries[second.count++] = entries[i];
+        }
+    }
+    for (uint32_t i = 0; i < second.count; i++) {
+        attach(sibling, second.entries[i]);
+    }
+    first.box = boxA;
+    second.box = boxB;
+
+    if (node == root) {
+        root = allocateNode(false);
+        Node &top = nodes[root];
+        top.entries[0] = static_cast<uint32_t>(node);
+        top.entries[1] = static_cast<uint32_t>(sibling);
+        top.count = 2;
+        nodes[node].parent = root;
+        nodes[sibling].parent = root;
+        top.box = unite(boxA, boxB);
+        return;
+    }
+
+    int32_t parent = nodes[node].parent;
+    refresh(parent);
+    insert(parent, static_cast<uint32_t>(sibling));
+}
+
+#pragma mark - Removal
+
+void LSSpatialIndex::condense(int32_t node)
+{
+    // Empty nodes are unlinked; underfull ones are kept, a reload repacks them.
+    while (node != root && nodes[node].count == 0) {
+        int32_t parent = nodes[node].parent;
+        Node &up = nodes[parent];
+        for (uint32_t i = 0; i < up.count; i++) {
+            if (up.entries[i] == static_cast<uint32_t>(node)) {
+                up.entries[i] = up.entries[--up.count];
+                break;
+            }
+        }
+        releaseNode(node);
+        node = parent;
+    }
+    refresh(node);
+
+    while (!nodes[root].leaf && nodes[root].count == 1) {
+        int32_t child = static_cast<int32_t>(nodes[root].entries[0]);
+        releaseNode(root);
+        root = child;
+        nodes[root].parent = -1;
+    }
+    if (nodes[root].count == 0) {
+        nodes[root].leaf = true;
+        nodes[root].box = Box::empty();
+    }
+}
+
+void LSSpatialIndex::remove(uint32_t pointID)
+{
+    if (!contains(pointID)) {
+        return;
+    }
+    int32_t leaf = leafOf[pointID];
+    Node &node = nodes[leaf];
+    for (uint32_t i = 0; i < node.count; i++) {
+        if (node.entries[i] == pointID) {
+            node.entries[i] = node.entries[--node.count];
+            break;
+        }
+    }
+    leafOf[pointID] = -1;
+    pointCount--;
+    condense(leaf);
+}
+
+void LSSpatialIndex::move(uint32_t pointID, double lat, double lon)
+{
+    if (pointID >= leafOf.size()) {
+        latitudes.resize(pointID + 1);
+        longitudes.resize(pointID + 1);
+        leafOf.resize(pointID + 1, -1);
+    }
+
+    if (contains(pointID)) {
+        // Small moves stay inside the leaf box, which remains a valid bound.
+        if (nodes[leafOf[pointID]].box.contains(lat, lon)) {
+            latitudes[pointID] = lat;
+            longitudes[pointID] = lon;
+            return;
+        }
+        remove(pointID);
+    }
+
+    latitudes[pointID] = lat;
+    longitudes[pointID] = lon;
+    if (root < 0) {
+        root = allocateNode(true);
+    }
+    pointCount++;
+    insert(chooseLeaf(Box::point(lat, lon)), pointID);
+}
+
+void LSSpatialIndex::clear()
+{
+    nodes.clear();
+    freeNodes.clear();
+    latitudes.clear();
+    longitudes.clear();
+    leafOf.clear();
+    root = -1;
+    pointCount = 0;
+}
+
+#pragma mark - Bulk loading
+
+namespace {
+
+struct ByLongitude {
+    const std::vector<double> &longitude;
+    bool operator()(uint32_t a, uint32_t b) const { return longitude[a] < longitude[b]; }
+};
+
+struct ByLatitude {
+    const std::vector<double> &latitude;
+    bool operator()(uint32_t a, uint32_t b) const { return latitude[a] < latitude[b]; }
+};
+
+} // namespace
+
+// Sort-Tile-Recursive: cut the entries into vertical slices by longitude, sort
+// every slice by latitude and fill nodes from it. Returns the new nodes.
+std::vector<uint32_t> LSSpatialIndex::pack(std::vector<uint32_t> &entries, bool leaf)
+{
+    std::vector<double> centerLatitude(leaf ? 0 : nodes.size());
+    std::vector<double> centerLongitude(leaf ? 0 : nodes.size());
+    if (!leaf) {
+        for (size_t i = 0; i < entries.size(); i++) {
+            centerLatitude[entries[i]] = nodes[entries[i]].box.centerLatitude();
+            centerLongitude[entries[i]] = nodes[entries[i]].box.centerLongitude();
+        }
+    }
+    const std::vector<double> &lat = leaf ? latitudes : centerLatitude;
+    const std::vector<double> &lon = leaf ? longitudes : centerLongitude;
+
+    size_t nodeCount = (entries.size() + kMaxEntries - 1) / kMaxEntries;
+    size_t sliceCount = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(nodeCount))));
+    size_t sliceSize = sliceCount * kMaxEntries;
+
+    ByLongitude byLongitude = { lon };
+    ByLatitude byLatitude = { lat };
+    std::sort(entries.begin(), entries.end(), byLongitude);
+
+    std::vector<uint32_t> packed;
+    for (size_t start = 0; start < entries.size(); start += sliceSize) {
+        size_t end = std::min(start + sliceSize, entries.size());
+        std::sort(entries.begin() + start, entries.begin() + end, byLatitude);
+        for (size_t first = start; first < end; first += kMaxEntries) {
+            int32_t node = allocateNode(leaf);
+            Node &current = nodes[node];
+            size_t last = std::min(first + kMaxEntries, end);
+            for (size_t i = first; i < last; i++) {
+                current.entries[current.count++] = entries[i];
+                attach(node, entries[i]);
+                current.box.expand(entryBox(current, current.count - 1));
+            }
+            packed.push_back(static_cast<uint32_t>(node));
+        }
+    }
+    return packed;
+}
+
+void LSSpatialIndex::load(const uint32_t *ids, const double *lats, const double *lons, size_t count)
+{
+    clear();
+    if (count == 0) {
+        return;
+    }
+
+    uint32_t largest = *std::max_element(ids, ids + count);
+    latitudes.resize(largest + 1);
+    longitudes.resize(largest + 1);
+    leafOf.resize(largest + 1, -1);
+
+    std::vector<uint32_t> entries(ids, ids + count);
+    for (size_t i = 0; i < count; i++) {
+        latitudes[ids[i]] = lats[i];
+        longitudes[ids[i]] = lons[i];
+    }
+    pointCount = count;
+
+    bool leaf = true;
+    do {
+        entries = pack(entries, leaf);
+        leaf = false;
+    } while (entries.size() > 1);
+
+    root = static_cast<int32_t>(entries[0]);
+}
+
+#pragma mark - Queries
+
+void LSSpatialIndex::queryBox(double northEastLatitude, double northEastLongitude, double southWestLatitude, double southWestLongitude, std::vector<uint32_t> &ids) const
+{
+    std::vector<uint32_t> *out = &ids;
+    auto collect = [out](uint32_t id) { out->push_back(id); };
+
+    if (southWestLongitude <= northEastLongitude) {
+        Box box = { southWestLatitude, southWestLongitude, northEastLatitude, northEastLongitude };
+        search(box, collect);
+    } else {
+        Box east = { southWestLatitude, southWestLongitude, northEastLatitude, 180.0 };
+        Box west = { southWestLatitude, -180.0, northEastLatitude, northEastLongitude };
+        search(east, collect);
+        search(west, collect);
+    }
+}
+
+void LSSpatialIndex::queryDistance(double centerLatitude, double centerLongitude, double radius, std::vector<uint32_t> &ids, std::vector<double> &distances) const
+{
+    // Candidates come from the bounding box of the circle, the exact distance
+    // is then computed for all of them in one batch.
+    double angle = radius / kMeanRadius;
+    double degrees = angle * 180.0 / kPi;
+    double minLatitude = centerLatitude - degrees;
+    double maxLatitude = centerLatitude + degrees;
+
+    std::vector<uint32_t> candidates;
+    double spread = std::sin(angle) / std::cos(centerLatitude * kPi / 180.0);
+    if (angle >= kPi / 2 || maxLatitude >= 90.0 || minLatitude <= -90.0 || spread >= 1.0) {
+        queryBox(std::min(maxLatitude, 90.0), 180.0, std::max(minLatitude, -90.0), -180.0, candidates);
+    } else {
+        double halfWidth = std::asin(spread) * 180.0 / kPi;
+        double west = centerLongitude - halfWidth;
+        double east = centerLongitude + halfWidth;
+        if (west < -180.0) {
+            west += 360.0;
+        }
+        if (east > 180.0) {
+            east -= 360.0;
+        }
+        queryBox(maxLatitude, east, minLatitude, west, candidates);
+    }
+
+    std::vector<double> lat(candidates.size()), lon(candidates.size()), distance(candidates.size());
+    for (size_t i = 0; i < candidates.size(); i++) {
+        lat[i] = latitudes[candidates[i]];
+        lon[i] = longitudes[candidates[i]];
+    }
+    LSGeoDistanceBatch(centerLatitude, centerLongitude, lat.data(), lon.data(), candidates.size(), distance.data(), LSGeoDistanceHaversine);
+
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (distance[i] <= radius) {
+            ids.push_back(candidates[i]);
+            distances.push_back(distance[i]);
+        }
+    }
+}
+
+namespace {
+
+struct Candidate {
+    double distance;
+    uint32_t id;
+    bool point;
+
+    bool operator<(const Candidate &other) const { return distance > other.distance; }
+};
+
+} // namespace
+
+// Best-first search: nodes and points share one queue ordered by distance,
+// nodes keyed by the lower bound of their box. A point that reaches the top
+// is closer than anything still queued, so the first k points are the answer.
+void LSSpatialIndex::queryNearest(double centerLatitude, double centerLongitude, size_t k, std::vector<uint32_t> &ids, std::vector<double> &distances) const
+{
+    if (root < 0 || k == 0) {
+        return;
+    }
+
+    std::priority_queue<Candidate> queue;
+    Candidate start = { 0, static_cast<uint32_t>(root), false };
+    queue.push(start);
+
+    while (!queue.empty() && ids.size() < k) {
+        Candidate top = queue.top();
+        queue.pop();
+
+        if (top.point) {
+            ids.push_back(top.id);
+            distances.push_back(top.distance);
+            continue;
+        }
+
+        const Node &node = nodes[top.id];
+        for (uint32_t i = 0; i < node.count; i++) {
+            uint32_t entry = node.entries[i];
+            Candidate next;
+            next.id = entry;
+            next.point = node.leaf;
+            if (node.leaf) {
+                next.distance = LSGeoDistance(centerLatitude, centerLongitude, latitudes[entry], longitudes[entry], LSGeoDistanceHaversine);
+            } else {
+                next.distance = nodes[entry].box.distanceFrom(centerLatitude, centerLongitude);
+            }
+            queue.push(next);
+        }
+    }
+}
+
+#pragma mark - C interface
+
+LSSpatialIndexRef LSSpatialIndexCreate(void)
+{
+    return new LSSpatialIndex();
+}
+
+void LSSpatialIndexDestroy(LSSpatialIndexRef index)
+{
+    delete index;
+}
+
+size_t LSSpatialIndexCount(LSSpatialIndexRef index)
+{
+    return index->size();
+}
+
+void LSSpatialIndexLoad(LSSpatialIndexRef index, const uint32_t *ids, const double *latitudes, const double *longitudes, size_t count)
+{
+    index->load(ids, latitudes, longitudes, count);
+}
+
+void LSSpatialIndexLoadMembers(LSSpatialIndexRef index, LSMemberTableRef table)
+{
+    index->load(table->userIndex.data(), table->latitude.data(), table->longitude.data(), table->size());
+}
+
+void LSSpatialIndexMove(LSSpatialIndexRef index, uint32_t pointID, double latitude, double longitude)
+{
+    index->move(pointID, latitude, longitude);
+}
+
+void LSSpatialIndexRemove(LSSpatialIndexRef index, uint32_t pointID)
+{
+    index->remove(pointID);
+}
+
+size_t LSSpatialIndexQueryBox(LSSpatialIndexRef index, double northEastLatitude, double northEastLongitude, double southWestLatitude, double southWestLongitude, uint32_t *pointIDs, size_t capacity)
+{
+    std::vector<uint32_t> ids;
+    index->queryBox(northEastLatitude, northEastLongitude, southWestLatitude, southWestLongitude, ids);
+    std::copy(ids.begin(), ids.begin() + std::min(capacity, ids.size()), pointIDs);
+    return ids.size();
+}
+
+size_t LSSpatialIndexQueryDistance(LSSpatialIndexRef index, double centerLatitude, double centerLongitude, double radius, uint32_t *pointIDs, double *distances, size_t capacity)
+{
+    std::vector<uint32_t> ids;
+    std::vector<double> meters;
+    index->queryDistance(centerLatitude, centerLongitude, radius, ids, meters);
+    size_t written = std::min(capacity, ids.size());
+    std::copy(ids.begin(), ids.begin() + written, pointIDs);
+    if (distances) {
+        std::copy(meters.begin(), meters.begin() + written, distances);
+    }
+    return ids.size();
+}
+
+size_t LSSpatialIndexQueryNearest(LSSpatialIndexRef index, double centerLatitude, double centerLongitude, size_t k, uint32_t *pointIDs, double *distances)
+{
+    std::vector<uint32_t> ids;
+    std::vector<double> meters;
+    index->queryNearest(centerLatitude, centerLongitude, k, ids, meters);
+    std::copy(ids.begin(), ids.end(), pointIDs);
+    if (distances) {
+        std::copy(meters.begin(), meters.end(), distances);
+    }
+    return ids.size();
+}
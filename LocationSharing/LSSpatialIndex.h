@@ -0,0 +1,155 @@
+//
+//  LSSpatialIndex.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-05.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSSpatialIndex_h
+#define LSSpatialIndex_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "LSMemberTable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// R-tree over points, answering the same questions as KiiClause geoBox and
+// geoDistance against the local cache.
+//
+// Points are identified by the caller (the member table user index). Load
+// packs the tree with Sort-Tile-Recursive, Move relocates one point in
+// O(log n) and only restructures the tree when the point leaves its leaf.
+//
+// Queries return the number of matches and write at most capacity of them.
+
+typedef struct LSSpatialIndex *LSSpatialIndexRef;
+
+LSSpatialIndexRef LSSpatialIndexCreate(void);
+void LSSpatialIndexDestroy(LSSpatialIndexRef index);
+
+size_t LSSpatialIndexCount(LSSpatialIndexRef index);
+
+void LSSpatialIndexLoad(LSSpatialIndexRef index, const uint32_t *ids, const double *latitudes, const double *longitudes, size_t count);
+void LSSpatialIndexLoadMembers(LSSpatialIndexRef index, LSMemberTableRef table);
+
+// Inserts the point if it is not indexed yet.
+void LSSpatialIndexMove(LSSpatialIndexRef index, uint32_t pointID, double latitude, double longitude);
+void LSSpatialIndexRemove(LSSpatialIndexRef index, uint32_t pointID);
+
+// Boxes crossing the 180th meridian have a south west longitude greater
+// than the north east one, like in KiiClause geoBox.
+size_t LSSpatialIndexQueryBox(LSSpatialIndexRef index, double northEastLatitude, double northEastLongitude, double southWestLatitude, double southWestLongitude, uint32_t *pointIDs, size_t capacity);
+
+// Distances are written next to the IDs when distances is not NULL.
+size_t LSSpatialIndexQueryDistance(LSSpatialIndexRef index, double centerLatitude, double centerLongitude, double radius, uint32_t *pointIDs, double *distances, size_t capacity);
+
+// The k points closest to the center, nearest first, with their distances in
+// meters. Returns how many were found, at most k.
+size_t LSSpatialIndexQueryNearest(LSSpatialIndexRef index, double centerLatitude, double centerLongitude, size_t k, uint32_t *pointIDs, double *distances);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+struct LSSpatialIndex {
+    static const uint32_t kMaxEntries = 16;
+    static const uint32_t kMinEntries = 6;
+
+    struct Box {
+        double minLatitude;
+        double minLongitude;
+        double maxLatitude;
+        double maxLongitude;
+
+        static Box empty();
+        static Box point(double latitude, double longitude);
+        void expand(const Box &other);
+        bool contains(double latitude, double longitude) const;
+        bool intersects(const Box &other) const;
+        double area() const;
+        double margin() const;
+        double centerLatitude() const { return (minLatitude + maxLatitude) * 0.5; }
+        double centerLongitude() const { return (minLongitude + maxLongitude) * 0.5; }
+        // Shortest great circle distance in meters from a point to the box.
+        double distanceFrom(double latitude, double longitude) const;
+    };
+
+    struct Node {
+        Box box;
+        int32_t parent;
+        uint32_t count;
+        bool leaf;
+        // One spare slot holds the overflowing entry until the node is split.
+        uint32_t entries[kMaxEntries + 1];
+    };
+
+    std::vector<Node> nodes;
+    int32_t root = -1;
+
+    size_t size() const { return pointCount; }
+    bool contains(uint32_t pointID) const { return pointID < leafOf.size() && leafOf[pointID] >= 0; }
+    double latitude(uint32_t pointID) const { return latitudes[pointID]; }
+    double longitude(uint32_t pointID) const { return longitudes[pointID]; }
+
+    void load(const uint32_t *ids, const double *lats, const double *lons, size_t count);
+    void move(uint32_t pointID, double lat, double lon);
+    void remove(uint32_t pointID);
+    void clear();
+
+    Box entryBox(const Node &node, uint32_t slot) const;
+
+    // Calls visit(pointID) for every point inside the box.
+    template <class Visitor>
+    void search(const Box &box, Visitor visit) const
+    {
+        if (root < 0) {
+            return;
+        }
+        std::vector<int32_t> stack(1, root);
+        while (!stack.empty()) {
+            const Node &node = nodes[stack.back()];
+            stack.pop_back();
+            for (uint32_t i = 0; i < node.count; i++) {
+                uint32_t entry = node.entries[i];
+                if (node.leaf) {
+                    if (box.contains(latitudes[entry], longitudes[entry])) {
+                        visit(entry);
+                    }
+                } else if (box.intersects(nodes[entry].box)) {
+                    stack.push_back(static_cast<int32_t>(entry));
+                }
+            }
+        }
+    }
+
+    void queryBox(double northEastLatitude, double northEastLongitude, double southWestLatitude, double southWestLongitude, std::vector<uint32_t> &ids) const;
+    void queryDistance(double centerLatitude, double centerLongitude, double radius, std::vector<uint32_t> &ids, std::vector<double> &distances) const;
+    void queryNearest(double centerLatitude, double centerLongitude, size_t k, std::vector<uint32_t> &ids, std::vector<double> &distances) const;
+
+private:
+    std::vector<double> latitudes;
+    std::vector<double> longitudes;
+    std::vector<int32_t> leafOf;
+    std::vector<int32_t> freeNodes;
+    size_t pointCount = 0;
+
+    int32_t allocateNode(bool leaf);
+    void releaseNode(int32_t node);
+    void attach(int32_t node, uint32_t entry);
+    void refresh(int32_t node);
+    int32_t chooseLeaf(const Box &box) const;
+    void insert(int32_t node, uint32_t entry);
+    void split(int32_t node);
+    void condense(int32_t node);
+    std::vector<uint32_t> pack(std::vector<uint32_t> &entries, bool leaf);
+};
+
+#endif
+
+#endif /* LSSpatialIndex_h */
@@ -0,0 +1,363 @@
+//
+//  LSTrajectoryStore.cpp
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-23.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#include "LSTrajectoryStore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const uint8_t kMagic[4] = { 'L', 'S', 'T', '1' };
+
+#pragma mark - Varints
+
+inline uint64_t zigzag(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline void putVarint(std::vector<uint8_t> &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Returns false at the end of the input or on an overlong varint.
+inline bool getVarint(const uint8_t *&cursor, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (cursor == end) {
+            return false;
+        }
+        uint8_t byte = *cursor++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool getSigned(const uint8_t *&cursor, const uint8_t *end, int64_t &value)
+{
+    uint64_t raw;
+    if (!getVarint(cursor, end, raw)) {
+        return false;
+    }
+    value = unzigzag(raw);
+    return true;
+}
+
+inline bool decodeFix(const uint8_t *&cursor, const uint8_t *end, LSTrajectoryStore::Fix &fix)
+{
+    int64_t dt, dlat, dlon;
+    if (!getSigned(cursor, end, dt) || !getSigned(cursor, end, dlat) || !getSigned(cursor, end, dlon)) {
+        return false;
+    }
+    // Wrapping arithmetic, so corrupt input cannot overflow.
+    fix.timestamp = static_cast<int64_t>(static_cast<uint64_t>(fix.timestamp) + static_cast<uint64_t>(dt));
+    fix.latitude = static_cast<int32_t>(static_cast<uint32_t>(fix.latitude) + static_cast<uint32_t>(dlat));
+    fix.longitude = static_cast<int32_t>(static_cast<uint32_t>(fix.longitude) + static_cast<uint32_t>(dlon));
+    return true;
+}
+
+inline int32_t microdegrees(double degrees)
+{
+    return static_cast<int32_t>(std::lround(degrees * 1e6));
+}
+
+} // namespace
+
+#pragma mark - Store
+
+void LSTrajectoryStore::encode(Chunk &chunk, const Fix &fix)
+{
+    if (chunk.count % kIndexInterval == 0) {
+        IndexEntry entry = { chunk.last, static_cast<uint32_t>(chunk.bytes.size()) };
+        chunk.index.push_back(entry);
+    }
+    putVarint(chunk.bytes, zigzag(fix.timestamp - chunk.last.timestamp));
+    putVarint(chunk.bytes, zigzag(static_cast<int64_t>(fix.latitude) - chunk.last.latitude));
+    putVarint(chunk.bytes, zigzag(static_cast<int64_t>(fix.longitude) - chunk.last.longitude));
+    chunk.last = fix;
+    chunk.count++;
+}
+
+bool LSTrajectoryStore::append(uint32_t user, const Fix &fix)
+{
+    if (user >= users.size()) {
+        users.resize(user + 1);
+    }
+    std::vector<Chunk> &chunks = users[user];
+
+    if (!chunks.empty() && fix.timestamp <= chunks.back().last.timestamp) {
+        return false;
+    }
+
+    if (chunks.empty() || chunks.back().count == kChunkFixes) {
+        if (!chunks.empty()) {
+            chunks.back().bytes.shrink_to_fit();
+        }
+        // The first fix is a delta from itself, so chunks decode on their own.
+        Chunk chunk;
+        chunk.last = fix;
+        chunk.count = 0;
+        chunks.push_back(chunk);
+    }
+
+    encode(chunks.back(), fix);
+    return true;
+}
+
+void LSTrajectoryStore::remove(uint32_t user)
+{
+    if (user < users.size()) {
+        std::vector<Chunk>().swap(users[user]);
+    }
+}
+
+void LSTrajectoryStore::trim(int64_t before)
+{
+    for (std::vector<Chunk> &chunks : users) {
+        auto kept = std::lower_bound(chunks.begin(), chunks.end(), before, [](const Chunk &chunk, int64_t time) {
+            return chunk.last.timestamp < time;
+        });
+        if (kept == chunks.end() && kept != chunks.begin()) {
+            --kept;
+        }
+        chunks.erase(chunks.begin(), kept);
+    }
+}
+
+size_t LSTrajectoryStore::count(uint32_t user) const
+{
+    if (user >= users.size()) {
+        return 0;
+    }
+    size_t total = 0;
+    for (const Chunk &chunk : users[user]) {
+        total += chunk.count;
+    }
+    return total;
+}
+
+size_t LSTrajectoryStore::bytes() const
+{
+    size_t total = 0;
+    for (const std::vector<Chunk> &chunks : users) {
+        for (const Chunk &chunk : chunks) {
+            total += chunk.bytes.capacity() + chunk.index.capacity() * sizeof(IndexEntry) + sizeof(Chunk);
+        }
+    }
+    return total;
+}
+
+void LSTrajectoryStore::query(uint32_t user, int64_t from, int64_t to, std::vector<Fix> &fixes) const
+{
+    if (user >= users.size() || from > to) {
+        return;
+    }
+    const std::vector<Chunk> &chunks = users[user];
+
+    // Chunks are in time order: skip to the first one that reaches from.
+    auto first = std::lower_bound(chunks.begin(), chunks.end(), from, [](const Chunk &chunk, int64_t time) {
+        return chunk.last.timestamp < time;
+    });
+
+    for (auto chunk = first; chunk != chunks.end(); ++chunk) {
+        // The last index entry that starts before the window.
+        auto entry = std::upper_bound(chunk->index.begin(), chunk->index.end(), from, [](int64_t time, const IndexEntry &entry) {
+            return time <= entry.previous.timestamp;
+        });
+        if (entry != chunk->index.begin()) {
+            --entry;
+        }
+        if (entry->previous.timestamp > to) {
+            return;
+        }
+
+        Fix fix = entry->previous;
+        const uint8_t *cursor = chunk->bytes.data() + entry->offset;
+        const uint8_t *end = chunk->bytes.data() + chunk->bytes.size();
+        while (cursor < end && decodeFix(cursor, end, fix)) {
+            if (fix.timestamp > to) {
+                return;
+            }
+            if (fix.timestamp >= from) {
+                fixes.push_back(fix);
+            }
+        }
+    }
+}
+
+void LSTrajectoryStore::clear()
+{
+    users.clear();
+}
+
+#pragma mark - Serialization
+
+// Magic, user count, then per user the chunk count and per chunk the fix
+// count, the first fix and the encoded bytes. The index is rebuilt while
+// loading.
+void LSTrajectoryStore::serialize(std::vector<uint8_t> &out) const
+{
+    out.insert(out.end(), kMagic, kMagic + sizeof(kMagic));
+    putVarint(out, users.size());
+    for (const std::vector<Chunk> &chunks : users) {
+        putVarint(out, chunks.size());
+        for (const Chunk &chunk : chunks) {
+            const Fix &first = chunk.index.front().previous;
+            putVarint(out, chunk.count);
+            putVarint(out, zigzag(first.timestamp));
+            putVarint(out, zigzag(first.latitude));
+            putVarint(out, zigzag(first.longitude));
+            putVarint(out, chunk.bytes.size());
+            out.insert(out.end(), chunk.bytes.begin(), chunk.bytes.end());
+        }
+    }
+}
+
+bool LSTrajectoryStore::deserialize(const uint8_t *bytes, size_t length)
+{
+    clear();
+    if (length < sizeof(kMagic) || std::memcmp(bytes, kMagic, sizeof(kMagic)) != 0) {
+        return false;
+    }
+    const uint8_t *cursor = bytes + sizeof(kMagic);
+    const uint8_t *end = bytes + length;
+
+    // Counts can be no larger than the bytes left, which bounds the allocations.
+    uint64_t userCount;
+    if (!getVarint(cursor, end, userCount) || userCount > static_cast<uint64_t>(end - cursor)) {
+        return false;
+    }
+    users.resize(userCount);
+
+    for (std::vector<Chunk> &chunks : users) {
+        uint64_t chunkCount;
+        if (!getVarint(cursor, end, chunkCount) || chunkCount > static_cast<uint64_t>(end - cursor)) {
+            clear();
+            return false;
+        }
+        for (uint64_t i = 0; i < chunkCount; i++) {
+            uint64_t fixCount, size;
+            int64_t timestamp, latitude, longitude;
+            if (!getVarint(cursor, end, fixCount) || !getSigned(cursor, end, timestamp) || !getSigned(cursor, end, latitude)
+                || !getSigned(cursor, end, longitude) || !getVarint(cursor, end, size) || fixCount == 0 || fixCount > kChunkFixes
+                || size > static_cast<uint64_t>(end - cursor)) {
+                clear();
+                return false;
+            }
+
+            // Decode every fix and encode it again, which checks the data and
+            // rebuilds the index.
+            Fix fix = { timestamp, static_cast<int32_t>(latitude), static_cast<int32_t>(longitude) };
+            Chunk chunk;
+            chunk.last = fix;
+            chunk.count = 0;
+            chunk.bytes.reserve(size);
+            const uint8_t *chunkEnd = cursor + size;
+            for (uint64_t j = 0; j < fixCount; j++) {
+                Fix previous = fix;
+                if (!decodeFix(cursor, chunkEnd, fix) || (j > 0 && fix.timestamp <= previous.timestamp)) {
+                    clear();
+                    return false;
+                }
+                encode(chunk, fix);
+            }
+            if (cursor != chunkEnd || (!chunks.empty() && chunk.index.front().previous.timestamp <= chunks.back().last.timestamp)) {
+                clear();
+                return false;
+            }
+            chunks.push_back(std::move(chunk));
+        }
+    }
+    if (cursor != end) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+#pragma mark - C interface
+
+LSTrajectoryStoreRef LSTrajectoryStoreCreate(void)
+{
+    return new LSTrajectoryStore();
+}
+
+void LSTrajectoryStoreDestroy(LSTrajectoryStoreRef store)
+{
+    delete store;
+}
+
+bool LSTrajectoryStoreAppend(LSTrajectoryStoreRef store, uint32_t userIndex, int64_t timestamp, double latitude, double longitude)
+{
+    LSTrajectoryStore::Fix fix = { timestamp, microdegrees(latitude), microdegrees(longitude) };
+    return store->append(userIndex, fix);
+}
+
+void LSTrajectoryStoreRemove(LSTrajectoryStoreRef store, uint32_t userIndex)
+{
+    store->remove(userIndex);
+}
+
+void LSTrajectoryStoreTrim(LSTrajectoryStoreRef store, int64_t before)
+{
+    store->trim(before);
+}
+
+size_t LSTrajectoryStoreCount(LSTrajectoryStoreRef store, uint32_t userIndex)
+{
+    return store->count(userIndex);
+}
+
+size_t LSTrajectoryStoreBytes(LSTrajectoryStoreRef store)
+{
+    return store->bytes();
+}
+
+size_t LSTrajectoryStoreQuery(LSTrajectoryStoreRef store, uint32_t userIndex, int64_t from, int64_t to, int64_t *timestamps, double *latitudes, double *longitudes, size_t capacity)
+{
+    std::vector<LSTrajectoryStore::Fix> fixes;
+    store->query(userIndex, from, to, fixes);
+    size_t written = std::min(capacity, fixes.size());
+    for (size_t i = 0; i < written; i++) {
+        timestamps[i] = fixes[i].timestamp;
+        latitudes[i] = fixes[i].latitude * 1e-6;
+        longitudes[i] = fixes[i].longitude * 1e-6;
+    }
+    return fixes.size();
+}
+
+size_t LSTrajectoryStoreSerialize(LSTrajectoryStoreRef store, uint8_t *buffer, size_t capacity)
+{
+    std::vector<uint8_t> bytes;
+    store->serialize(bytes);
+    if (bytes.size() <= capacity) {
+        std::copy(bytes.begin(), bytes.end(), buffer);
+    }
+    return bytes.size();
+}
+
+bool LSTrajectoryStoreDeserialize(LSTrajectoryStoreRef store, const uint8_t *bytes, size_t length)
+{
+    return store->deserialize(bytes, length);
+}
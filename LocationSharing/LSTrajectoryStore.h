@@ -0,0 +1,109 @@
+//
+//  LSTrajectoryStore.h
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-23.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+#ifndef LSTrajectoryStore_h
+#define LSTrajectoryStore_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Location history of every member, compressed in memory.
+//
+// Fixes are kept per member (the member table user index) in append-only
+// chunks. Each fix is stored as the change from the previous one: time in
+// milliseconds, latitude and longitude in micro-degrees, each as a zigzag
+// varint, so a walking member at 1 Hz costs about 4 bytes per fix. Every
+// 32nd fix of a chunk gets an entry in a sparse time index, so a range scan
+// decodes at most 31 fixes before the window starts.
+//
+// A member's fixes must come in time order; a fix no newer than the last one
+// is rejected, so fetching the same object again adds nothing.
+
+typedef struct LSTrajectoryStore *LSTrajectoryStoreRef;
+
+LSTrajectoryStoreRef LSTrajectoryStoreCreate(void);
+void LSTrajectoryStoreDestroy(LSTrajectoryStoreRef store);
+
+bool LSTrajectoryStoreAppend(LSTrajectoryStoreRef store, uint32_t userIndex, int64_t timestamp, double latitude, double longitude);
+
+// Drops every fix of the member, as when it leaves the member table.
+void LSTrajectoryStoreRemove(LSTrajectoryStoreRef store, uint32_t userIndex);
+// Drops the fixes older than before, a whole chunk at a time, so fixes up to
+// a chunk older may stay. The newest chunk of a member is always kept, so a
+// fix fetched again is still rejected.
+void LSTrajectoryStoreTrim(LSTrajectoryStoreRef store, int64_t before);
+
+size_t LSTrajectoryStoreCount(LSTrajectoryStoreRef store, uint32_t userIndex);
+// Memory held by the encoded fixes and the time index.
+size_t LSTrajectoryStoreBytes(LSTrajectoryStoreRef store);
+
+// Fixes of the member with from <= timestamp <= to, oldest first. Returns the
+// number of fixes in the window and writes at most capacity of them.
+size_t LSTrajectoryStoreQuery(LSTrajectoryStoreRef store, uint32_t userIndex, int64_t from, int64_t to, int64_t *timestamps, double *latitudes, double *longitudes, size_t capacity);
+
+// The whole store as bytes, to keep on disk or upload as an object body.
+// Returns the size needed; nothing is written when it exceeds capacity.
+size_t LSTrajectoryStoreSerialize(LSTrajectoryStoreRef store, uint8_t *buffer, size_t capacity);
+// Replaces the contents of the store. Returns false, leaving the store
+// empty, when the bytes are not a serialized store.
+bool LSTrajectoryStoreDeserialize(LSTrajectoryStoreRef store, const uint8_t *bytes, size_t length);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+struct LSTrajectoryStore {
+    static const uint32_t kChunkFixes = 1024;
+    static const uint32_t kIndexInterval = 32;
+
+    struct Fix {
+        int64_t timestamp;
+        int32_t latitude;
+        int32_t longitude;
+    };
+
+    // Decoding from an entry starts with the fix before it, so the entry
+    // stores that fix and where the next one begins in the chunk.
+    struct IndexEntry {
+        Fix previous;
+        uint32_t offset;
+    };
+
+    struct Chunk {
+        std::vector<uint8_t> bytes;
+        std::vector<IndexEntry> index;
+        Fix last;
+        uint32_t count;
+    };
+
+    bool append(uint32_t user, const Fix &fix);
+    void remove(uint32_t user);
+    void trim(int64_t before);
+    size_t count(uint32_t user) const;
+    size_t bytes() const;
+    void query(uint32_t user, int64_t from, int64_t to, std::vector<Fix> &fixes) const;
+    void clear();
+
+    void serialize(std::vector<uint8_t> &out) const;
+    bool deserialize(const uint8_t *bytes, size_t length);
+
+private:
+    std::vector<std::vector<Chunk>> users;
+
+    static void encode(Chunk &chunk, const Fix &fix);
+};
+
+#endif
+
+#endif /* LSTrajectoryStore_h */
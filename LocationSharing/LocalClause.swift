@@ -0,0 +1,48 @@
+//
+//  LocalClause.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-10.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// A query clause in its REST JSON form, compiled once and run against the
+// member table, so a repeated query or offline refresh needs no round trip.
+// The same dictionary builds the server query with KiiQuery(dictionary:).
+class LocalClause: NSObject {
+
+    let ref: LSClauseRef
+
+    init?(dictionary: [String: AnyObject]) {
+
+        guard let data = try? NSJSONSerialization.dataWithJSONObject(dictionary, options: []) else {
+            return nil
+        }
+
+        let ref = LSClauseCompile(UnsafePointer<CChar>(data.bytes), data.length)
+
+        if ref == nil {
+            return nil
+        }
+
+        self.ref = ref
+
+        super.init()
+    }
+
+    deinit {
+        LSClauseDestroy(ref)
+    }
+
+    // Matching rows in ascending order
+    func rows(table: MemberTable) -> [Int] {
+
+        var rows = [UInt32](count: table.count, repeatedValue: 0)
+
+        let found = LSClauseEvaluate(ref, table.ref, &rows, rows.count)
+
+        return rows[0 ..< min(found, rows.count)].map { Int($0) }
+    }
+}
@@ -0,0 +1,77 @@
+//
+//  LocationBatcher.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-30.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import MapKit
+import UIKit
+
+// Gathers location updates for the group topic and publishes them together,
+// one push message per window however many members moved in it.
+class LocationBatcher: NSObject {
+
+    let batcher: LSFrameBatcherRef
+
+    let stream: LocationStream
+
+    private var timer: NSTimer?
+
+    init(stream: LocationStream, window: NSTimeInterval = 0.2, maxRecords: Int = 100) {
+        self.stream = stream
+        batcher = LSFrameBatcherCreate(Int64(window * 1000), maxRecords)
+        super.init()
+    }
+
+    deinit {
+        LSFrameBatcherDestroy(batcher)
+    }
+
+    var count: Int {
+        return LSFrameBatcherCount(batcher)
+    }
+
+    // Sent within the window, or right away once the batch is full
+    func add(userID: String, location: CLLocation) {
+
+        var record = LocationStream.recordOf(userID, location: location)
+
+        if LSFrameBatcherAdd(batcher, &record, LocationBatcher.now()) {
+            flush()
+            return
+        }
+
+        if timer == nil {
+            let delay = Double(LSFrameBatcherDeadline(batcher) - LocationBatcher.now()) / 1000
+            timer = NSTimer.scheduledTimerWithTimeInterval(max(delay, 0), target: self, selector: #selector(LocationBatcher.flush), userInfo: nil, repeats: false)
+        }
+    }
+
+    // Publishes everything queued, in as many frames as it takes
+    func flush() {
+
+        timer?.invalidate()
+        timer = nil
+
+        while true {
+
+            let size = LSFrameBatcherTake(batcher, nil, 0)
+
+            if size == 0 {
+                break
+            }
+
+            let frame = NSMutableData(length: size)!
+
+            LSFrameBatcherTake(batcher, UnsafeMutablePointer<UInt8>(frame.mutableBytes), size)
+
+            stream.publish(frame)
+        }
+    }
+
+    class func now() -> Int64 {
+        return Int64(NSDate().timeIntervalSince1970 * 1000)
+    }
+}
@@ -0,0 +1,498 @@
+//
+//  LocationStream.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-26.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import MapKit
+import UIKit
+
+// Live member locations over the MQTT push channel of Kii Cloud.
+//
+// Locations go out as push messages to a group topic, each a binary
+// location frame (see LSLocationFrame.h) in base64 under the "f" key, since
+// MQTT fields only carry a flat dictionary. Kii Cloud delivers
+// them to the MQTT topic of every subscribed installation, which the stream
+// reads over one connection held open while it runs. While that connection
+// is down isAvailable is false and onAvailabilityChange tells the owner to
+// poll instead; the stream reconnects on its own, waiting longer each time.
+//
+// The endpoint is fetched from Kii Cloud unless start is given one, which is
+// how the stream runs against a local broker in tests.
+class LocationStream: NSObject, NSStreamDelegate {
+
+    struct Endpoint {
+        let host: String
+        let port: Int
+        let secure: Bool
+        let clientID: String
+        let username: String?
+        let password: String?
+        // Topic the broker delivers the messages of the installation on
+        let topic: String
+    }
+
+    let topic: KiiTopic
+
+    let members: MemberTable
+
+    // Rows moved by pushed locations, called on the main queue
+    var onUpdate: (([Int]) -> Void)?
+
+    var onAvailabilityChange: ((Bool) -> Void)?
+
+    private(set) var isAvailable = false
+
+    var keepAlive: UInt16 = 60
+
+    // Longest wait between two connection attempts
+    var maxRetryDelay: NSTimeInterval = 60
+
+    private let decoder = LSMQTTDecoderCreate(1 << 20)
+
+    private var endpoint: Endpoint?
+    private var fixedEndpoint = false
+    private var running = false
+
+    private var input: NSInputStream?
+    private var output: NSOutputStream?
+    private let outgoing = NSMutableData()
+
+    private var pingTimer: NSTimer?
+    private var retryTimer: NSTimer?
+    private var retryDelay: NSTimeInterval = 1
+    private var lastReceived = NSDate()
+    private var subscribeID: UInt16 = 0
+
+    init(topic: KiiTopic, members: MemberTable) {
+        self.topic = topic
+        self.members = members
+        super.init()
+    }
+
+    deinit {
+        LSMQTTDecoderDestroy(decoder)
+    }
+
+    // Timers keep the stream alive until stop is called
+    func start(endpoint: Endpoint? = nil) {
+
+        if running {
+            return
+        }
+
+        running = true
+
+        if endpoint != nil {
+            self.endpoint = endpoint
+            fixedEndpoint = true
+        }
+
+        connect()
+    }
+
+    func stop() {
+
+        running = false
+
+        retryTimer?.invalidate()
+        retryTimer = nil
+
+        if output != nil {
+            send { LSMQTTEncodeDisconnect($0, $1) }
+        }
+
+        close()
+        setAvailable(false)
+    }
+
+    // Sends the location to every member subscribed to the topic
+    func publish(userID: String, location: CLLocation, block: ((NSError?) -> Void)? = nil) {
+        publish([LocationStream.recordOf(userID, location: location)], block: block)
+    }
+
+    func publish(records: [LSLocationRecord], block: ((NSError?) -> Void)? = nil) {
+
+        guard let frame = LocationStream.frameOf(records) else {
+            block?(nil)
+            return
+        }
+
+        publish(frame, block: block)
+    }
+
+    func publish(frame: NSData, block: ((NSError?) -> Void)? = nil) {
+
+        let fields = KiiMQTTFields.createFields()
+        fields.data = ["f": frame.base64EncodedStringWithOptions([])]
+
+        let message = KiiPushMessage.composeMessageWithAPNSFields(nil, andGCMFields: nil, andMQTTFields: fields)
+
+        topic.sendMessage(message) { (topic : KiiTopic, error : NSError?) -> Void in
+            block?(error)
+        }
+    }
+
+    // Stamped in server time, receivers compare it with _modified
+    class func recordOf(userID: String, location: CLLocation) -> LSLocationRecord {
+        let timestamp = ServerClock.milliseconds(ServerClock.shared.serverDate(location.timestamp))
+        return LSLocationRecord(userKey: LSLocationFrameUserKey(userID), latitude: location.coordinate.latitude, longitude: location.coordinate.longitude, heading: location.course, speed: location.speed, accuracy: location.horizontalAccuracy, timestamp: timestamp)
+    }
+
+    // nil when the records span more time than one frame holds
+    class func frameOf(records: [LSLocationRecord]) -> NSData? {
+
+        let size = LSLocationFrameEncode(records, records.count, nil, 0)
+
+        if size == 0 {
+            return nil
+        }
+
+        let frame = NSMutableData(length: size)!
+
+        LSLocationFrameEncode(records, records.count, UnsafeMutablePointer<UInt8>(frame.mutableBytes), size)
+
+        return frame
+    }
+
+    // Moves the members of a pushed message, returns their rows
+    func apply(payload: NSData) -> [Int] {
+
+        guard let json = try? NSJSONSerialization.JSONObjectWithData(payload, options: []), message = json as? [String: AnyObject], encoded = message["f"] as? String, frame = NSData(base64EncodedString: encoded, options: []) else {
+            return []
+        }
+
+        return members.apply(frame)
+    }
+
+    // Where the installation ID of this device is kept between launches
+    static let installationKey = "LocationSharing.LocationStream.installationID"
+
+    // Debug builds install against the development push environment
+    class var development: Bool {
+        #if DEBUG
+            return true
+        #else
+            return false
+        #endif
+    }
+
+    // Installs this device for MQTT push once, subscribes it to the topic and
+    // asks where to connect. Blocks, so never call it on the main queue.
+    class func fetchEndpoint(topic: KiiTopic) -> Endpoint? {
+
+        let defaults = NSUserDefaults.standardUserDefaults()
+
+        guard let installationID = defaults.stringForKey(installationKey) ?? install() else {
+            return nil
+        }
+
+        defaults.setObject(installationID, forKey: installationKey)
+
+        // Both fail harmlessly when the topic or the subscription already exists
+        _ = try? topic.saveSynchronous()
+        _ = try? KiiUser.currentUser()?.pushSubscription().subscribeSynchronous(topic)
+
+        // The broker account may take a moment to be ready, the next attempt gets it
+        let request = KiiRequest(path: "installations/" + installationID + "/mqtt-endpoint", andApp: true)
+        request.requestMethod = Int32(KiiRequestGET.rawValue)
+
+        var error: NSError?
+        var status: Int32 = 0
+
+        let info = request.makeSynchronousRequest(&error, andResponseCode: &status) as? [String: AnyObject]
+
+        // The installation was deleted on the server, a new one is made next time
+        if status == 404 {
+            defaults.removeObjectForKey(installationKey)
+            return nil
+        }
+
+        guard let host = info?["host"] as? String, port = info?["portSSL"] as? Int, username = info?["username"] as? String, password = info?["password"] as? String, mqttTopic = info?["mqttTopic"] as? String where error == nil else {
+            return nil
+        }
+
+        return Endpoint(host: host, port: port, secure: true, clientID: mqttTopic, username: username, password: password, topic: mqttTopic)
+    }
+
+    // Creates an MQTT installation for this device, returns its ID
+    private class func install() -> String? {
+
+        var error: NSError?
+
+        let install = KiiRequest(path: "installations", andApp: true)
+        install.requestMethod = Int32(KiiRequestPOST.rawValue)
+        install.content = "application/vnd.kii.InstallationCreationRequest+json"
+        install.postData = ["deviceType": "MQTT", "development": development]
+
+        guard let installation = install.makeSynchronousRequest(&error) as? [String: AnyObject], installationID = installation["installationID"] as? String where error == nil else {
+            return nil
+        }
+
+        return installationID
+    }
+
+    // MARK: - Connection
+
+    private func connect() {
+
+        if !running {
+            return
+        }
+
+        if let endpoint = endpoint {
+            open(endpoint)
+            return
+        }
+
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)) {
+
+            let endpoint = LocationStream.fetchEndpoint(self.topic)
+
+            dispatch_async(dispatch_get_main_queue()) {
+                if let endpoint = endpoint {
+                    self.endpoint = endpoint
+                    self.open(endpoint)
+                } else {
+                    self.retry()
+                }
+            }
+        }
+    }
+
+    private func open(endpoint: Endpoint) {
+
+        if !running {
+            return
+        }
+
+        var input: NSInputStream?
+        var output: NSOutputStream?
+
+        NSStream.getStreamsToHostWithName(endpoint.host, port: endpoint.port, inputStream: &input, outputStream: &output)
+
+        guard let reader = input, writer = output else {
+            retry()
+            return
+        }
+
+        for stream in [reader, writer] as [NSStream] {
+            if endpoint.secure {
+                stream.setProperty(NSStreamSocketSecurityLevelNegotiatedSSL, forKey: NSStreamSocketSecurityLevelKey)
+            }
+            stream.delegate = self
+            // Common modes, so messages still arrive while the map is dragged
+            stream.scheduleInRunLoop(NSRunLoop.mainRunLoop(), forMode: NSRunLoopCommonModes)
+            stream.open()
+        }
+
+        self.input = reader
+        self.output = writer
+
+        LSMQTTDecoderReset(decoder)
+        outgoing.length = 0
+        lastReceived = NSDate()
+
+        let username = (endpoint.username as NSString?)?.UTF8String ?? nil
+        let password = (endpoint.password as NSString?)?.UTF8String ?? nil
+
+        send { LSMQTTEncodeConnect(endpoint.clientID, username, password, self.keepAlive, true, $0, $1) }
+
+        pingTimer = NSTimer.scheduledTimerWithTimeInterval(Double(keepAlive) / 2, target: self, selector: #selector(LocationStream.ping), userInfo: nil, repeats: true)
+    }
+
+    private func close() {
+
+        pingTimer?.invalidate()
+        pingTimer = nil
+
+        for stream in [input, output] as [NSStream?] {
+            stream?.delegate = nil
+            stream?.close()
+            stream?.removeFromRunLoop(NSRunLoop.mainRunLoop(), forMode: NSRunLoopCommonModes)
+        }
+
+        input = nil
+        output = nil
+        outgoing.length = 0
+    }
+
+    // The connection is lost, polling takes over until it is back
+    private func drop() {
+
+        if input == nil {
+            return
+        }
+
+        close()
+        setAvailable(false)
+        retry()
+    }
+
+    private func retry() {
+
+        if !running || retryTimer != nil {
+            return
+        }
+
+        retryTimer = NSTimer.scheduledTimerWithTimeInterval(retryDelay, target: self, selector: #selector(LocationStream.reconnect), userInfo: nil, repeats: false)
+
+        retryDelay = min(retryDelay * 2, maxRetryDelay)
+    }
+
+    func reconnect() {
+        retryTimer = nil
+        connect()
+    }
+
+    func ping() {
+
+        // Nothing heard for one and a half keep alive periods, the broker is gone
+        if NSDate().timeIntervalSinceDate(lastReceived) > Double(keepAlive) * 1.5 {
+            drop()
+            return
+        }
+
+        send { LSMQTTEncodePingReq($0, $1) }
+    }
+
+    private func setAvailable(available: Bool) {
+
+        if isAvailable == available {
+            return
+        }
+
+        isAvailable = available
+        onAvailabilityChange?(available)
+    }
+
+    // MARK: - Packets
+
+    private func send(encode: (UnsafeMutablePointer<UInt8>, Int) -> Int) {
+
+        let size = encode(nil, 0)
+
+        if size == 0 {
+            return
+        }
+
+        var packet = [UInt8](count: size, repeatedValue: 0)
+        encode(&packet, size)
+
+        outgoing.appendBytes(packet, length: size)
+        flush()
+    }
+
+    private func flush() {
+
+        guard let output = output where output.hasSpaceAvailable && outgoing.length > 0 else {
+            return
+        }
+
+        let written = output.write(UnsafePointer<UInt8>(outgoing.bytes), maxLength: outgoing.length)
+
+        if written > 0 {
+            outgoing.replaceBytesInRange(NSMakeRange(0, written), withBytes: nil, length: 0)
+        }
+    }
+
+    private func read() {
+
+        var buffer = [UInt8](count: 4096, repeatedValue: 0)
+
+        var rows = [Int]()
+
+        while let input = input where input.hasBytesAvailable {
+
+            let count = input.read(&buffer, maxLength: buffer.count)
+
+            if count <= 0 {
+                break
+            }
+
+            lastReceived = NSDate()
+
+            LSMQTTDecoderFeed(decoder, buffer, count)
+
+            // Packets point into the decoder, they are handled before the next read
+            var packet = LSMQTTPacket()
+
+            while LSMQTTDecoderNext(decoder, &packet) {
+                handle(packet, rows: &rows)
+            }
+
+            if LSMQTTDecoderFailed(decoder) {
+                drop()
+                break
+            }
+        }
+
+        if !rows.isEmpty {
+            onUpdate?(rows)
+        }
+    }
+
+    private func handle(packet: LSMQTTPacket, inout rows: [Int]) {
+
+        switch UInt32(packet.type) {
+
+        case LSMQTTConnAck.rawValue:
+
+            if packet.returnCode != 0 {
+                // Credentials may have been revoked, fetch new ones next time
+                if !fixedEndpoint {
+                    endpoint = nil
+                }
+                drop()
+                return
+            }
+
+            subscribeID = subscribeID &+ 1
+            if subscribeID == 0 {
+                subscribeID = 1
+            }
+
+            if let endpoint = endpoint {
+                let id = subscribeID
+                send { LSMQTTEncodeSubscribe(id, endpoint.topic, 1, $0, $1) }
+            }
+
+        case LSMQTTSubAck.rawValue:
+
+            if packet.packetID == subscribeID && packet.returnCode != 0x80 {
+                retryDelay = 1
+                setAvailable(true)
+            } else {
+                drop()
+            }
+
+        case LSMQTTPublish.rawValue:
+
+            if packet.qos > 0 {
+                let id = packet.packetID
+                send { LSMQTTEncodePubAck(id, $0, $1) }
+            }
+
+            rows.appendContentsOf(apply(NSData(bytes: packet.payload, length: packet.payloadLength)))
+
+        default:
+            break
+        }
+    }
+
+    func stream(stream: NSStream, handleEvent eventCode: NSStreamEvent) {
+
+        switch eventCode {
+        case NSStreamEvent.HasBytesAvailable:
+            read()
+        case NSStreamEvent.HasSpaceAvailable:
+            flush()
+        case NSStreamEvent.ErrorOccurred, NSStreamEvent.EndEncountered:
+            drop()
+        default:
+            break
+        }
+    }
+}
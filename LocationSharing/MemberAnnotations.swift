@@ -0,0 +1,90 @@
+//
+//  MemberAnnotations.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-18.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import MapKit
+import UIKit
+
+// One CustomPointAnnotation per member, kept in step with the member table by
+// adding, removing and moving only the annotations that changed, so MapKit
+// keeps the views of everyone else.
+class MemberAnnotations: NSObject {
+
+    let diff = LSAnnotationDiffCreate()
+
+    // Keyed by member table user index
+    private(set) var annotations = [UInt32: CustomPointAnnotation]()
+
+    deinit {
+        LSAnnotationDiffDestroy(diff)
+    }
+
+    func update(map: MKMapView, members: MemberTable) {
+
+        LSAnnotationDiffUpdate(diff, members.ref)
+
+        var count = 0
+
+        var removed = [CustomPointAnnotation]()
+
+        let deletes = LSAnnotationDiffDeletes(diff, &count)
+
+        for i in 0 ..< count {
+            if let annotation = annotations.removeValueForKey(deletes[i]) {
+                removed.append(annotation)
+            }
+        }
+
+        let moves = LSAnnotationDiffMoves(diff, &count)
+
+        for i in 0 ..< count {
+            let row = Int(LSMemberTableRowForUserIndex(members.ref, moves[i]))
+            annotations[moves[i]]?.coordinate = members.coordinate(row)
+        }
+
+        var added = [CustomPointAnnotation]()
+
+        let inserts = LSAnnotationDiffInserts(diff, &count)
+
+        for i in 0 ..< count {
+
+            let row = Int(LSMemberTableRowForUserIndex(members.ref, inserts[i]))
+
+            let annotation = CustomPointAnnotation()
+            annotation.coordinate = members.coordinate(row)
+            annotation.id = members.userID(row)
+            annotation.title = annotation.id
+            annotation.imageName = "pin2X.png"
+
+            annotations[inserts[i]] = annotation
+            added.append(annotation)
+        }
+
+        map.removeAnnotations(removed)
+        map.addAnnotations(added)
+    }
+
+    // Moves the pins on the map to the predicted locations, without
+    // adding or removing any
+    func animate(members: MemberTable, motion: MemberMotion) {
+
+        let coordinates = motion.predict(members)
+
+        let userIndices = LSMemberTableUserIndices(members.ref)
+
+        for row in 0 ..< coordinates.count {
+            annotations[userIndices[row]]?.coordinate = coordinates[row]
+        }
+    }
+
+    // Takes every member annotation off the map
+    func removeAll(map: MKMapView) {
+        map.removeAnnotations(Array(annotations.values))
+        annotations.removeAll()
+        LSAnnotationDiffReset(diff)
+    }
+}
@@ -0,0 +1,120 @@
+//
+//  MemberClusters.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-19.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import MapKit
+import UIKit
+
+class ClusterAnnotation: CustomPointAnnotation {
+    var count = 0
+}
+
+// Shows the members in the visible region as clusters from the member table
+// cluster index, one annotation per cluster instead of one per member.
+//
+// Annotations are keyed by cell like MemberAnnotations keys them by member:
+// a cluster still in view keeps its annotation and only moves, so MapKit
+// keeps its view, and only the clusters that appeared or went away are
+// added or removed.
+class MemberClusters: NSObject {
+
+    // Keyed by cell at zoom
+    private(set) var annotations = [UInt64: ClusterAnnotation]()
+
+    private var zoom: UInt32? = nil
+
+    // Zoom level of the map, 0 when the whole world fits in 256 points
+    class func zoomOf(map: MKMapView) -> UInt32 {
+
+        let span = max(map.region.span.longitudeDelta, 1e-9)
+
+        let zoom = log2(360 * Double(map.bounds.width) / 256 / span)
+
+        return UInt32(min(max(zoom, 0), Double(LSClusterIndexMaxZoom)))
+    }
+
+    func update(map: MKMapView, members: MemberTable) {
+
+        let region = map.region
+
+        let northEast = (latitude: region.center.latitude + region.span.latitudeDelta / 2, longitude: region.center.longitude + region.span.longitudeDelta / 2)
+        let southWest = (latitude: region.center.latitude - region.span.latitudeDelta / 2, longitude: region.center.longitude - region.span.longitudeDelta / 2)
+
+        // Longitudes past the 180th meridian wrap, leaving west greater than east
+        let east = northEast.longitude > 180 ? northEast.longitude - 360 : northEast.longitude
+        let west = southWest.longitude < -180 ? southWest.longitude + 360 : southWest.longitude
+
+        let zoom = MemberClusters.zoomOf(map)
+
+        var clusters = [LSCluster](count: 256, repeatedValue: LSCluster())
+
+        var found = LSClusterIndexQuery(members.clusters, zoom, northEast.latitude, east, southWest.latitude, west, &clusters, clusters.count)
+
+        if found > clusters.count {
+            clusters = [LSCluster](count: found, repeatedValue: LSCluster())
+            found = LSClusterIndexQuery(members.clusters, zoom, northEast.latitude, east, southWest.latitude, west, &clusters, clusters.count)
+        }
+
+        // The same key names another cell at another zoom level
+        var previous = zoom == self.zoom ? annotations : [:]
+        var removed = zoom == self.zoom ? [] : Array(annotations.values)
+
+        var current = [UInt64: ClusterAnnotation]()
+        var added = [ClusterAnnotation]()
+
+        for cluster in clusters[0 ..< found] {
+
+            if let annotation = previous.removeValueForKey(cluster.cell) {
+                MemberClusters.describe(annotation, cluster: cluster, members: members)
+                // Only clusters of several members show a callout
+                map.viewForAnnotation(annotation)?.canShowCallout = cluster.count > 1
+                current[cluster.cell] = annotation
+                continue
+            }
+
+            let annotation = ClusterAnnotation()
+            annotation.imageName = "pin2X.png"
+            MemberClusters.describe(annotation, cluster: cluster, members: members)
+
+            current[cluster.cell] = annotation
+            added.append(annotation)
+        }
+
+        removed.appendContentsOf(previous.values)
+
+        map.removeAnnotations(removed)
+        map.addAnnotations(added)
+
+        annotations = current
+        self.zoom = zoom
+    }
+
+    private class func describe(annotation: ClusterAnnotation, cluster: LSCluster, members: MemberTable) {
+
+        let coordinate = CLLocationCoordinate2DMake(cluster.latitude, cluster.longitude)
+
+        if annotation.coordinate.latitude != coordinate.latitude || annotation.coordinate.longitude != coordinate.longitude {
+            annotation.coordinate = coordinate
+        }
+
+        annotation.count = Int(cluster.count)
+
+        if cluster.count == 1 {
+            annotation.id = String.fromCString(LSMemberTableUserID(members.ref, cluster.pointID))
+            annotation.title = annotation.id
+        } else {
+            annotation.id = nil
+            annotation.title = "\(cluster.count) members"
+        }
+    }
+
+    func removeAll(map: MKMapView) {
+        map.removeAnnotations(Array(annotations.values))
+        annotations.removeAll()
+        zoom = nil
+    }
+}
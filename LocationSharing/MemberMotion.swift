@@ -0,0 +1,56 @@
+//
+//  MemberMotion.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-25.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import MapKit
+import UIKit
+
+// Smoothed and predicted member locations, one Kalman filter per member
+// keyed by member table user index.
+class MemberMotion: NSObject {
+
+    let bank: LSKalmanBankRef
+
+    // Accuracy assumed for server locations, the objects do not carry one
+    var accuracy: CLLocationAccuracy = 10
+
+    init(processNoise: Double = 1, maxHorizon: NSTimeInterval = 10) {
+        bank = LSKalmanBankCreate(processNoise)
+        LSKalmanBankSetMaxHorizon(bank, Int64(maxHorizon * 1000))
+        super.init()
+    }
+
+    deinit {
+        LSKalmanBankDestroy(bank)
+    }
+
+    // Feeds the members whose location changed since the last call
+    func update(members: MemberTable) -> Int {
+        return LSKalmanBankUpdateMembers(bank, members.ref, accuracy)
+    }
+
+    // Where every row of the table is expected to be at the date, in server
+    // time like the table
+    func predict(members: MemberTable, at date: NSDate = ServerClock.shared.now()) -> [CLLocationCoordinate2D] {
+
+        let count = members.count
+
+        var latitudes = [Double](count: count, repeatedValue: 0)
+        var longitudes = [Double](count: count, repeatedValue: 0)
+
+        LSKalmanBankPredictMembers(bank, members.ref, Int64(date.timeIntervalSince1970 * 1000), &latitudes, &longitudes)
+
+        var coordinates = [CLLocationCoordinate2D]()
+        coordinates.reserveCapacity(count)
+
+        for i in 0 ..< count {
+            coordinates.append(CLLocationCoordinate2DMake(latitudes[i], longitudes[i]))
+        }
+
+        return coordinates
+    }
+}
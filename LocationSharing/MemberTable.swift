@@ -0,0 +1,271 @@
+//
+//  MemberTable.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-01.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import MapKit
+import UIKit
+
+class MemberTable: NSObject {
+
+    let ref = LSMemberTableCreate()
+
+    // Spatial index over the same members, keyed by user index
+    let index = LSSpatialIndexCreate()
+
+    // Pin clusters for every zoom level, keyed the same way
+    let clusters = LSClusterIndexCreate()
+
+    // Every location loaded for a member, keyed the same way
+    let history = LSTrajectoryStoreCreate()
+
+    // How long locations are kept in history, in milliseconds
+    var historyRetention: Int64 = 24 * 60 * 60 * 1000
+
+    // Matches the user keys of pushed location frames to members
+    lazy var frames: LSLocationFrameDecoderRef = LSLocationFrameDecoderCreate(self.ref)
+
+    deinit {
+        LSLocationFrameDecoderDestroy(frames)
+        LSTrajectoryStoreDestroy(history)
+        LSClusterIndexDestroy(clusters)
+        LSSpatialIndexDestroy(index)
+        LSMemberTableDestroy(ref)
+    }
+
+    var count: Int {
+        return Int(LSMemberTableCount(ref))
+    }
+
+    // Copies userID, location and modified time out of each KiiObject once,
+    // returns the row of every object in the same order
+    func load(objects: [AnyObject]) -> [Int] {
+
+        var rows = [Int]()
+
+        for obj in objects {
+
+            guard let object = obj as? KiiObject, userID = object.getObjectForKey("userID") as? String, location = object.getGeoPointForKey("location") else {
+                rows.append(-1)
+                continue
+            }
+
+            let row = Int(LSMemberTableUpsert(ref, userID, location.latitude, location.longitude, timestampOf(object)))
+
+            // The table keeps a newer location than an old object
+            let user = LSMemberTableUserIndices(ref)[row]
+            let latitude = LSMemberTableLatitudes(ref)[row]
+            let longitude = LSMemberTableLongitudes(ref)[row]
+
+            LSSpatialIndexMove(index, user, latitude, longitude)
+            LSClusterIndexMove(clusters, user, latitude, longitude)
+            LSTrajectoryStoreAppend(history, user, LSMemberTableTimestamps(ref)[row], latitude, longitude)
+
+            rows.append(row)
+        }
+
+        return rows
+    }
+
+    // Reads the results of a query page straight into the table, returns the
+    // row of every result loaded
+    func load(page: QueryPage) -> [Int] {
+
+        LSQueryPageLoad(page.ref, ref)
+
+        var count = 0
+        let loaded = LSQueryPageRows(page.ref, &count)
+
+        var rows = [Int]()
+
+        for i in 0 ..< count {
+
+            let row = Int(loaded[i])
+            let user = LSMemberTableUserIndices(ref)[row]
+            let latitude = LSMemberTableLatitudes(ref)[row]
+            let longitude = LSMemberTableLongitudes(ref)[row]
+
+            LSSpatialIndexMove(index, user, latitude, longitude)
+            LSClusterIndexMove(clusters, user, latitude, longitude)
+            LSTrajectoryStoreAppend(history, user, LSMemberTableTimestamps(ref)[row], latitude, longitude)
+
+            rows.append(row)
+        }
+
+        return rows
+    }
+
+    // Reads an object in the JSON form of the REST API, as ObjectReader passes
+    // it, returns its row or -1 when it has no location
+    func load(fields: [String: AnyObject]) -> Int {
+
+        guard let userID = fields["userID"] as? String, location = fields["location"] as? [String: AnyObject], latitude = location["lat"] as? Double, longitude = location["lon"] as? Double else {
+            return -1
+        }
+
+        let modified = (fields["_modified"] as? NSNumber)?.longLongValue ?? 0
+
+        let row = Int(LSMemberTableUpsert(ref, userID, latitude, longitude, modified))
+
+        // The table keeps a newer location than an old object
+        let user = LSMemberTableUserIndices(ref)[row]
+        let kept = coordinate(row)
+
+        LSSpatialIndexMove(index, user, kept.latitude, kept.longitude)
+        LSClusterIndexMove(clusters, user, kept.latitude, kept.longitude)
+        LSTrajectoryStoreAppend(history, user, LSMemberTableTimestamps(ref)[row], kept.latitude, kept.longitude)
+
+        return row
+    }
+
+    func timestampOf(object: KiiObject) -> Int64 {
+
+        if let modified = object.modified {
+            return Int64(modified.timeIntervalSince1970 * 1000)
+        }
+
+        return 0
+    }
+
+    func row(userID: String) -> Int {
+        return Int(LSMemberTableFindRow(ref, userID))
+    }
+
+    func userID(row: Int) -> String {
+        return String.fromCString(LSMemberTableUserID(ref, LSMemberTableUserIndices(ref)[row]))!
+    }
+
+    func coordinate(row: Int) -> CLLocationCoordinate2D {
+        return CLLocationCoordinate2DMake(LSMemberTableLatitudes(ref)[row], LSMemberTableLongitudes(ref)[row])
+    }
+
+    func setCoordinate(row: Int, coordinate: CLLocationCoordinate2D, timestamp: Int64) {
+        LSMemberTableSetLocation(ref, UInt32(row), coordinate.latitude, coordinate.longitude, timestamp)
+        LSSpatialIndexMove(index, LSMemberTableUserIndices(ref)[row], coordinate.latitude, coordinate.longitude)
+        LSClusterIndexMove(clusters, LSMemberTableUserIndices(ref)[row], coordinate.latitude, coordinate.longitude)
+        LSTrajectoryStoreAppend(history, LSMemberTableUserIndices(ref)[row], timestamp, coordinate.latitude, coordinate.longitude)
+    }
+
+    // Drops the member from the table, its indexes and its history; rows
+    // after it may move
+    func remove(row: Int) {
+        let user = LSMemberTableUserIndices(ref)[row]
+        LSSpatialIndexRemove(index, user)
+        LSClusterIndexRemove(clusters, user)
+        LSTrajectoryStoreRemove(history, user)
+        LSMemberTableRemoveRow(ref, UInt32(row))
+    }
+
+    // Drops the history older than historyRetention before now (milliseconds)
+    func trimHistory(now: Int64 = Int64(NSDate().timeIntervalSince1970 * 1000)) {
+        LSTrajectoryStoreTrim(history, now - historyRetention)
+    }
+
+    // Moves the members of a binary location frame that have a newer
+    // location in it, returns their rows
+    func apply(frame: NSData) -> [Int] {
+
+        var moved = [UInt32](count: max(count, 1), repeatedValue: 0)
+
+        let found = LSLocationFrameDecoderApply(frames, UnsafePointer<UInt8>(frame.bytes), frame.length, &moved, moved.count)
+
+        var rows = [Int]()
+
+        for i in 0 ..< min(found, moved.count) {
+
+            let row = Int(moved[i])
+            let user = LSMemberTableUserIndices(ref)[row]
+            let latitude = LSMemberTableLatitudes(ref)[row]
+            let longitude = LSMemberTableLongitudes(ref)[row]
+
+            LSSpatialIndexMove(index, user, latitude, longitude)
+            LSClusterIndexMove(clusters, user, latitude, longitude)
+            LSTrajectoryStoreAppend(history, user, LSMemberTableTimestamps(ref)[row], latitude, longitude)
+
+            rows.append(row)
+        }
+
+        return rows
+    }
+
+    // Locations of the member between from and to (milliseconds), oldest first
+    func history(row: Int, from: Int64, to: Int64) -> [(timestamp: Int64, coordinate: CLLocationCoordinate2D)] {
+
+        let user = LSMemberTableUserIndices(ref)[row]
+
+        let capacity = LSTrajectoryStoreQuery(history, user, from, to, nil, nil, nil, 0)
+
+        var timestamps = [Int64](count: capacity, repeatedValue: 0)
+        var latitudes = [Double](count: capacity, repeatedValue: 0)
+        var longitudes = [Double](count: capacity, repeatedValue: 0)
+
+        let found = min(LSTrajectoryStoreQuery(history, user, from, to, &timestamps, &latitudes, &longitudes, capacity), capacity)
+
+        var fixes = [(timestamp: Int64, coordinate: CLLocationCoordinate2D)]()
+
+        for i in 0 ..< found {
+            fixes.append((timestamp: timestamps[i], coordinate: CLLocationCoordinate2DMake(latitudes[i], longitudes[i])))
+        }
+
+        return fixes
+    }
+
+    // Rows inside the box, same semantics as KiiClause geoBox
+    func rows(northEast: KiiGeoPoint, southWest: KiiGeoPoint) -> [Int] {
+
+        var ids = [UInt32](count: count, repeatedValue: 0)
+
+        let found = LSSpatialIndexQueryBox(index, northEast.latitude, northEast.longitude, southWest.latitude, southWest.longitude, &ids, ids.count)
+
+        return ids[0 ..< min(found, ids.count)].map { Int(LSMemberTableRowForUserIndex(ref, $0)) }
+    }
+
+    // Rows within radius meters of center, same semantics as KiiClause geoDistance
+    func rows(center: KiiGeoPoint, radius: Double) -> [(row: Int, distance: Double)] {
+
+        var ids = [UInt32](count: count, repeatedValue: 0)
+        var distances = [Double](count: count, repeatedValue: 0)
+
+        let found = LSSpatialIndexQueryDistance(index, center.latitude, center.longitude, radius, &ids, &distances, ids.count)
+
+        var rows = [(row: Int, distance: Double)]()
+
+        for i in 0 ..< min(found, ids.count) {
+            rows.append((row: Int(LSMemberTableRowForUserIndex(ref, ids[i])), distance: distances[i]))
+        }
+
+        return rows
+    }
+
+    // The limit rows closest to center, nearest first
+    func closest(center: KiiGeoPoint, limit: Int) -> [(row: Int, distance: Double)] {
+
+        let k = max(0, min(limit, count))
+
+        var ids = [UInt32](count: k, repeatedValue: 0)
+        var distances = [Double](count: k, repeatedValue: 0)
+
+        let found = LSSpatialIndexQueryNearest(index, center.latitude, center.longitude, k, &ids, &distances)
+
+        var rows = [(row: Int, distance: Double)]()
+
+        for i in 0 ..< found {
+            rows.append((row: Int(LSMemberTableRowForUserIndex(ref, ids[i])), distance: distances[i]))
+        }
+
+        return rows
+    }
+
+    // Distance in meters from center to every row, in row order
+    func distances(center: KiiGeoPoint, mode: LSGeoDistanceMode = LSGeoDistanceHaversine) -> [Double] {
+
+        var distances = [Double](count: count, repeatedValue: 0)
+
+        LSGeoDistanceBatch(center.latitude, center.longitude, LSMemberTableLatitudes(ref), LSMemberTableLongitudes(ref), count, &distances, mode)
+
+        return distances
+    }
+}
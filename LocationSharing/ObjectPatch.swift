@@ -0,0 +1,103 @@
+//
+//  ObjectPatch.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-16.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// Sets fields on a KiiObject while remembering which ones changed, so a save
+// can send just those with a partial save instead of saveAllFields.
+class ObjectPatch: NSObject {
+
+    let object: KiiObject
+
+    let ref = LSObjectPatchCreate()
+
+    // The location fields the object already has are taken as saved
+    init(object: KiiObject) {
+
+        self.object = object
+
+        super.init()
+
+        if let location = object.getGeoPointForKey("location") {
+            LSObjectPatchSetGeoPoint(ref, "location", location.latitude, location.longitude)
+        }
+
+        if let geohash = object.getObjectForKey(GeoCell.fieldName) as? String {
+            LSObjectPatchSetString(ref, GeoCell.fieldName, geohash)
+        }
+
+        LSObjectPatchMarkClean(ref)
+    }
+
+    deinit {
+        LSObjectPatchDestroy(ref)
+    }
+
+    var isDirty: Bool {
+        return LSObjectPatchDirtyMask(ref) != 0
+    }
+
+    func setString(value: String, forKey key: String) {
+        object.setObject(value, forKey: key)
+        LSObjectPatchSetString(ref, key, value)
+    }
+
+    func setNumber(value: Double, forKey key: String) {
+        object.setObject(NSNumber(double: value), forKey: key)
+        LSObjectPatchSetNumber(ref, key, value)
+    }
+
+    func setGeoPoint(point: KiiGeoPoint, forKey key: String) {
+        object.setGeoPoint(point, forKey: key)
+        LSObjectPatchSetGeoPoint(ref, key, point.latitude, point.longitude)
+    }
+
+    // The dirty fields as a JSON object, now counted as sent. Pass sent back
+    // to restore() if the request fails.
+    func encode() -> (body: NSData, sent: UInt64) {
+
+        var sent: UInt64 = 0
+
+        var buffer = [CChar](count: 256, repeatedValue: 0)
+
+        var length = LSObjectPatchEncode(ref, &buffer, buffer.count, &sent)
+
+        if length >= buffer.count {
+            buffer = [CChar](count: length + 1, repeatedValue: 0)
+            length = LSObjectPatchEncode(ref, &buffer, buffer.count, &sent)
+        }
+
+        return (body: NSData(bytes: buffer, length: length), sent: sent)
+    }
+
+    func restore(sent: UInt64) {
+        LSObjectPatchRestore(ref, sent)
+    }
+
+    // Partial save of the changed fields, nothing is sent when none changed.
+    // The save is forced: several devices write every member's object, so a
+    // save conditional on the ETag would keep failing on a stale one.
+    func save(block: (error: NSError?) -> Void) {
+
+        if !isDirty {
+            block(error: nil)
+            return
+        }
+
+        let sent = LSObjectPatchDirtyMask(ref)
+
+        LSObjectPatchMarkClean(ref)
+
+        object.save(true, withBlock: { (object : KiiObject?, error : NSError?) -> Void in
+            if error != nil {
+                self.restore(sent)
+            }
+            block(error: error)
+        })
+    }
+}
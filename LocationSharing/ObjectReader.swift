@@ -0,0 +1,53 @@
+//
+//  ObjectReader.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// Reads single objects as a GET on their URI through Transport, in place of
+// KiiObject refreshSynchronous. With a cache on the transport an object read
+// before goes out with If-None-Match, and while it has not changed the
+// server answers with a header only 304 that the cache turns back into the
+// body it holds.
+class ObjectReader: NSObject {
+
+    typealias ReadBlock = (fields: [String: AnyObject]?, error: NSError?) -> Void
+
+    static let errorDomain = "LocationSharing.ObjectReader"
+
+    let transport: Transport
+
+    init(transport: Transport = Transport.shared) {
+        self.transport = transport
+        super.init()
+    }
+
+    // The fields as the REST API returns them, _modified included; the block
+    // is called on the main queue
+    func read(object: KiiObject, priority: RequestScheduler.Priority = .Interactive, block: ReadBlock) {
+
+        guard let path = BatchWriter.pathOf(object), request = transport.request(path) else {
+            block(fields: nil, error: NSError(domain: ObjectReader.errorDomain, code: 0, userInfo: [NSLocalizedDescriptionKey: "The object is not saved or Transport has no app"]))
+            return
+        }
+
+        transport.send(request, priority: priority) { (data : NSData?, response : NSHTTPURLResponse?, error : NSError?) -> Void in
+
+            var fields: [String: AnyObject]?
+
+            if let data = data, response = response where response.statusCode == 200 {
+                fields = (try? NSJSONSerialization.JSONObjectWithData(data, options: [])) as? [String: AnyObject]
+            }
+
+            let failure = fields != nil ? nil : error ?? NSError(domain: ObjectReader.errorDomain, code: response?.statusCode ?? 0, userInfo: nil)
+
+            dispatch_async(dispatch_get_main_queue()) {
+                block(fields: fields, error: failure)
+            }
+        }
+    }
+}
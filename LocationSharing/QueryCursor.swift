@@ -0,0 +1,135 @@
+//
+//  QueryCursor.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-11.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// Walks every page of a bucket query, following nextQuery. Pages are fetched
+// on a background queue up to window pages ahead of the caller, so the next
+// round trip overlaps with the work done on the current page; the fetcher
+// stops when the window is full until the caller takes a page.
+class QueryCursor: NSObject {
+
+    // Shared with the fetcher, so an abandoned cursor can still stop it
+    private class State {
+        let lock = NSLock()
+        let slots: dispatch_semaphore_t
+        let available = dispatch_semaphore_create(0)
+        var pages = [[AnyObject]]()
+        var finished = false
+        var cancelled = false
+        var error: NSError?
+
+        // Made empty and filled up: libdispatch aborts when a semaphore is
+        // freed below the value it was created with, which is where a cursor
+        // cancelled with pages in the window leaves it
+        init(window: Int) {
+            slots = dispatch_semaphore_create(0)
+            for _ in 0 ..< window {
+                dispatch_semaphore_signal(slots)
+            }
+        }
+    }
+
+    private let state: State
+
+    private static let fetchQueue = dispatch_queue_create("LocationSharing.QueryCursor", DISPATCH_QUEUE_CONCURRENT)
+
+    // The error that ended the query early, once next() has returned nil
+    var error: NSError? {
+        state.lock.lock()
+        defer { state.lock.unlock() }
+        return state.error
+    }
+
+    init(bucket: KiiBucket, query: KiiQuery?, window: Int = 2) {
+
+        state = State(window: max(window, 1))
+
+        super.init()
+
+        let state = self.state
+
+        dispatch_async(QueryCursor.fetchQueue) {
+
+            var query = query
+
+            while query != nil {
+
+                dispatch_semaphore_wait(state.slots, DISPATCH_TIME_FOREVER)
+
+                state.lock.lock()
+                let cancelled = state.cancelled
+                state.lock.unlock()
+
+                if cancelled {
+                    break
+                }
+
+                var nextQuery: KiiQuery? = nil
+
+                do {
+                    let results = try bucket.executeQuerySynchronous(query, nextQuery: &nextQuery)
+
+                    state.lock.lock()
+                    state.pages.append(results)
+                    state.lock.unlock()
+
+                    dispatch_semaphore_signal(state.available)
+
+                } catch let error as NSError {
+
+                    state.lock.lock()
+                    state.error = error
+                    state.lock.unlock()
+
+                    nextQuery = nil
+                }
+
+                query = nextQuery
+            }
+
+            state.lock.lock()
+            state.finished = true
+            state.lock.unlock()
+
+            dispatch_semaphore_signal(state.available)
+        }
+    }
+
+    deinit {
+        cancel()
+    }
+
+    // Blocks until the next page is fetched, nil once there are no more
+    func next() -> [AnyObject]? {
+
+        dispatch_semaphore_wait(state.available, DISPATCH_TIME_FOREVER)
+
+        state.lock.lock()
+        defer { state.lock.unlock() }
+
+        if !state.pages.isEmpty {
+            dispatch_semaphore_signal(state.slots)
+            return state.pages.removeFirst()
+        }
+
+        // Finished: leave the signal for any later call
+        dispatch_semaphore_signal(state.available)
+        return nil
+    }
+
+    // Stops fetching after the page in flight
+    func cancel() {
+
+        state.lock.lock()
+        state.cancelled = true
+        state.lock.unlock()
+
+        dispatch_semaphore_signal(state.slots)
+    }
+}
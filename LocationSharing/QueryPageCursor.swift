@@ -0,0 +1,185 @@
+//
+//  QueryPageCursor.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-02.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// A page of a bucket query response, indexed but not loaded yet
+class QueryPage: NSObject {
+
+    let ref = LSQueryPageCreate()
+
+    deinit {
+        LSQueryPageDestroy(ref)
+    }
+
+    var nextPaginationKey: String? {
+        let key = LSQueryPageNextPaginationKey(ref)
+        return key == nil ? nil : String.fromCString(key)
+    }
+}
+
+// Walks every page of a bucket query like QueryCursor, but posts the query
+// through Transport and hands out the raw pages instead of KiiObjects. The
+// structural index of a page is built on the fetch queue, so the caller only
+// pays for reading the fields the member table keeps.
+class QueryPageCursor: NSObject {
+
+    private class State {
+        let lock = NSLock()
+        let slots: dispatch_semaphore_t
+        let available = dispatch_semaphore_create(0)
+        var pages = [QueryPage]()
+        var finished = false
+        var cancelled = false
+        var error: NSError?
+
+        // Made empty and filled up: libdispatch aborts when a semaphore is
+        // freed below the value it was created with, which is where a cursor
+        // cancelled with pages in the window leaves it
+        init(window: Int) {
+            slots = dispatch_semaphore_create(0)
+            for _ in 0 ..< window {
+                dispatch_semaphore_signal(slots)
+            }
+        }
+    }
+
+    private let state: State
+
+    private static let fetchQueue = dispatch_queue_create("LocationSharing.QueryPageCursor", DISPATCH_QUEUE_CONCURRENT)
+
+    static let errorDomain = "LocationSharing.QueryPageCursor"
+
+    // The error that ended the query early, once next() has returned nil
+    var error: NSError? {
+        state.lock.lock()
+        defer { state.lock.unlock() }
+        return state.error
+    }
+
+    // path is the bucket, e.g. "groups/{groupID}/buckets/{name}", clause is
+    // in the JSON form of the query REST API; results come ascending by
+    // orderBy when it is given. Every page is sent with the priority and
+    // deadline, see Transport.
+    init(path: String, clause: [String: AnyObject] = ["type": "all"], orderBy: String? = nil, limit: Int = 100, transport: Transport = Transport.shared, priority: RequestScheduler.Priority = .Normal, deadline: NSTimeInterval? = nil, window: Int = 2) {
+
+        state = State(window: max(window, 1))
+
+        super.init()
+
+        let state = self.state
+
+        dispatch_async(QueryPageCursor.fetchQueue) {
+
+            var paginationKey: String? = nil
+
+            repeat {
+
+                dispatch_semaphore_wait(state.slots, DISPATCH_TIME_FOREVER)
+
+                state.lock.lock()
+                let cancelled = state.cancelled
+                state.lock.unlock()
+
+                if cancelled {
+                    break
+                }
+
+                var bucketQuery: [String: AnyObject] = ["clause": clause]
+
+                if let orderBy = orderBy {
+                    bucketQuery["orderBy"] = orderBy
+                    bucketQuery["descending"] = false
+                }
+
+                var query: [String: AnyObject] = ["bucketQuery": bucketQuery, "bestEffortLimit": limit]
+
+                if let key = paginationKey {
+                    query["paginationKey"] = key
+                }
+
+                let page = QueryPage()
+                var error: NSError? = nil
+
+                let body = try? NSJSONSerialization.dataWithJSONObject(query, options: [])
+
+                if let request = transport.request(path + "/query", method: "POST", body: body, contentType: "application/vnd.kii.QueryRequest+json") {
+
+                    let result = transport.sendSynchronous(request, priority: priority, deadline: deadline)
+
+                    if let data = result.data, response = result.response where response.statusCode == 200 {
+                        LSQueryPageFeed(page.ref, data.bytes, data.length)
+                        if !LSQueryPageFinish(page.ref) {
+                            error = NSError(domain: QueryPageCursor.errorDomain, code: response.statusCode, userInfo: nil)
+                        }
+                    } else {
+                        error = result.error ?? NSError(domain: QueryPageCursor.errorDomain, code: result.response?.statusCode ?? 0, userInfo: nil)
+                    }
+
+                } else {
+                    error = NSError(domain: QueryPageCursor.errorDomain, code: 0, userInfo: [NSLocalizedDescriptionKey: "Transport has no app"])
+                }
+
+                state.lock.lock()
+                if let error = error {
+                    state.error = error
+                } else {
+                    state.pages.append(page)
+                }
+                state.lock.unlock()
+
+                if error != nil {
+                    break
+                }
+
+                dispatch_semaphore_signal(state.available)
+
+                paginationKey = page.nextPaginationKey
+
+            } while paginationKey != nil
+
+            state.lock.lock()
+            state.finished = true
+            state.lock.unlock()
+
+            dispatch_semaphore_signal(state.available)
+        }
+    }
+
+    deinit {
+        cancel()
+    }
+
+    // Blocks until the next page is fetched, nil once there are no more
+    func next() -> QueryPage? {
+
+        dispatch_semaphore_wait(state.available, DISPATCH_TIME_FOREVER)
+
+        state.lock.lock()
+        defer { state.lock.unlock() }
+
+        if !state.pages.isEmpty {
+            dispatch_semaphore_signal(state.slots)
+            return state.pages.removeFirst()
+        }
+
+        // Finished: leave the signal for any later call
+        dispatch_semaphore_signal(state.available)
+        return nil
+    }
+
+    // Stops fetching after the page in flight
+    func cancel() {
+
+        state.lock.lock()
+        state.cancelled = true
+        state.lock.unlock()
+
+        dispatch_semaphore_signal(state.slots)
+    }
+}
@@ -0,0 +1,236 @@
+//
+//  RequestScheduler.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-01.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import ObjectiveC
+import UIKit
+
+// Runs SDK requests in priority order, see LSRequestScheduler.h.
+//
+// Every non-blocking SDK call hands its work to KiiUtilities
+// performRequestMethodAsync:. Once installed, that block is queued here
+// instead, in the priority of the code that made the call: calls made
+// inside with(_:deadline:body:) get its priority, any other call is normal.
+//
+// A full class queue pushes back: the submitter waits until a request of
+// that class has started, so nothing is dropped and nothing runs past the
+// limit. Code that may queue many requests at once submits them off the
+// main queue. A request submitted from inside a running one does not wait,
+// as that could hold every running slot while the queues stay full; it is
+// kept aside and queued as soon as its class has room.
+//
+// Requests sent through Transport are scheduled there, per host.
+class RequestScheduler: NSObject {
+
+    enum Priority: Int {
+        case Interactive
+        case Normal
+        case Bulk
+
+        var value: LSRequestPriority {
+            return LSRequestPriority(UInt32(rawValue))
+        }
+
+        // Queue the request runs on once it is its turn
+        var queue: dispatch_queue_t {
+            switch self {
+            case .Interactive:
+                return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0)
+            case .Normal:
+                return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)
+            case .Bulk:
+                return dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0)
+            }
+        }
+    }
+
+    static let shared = RequestScheduler()
+
+    let scheduler: LSRequestSchedulerRef
+
+    let queueLimit: Int
+
+    // Guards the scheduler and requests, signaled whenever a request starts
+    private let condition = NSCondition()
+
+    private var requests = [UInt64: (priority: Priority, block: () -> Void)]()
+
+    // Submitted from running requests while their queue was full, in order
+    private var overflow = [(priority: Priority, due: Int64, block: () -> Void)]()
+
+    private static let runningKey = "LocationSharing.RequestScheduler.running"
+    private static let priorityKey = "LocationSharing.RequestScheduler.priority"
+    private static let deadlineKey = "LocationSharing.RequestScheduler.deadline"
+
+    private static var installed = false
+
+    init(maxRunning: Int = 4, queueLimit: Int = 64) {
+
+        scheduler = LSRequestSchedulerCreate(maxRunning)
+
+        self.queueLimit = max(queueLimit, 1)
+
+        for priority in [Priority.Interactive, Priority.Normal, Priority.Bulk] {
+            LSRequestSchedulerSetQueueLimit(scheduler, priority.value, self.queueLimit)
+        }
+
+        super.init()
+    }
+
+    deinit {
+        LSRequestSchedulerDestroy(scheduler)
+    }
+
+    // Runs the block once its turn comes, deadline is in seconds from now.
+    // Waits while the queue of the priority is full.
+    func submit(priority: Priority, deadline: NSTimeInterval? = nil, block: () -> Void) {
+
+        let due = deadline.map { Int64((NSDate().timeIntervalSince1970 + $0) * 1000) } ?? Int64.max
+
+        let nested = NSThread.currentThread().threadDictionary[RequestScheduler.runningKey] === self
+
+        condition.lock()
+
+        if nested && isFull(priority) {
+            overflow.append((priority: priority, due: due, block: block))
+            condition.unlock()
+            return
+        }
+
+        // SDK blocks call back their caller, so none may be displaced
+        while isFull(priority) {
+            condition.wait()
+        }
+
+        enqueue(priority, due: due, block: block)
+
+        condition.unlock()
+
+        pump()
+    }
+
+    // SDK calls made in body are scheduled with the priority
+    func with(priority: Priority, deadline: NSTimeInterval? = nil, @noescape body: () -> Void) {
+
+        let context = NSThread.currentThread().threadDictionary
+
+        let previousPriority = context[RequestScheduler.priorityKey]
+        let previousDeadline = context[RequestScheduler.deadlineKey]
+
+        context[RequestScheduler.priorityKey] = priority.rawValue
+        context[RequestScheduler.deadlineKey] = deadline
+
+        body()
+
+        context[RequestScheduler.priorityKey] = previousPriority
+        context[RequestScheduler.deadlineKey] = previousDeadline
+    }
+
+    // Set aside requests included
+    func pending(priority: Priority) -> Int {
+        condition.lock()
+        defer { condition.unlock() }
+        return LSRequestSchedulerPending(scheduler, priority.value) + overflow.filter({ $0.priority == priority }).count
+    }
+
+    // Called with the condition locked
+    private func isFull(priority: Priority) -> Bool {
+        return LSRequestSchedulerPending(scheduler, priority.value) >= queueLimit
+    }
+
+    // Called with the condition locked
+    private func enqueue(priority: Priority, due: Int64, block: () -> Void) {
+
+        var displaced: UInt64 = 0
+
+        let id = LSRequestSchedulerSubmit(scheduler, priority.value, due, &displaced)
+        requests[id] = (priority: priority, block: block)
+
+        assert(displaced == 0, "The queue had room")
+    }
+
+    // Called with the condition locked. Set aside requests go ahead of
+    // submitters still waiting, they were submitted first.
+    private func admitOverflow() {
+
+        var kept = [(priority: Priority, due: Int64, block: () -> Void)]()
+
+        for request in overflow {
+            if isFull(request.priority) {
+                kept.append(request)
+            } else {
+                enqueue(request.priority, due: request.due, block: request.block)
+            }
+        }
+
+        overflow = kept
+    }
+
+    // Starts every request allowed to run
+    private func pump() {
+
+        while true {
+
+            condition.lock()
+            let id = LSRequestSchedulerNext(scheduler)
+            let request = id != 0 ? requests.removeValueForKey(id) : nil
+            if request != nil {
+                // Its queue has room again
+                admitOverflow()
+                condition.broadcast()
+            }
+            condition.unlock()
+
+            guard let next = request else {
+                return
+            }
+
+            dispatch_async(next.priority.queue) {
+
+                let context = NSThread.currentThread().threadDictionary
+
+                context[RequestScheduler.runningKey] = self
+                next.block()
+                context.removeObjectForKey(RequestScheduler.runningKey)
+
+                self.condition.lock()
+                LSRequestSchedulerFinish(self.scheduler, id)
+                self.condition.unlock()
+
+                self.pump()
+            }
+        }
+    }
+
+    // MARK: - SDK
+
+    // Makes the shared scheduler the dispatch point of the SDK, call once at launch
+    class func install() {
+
+        if installed {
+            return
+        }
+
+        installed = true
+
+        let original = class_getClassMethod(KiiUtilities.self, #selector(KiiUtilities.performRequestMethodAsync(_:)))
+        let replacement = class_getClassMethod(RequestScheduler.self, #selector(RequestScheduler.performRequestMethodAsync(_:)))
+
+        method_exchangeImplementations(original, replacement)
+    }
+
+    // Runs in place of the SDK method, so self is not RequestScheduler here
+    dynamic class func performRequestMethodAsync(block: () -> Void) {
+
+        let context = NSThread.currentThread().threadDictionary
+
+        let priority = (context[RequestScheduler.priorityKey] as? Int).flatMap { Priority(rawValue: $0) } ?? .Normal
+        let deadline = context[RequestScheduler.deadlineKey] as? NSTimeInterval
+
+        RequestScheduler.shared.submit(priority, deadline: deadline, block: block)
+    }
+}
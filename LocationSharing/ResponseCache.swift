@@ -0,0 +1,103 @@
+//
+//  ResponseCache.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-06.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// Response bodies of GET requests with their ETags for Transport, keyed by
+// method, URL, caller and request body, so the same object read by another
+// user never shares an entry.
+class ResponseCache: NSObject {
+
+    private let ref: LSResponseCacheRef
+    private let lock = NSLock()
+
+    init(maxBytes: Int = 4 * 1024 * 1024) {
+        ref = LSResponseCacheCreate(maxBytes)
+        super.init()
+    }
+
+    deinit {
+        LSResponseCacheDestroy(ref)
+    }
+
+    var count: Int {
+        lock.lock()
+        defer { lock.unlock() }
+        return LSResponseCacheCount(ref)
+    }
+
+    class func key(request: NSURLRequest) -> NSData {
+
+        let key = NSMutableData()
+
+        let head = (request.HTTPMethod ?? "GET") + " " + (request.URL?.absoluteString ?? "") + "\n" + (request.valueForHTTPHeaderField("Authorization") ?? "") + "\n"
+
+        key.appendData(head.dataUsingEncoding(NSUTF8StringEncoding)!)
+
+        if let body = request.HTTPBody {
+            key.appendData(body)
+        }
+
+        return key
+    }
+
+    func etag(key: NSData) -> String? {
+
+        lock.lock()
+        defer { lock.unlock() }
+
+        let etag = LSResponseCacheETag(ref, key.bytes, key.length)
+
+        return etag == nil ? nil : String.fromCString(etag)
+    }
+
+    func body(key: NSData) -> NSData? {
+
+        lock.lock()
+        defer { lock.unlock() }
+
+        var length = 0
+        let bytes = LSResponseCacheBody(ref, key.bytes, key.length, &length)
+
+        return bytes == nil ? nil : NSData(bytes: bytes, length: length)
+    }
+
+    // Keeps a 200 that came with an ETag, forgets the key for any other
+    // response so a stale body is never served
+    func store(key: NSData, response: NSHTTPURLResponse, data: NSData?) {
+
+        lock.lock()
+        defer { lock.unlock() }
+
+        guard let data = data, etag = ResponseCache.etag(response) where response.statusCode == 200 else {
+            LSResponseCacheRemove(ref, key.bytes, key.length)
+            return
+        }
+
+        LSResponseCacheStore(ref, key.bytes, key.length, etag, data.bytes, data.length)
+    }
+
+    func removeAll() {
+        lock.lock()
+        LSResponseCacheClear(ref)
+        lock.unlock()
+    }
+
+    // Header names are not case sensitive, and the capitalization of ETag
+    // varies between servers
+    class func etag(response: NSHTTPURLResponse) -> String? {
+
+        for (name, value) in response.allHeaderFields {
+            if let name = name as? String where name.lowercaseString == "etag" {
+                return value as? String
+            }
+        }
+
+        return nil
+    }
+}
@@ -0,0 +1,94 @@
+//
+//  ServerClock.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// The Kii Cloud clock as seen from this device, so every time that goes
+// into the member table, a pushed frame or a prediction is in the same base
+// as the _modified times of the objects. Device clocks drift and can be set
+// by hand; comparing them with server times would let an old push win over
+// a newer save, or give the motion filters a wrong interval.
+//
+// The offset comes from the Date header of the responses Transport sees.
+// The header has whole seconds, so the sample with the shortest round trip
+// is kept, and a fresh one is taken after maxSampleAge in case the device
+// clock was changed meanwhile.
+class ServerClock: NSObject {
+
+    static let shared = ServerClock()
+
+    var maxSampleAge: NSTimeInterval = 3600
+
+    private let lock = NSLock()
+    private var offset: NSTimeInterval = 0
+    private var roundTrip = Double.infinity
+    private var sampled: NSDate?
+
+    private let formatter: NSDateFormatter = {
+        let formatter = NSDateFormatter()
+        formatter.locale = NSLocale(localeIdentifier: "en_US_POSIX")
+        formatter.timeZone = NSTimeZone(forSecondsFromGMT: 0)
+        formatter.dateFormat = "EEE, dd MMM yyyy HH:mm:ss zzz"
+        return formatter
+    }()
+
+    // Seconds the server is ahead of the device, 0 before any response
+    var serverOffset: NSTimeInterval {
+        lock.lock()
+        defer { lock.unlock() }
+        return offset
+    }
+
+    func update(response: NSHTTPURLResponse, sent: NSDate, received: NSDate) {
+
+        var header: String?
+
+        for (name, value) in response.allHeaderFields {
+            if let name = name as? String where name.lowercaseString == "date" {
+                header = value as? String
+            }
+        }
+
+        guard let date = header else {
+            return
+        }
+
+        lock.lock()
+        defer { lock.unlock() }
+
+        guard let server = formatter.dateFromString(date) else {
+            return
+        }
+
+        let elapsed = received.timeIntervalSinceDate(sent)
+
+        if let sampled = sampled where elapsed > roundTrip && -sampled.timeIntervalSinceNow < maxSampleAge {
+            return
+        }
+
+        // The server stamped the response somewhere in that second, taken
+        // as its middle, halfway through the round trip
+        offset = server.timeIntervalSince1970 + 0.5 - (sent.timeIntervalSince1970 + elapsed / 2)
+        roundTrip = elapsed
+        sampled = received
+    }
+
+    func now() -> NSDate {
+        return serverDate(NSDate())
+    }
+
+    // A device time, such as CLLocation.timestamp, in server time
+    func serverDate(date: NSDate) -> NSDate {
+        return date.dateByAddingTimeInterval(serverOffset)
+    }
+
+    // Milliseconds since 1970 in server time, like _modified
+    class func milliseconds(date: NSDate) -> Int64 {
+        return Int64(date.timeIntervalSince1970 * 1000)
+    }
+}
@@ -51,6 +51,7 @@ class TestFunctions: NSObject {
         if let user = KiiUser.currentUser(){
             let point = KiiGeoPoint(latitude: 44.699158, andLongitude: -63.665778)
             object.setGeoPoint(point, forKey:"location")
+            object.setObject(GeoCell.geohash(point.latitude, longitude: point.longitude), forKey: GeoCell.fieldName)
             object.setObject(user.userID, forKey: "userID")
             
             object.saveWithBlock { (object : KiiObject?, error : NSError?) -> Void in
@@ -0,0 +1,348 @@
+//
+//  TileLoader.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-22.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import MapKit
+import UIKit
+
+// Loads member locations for what is on screen rather than the whole bucket.
+//
+// The visible region is cut into quad key tiles at the map zoom level, and
+// each tile is a geoBox query kept current by a DeltaSync of its own, so
+// refreshing a tile only fetches the objects modified in it since its last
+// sync. Tiles on screen and one ring around them are fetched, loaded tiles
+// are reused until they go stale, and tiles more than evictDistance tiles
+// away from the screen are forgotten so the cache follows the user across
+// the map. Members outside every tile kept are dropped from the member table
+// with them, except the user logged in.
+//
+// Tiles of another zoom level are kept, with their members, until every
+// tile on screen at the new level has loaded, so pins stay put while the
+// map is pinched instead of going and coming back.
+//
+// Tiles on screen are fetched as interactive requests, due from the centre
+// of the screen outwards, so the middle of the map fills in first and ahead
+// of anything queued earlier further out; the ring is prefetched at normal
+// priority.
+//
+// Meant to be used from the main queue, where query blocks are called.
+class TileLoader: NSObject {
+
+    private class Tile {
+        let key: UInt64
+        let level: UInt32
+        let sync: DeltaSync
+        var synced: NSDate?
+
+        init(key: UInt64, level: UInt32, sync: DeltaSync) {
+            self.key = key
+            self.level = level
+            self.sync = sync
+        }
+    }
+
+    // The bucket, e.g. "groups/{groupID}/buckets/{name}"
+    let path: String
+
+    let members: MemberTable
+
+    // Tiles older than this are fetched again when visible
+    var maxAge: NSTimeInterval = 30
+
+    var evictDistance = 3
+
+    // Above this many visible tiles the level goes down by one
+    var maxVisibleTiles = 48
+
+    // Seconds between the deadlines of one ring of tiles and the next
+    var deadlineStep: NSTimeInterval = 0.1
+
+    // Called after members have been loaded into or dropped from the member table
+    var onChange: (() -> Void)?
+
+    private var tiles = [String: Tile]()
+
+    // What update() last found on screen, for refresh()
+    private var visible: (range: (x: Int, y: Int, width: Int, height: Int), level: UInt32)?
+
+    init(path: String, members: MemberTable) {
+        self.path = path
+        self.members = members
+        super.init()
+    }
+
+    var cachedCount: Int {
+        return tiles.count
+    }
+
+    func update(region: MKCoordinateRegion, zoom: UInt32) {
+
+        var level = min(max(zoom, 1), 18)
+
+        var range = TileLoader.tileRange(region, level: level)
+
+        while level > 1 && range.width * range.height > maxVisibleTiles {
+            level -= 1
+            range = TileLoader.tileRange(region, level: level)
+        }
+
+        visible = (range: range, level: level)
+
+        if evict(range, level: level) && evictMembers() {
+            onChange?()
+        }
+
+        // Visible tiles first, then the ring around them
+        for margin in 0 ... 1 {
+            for dx in -margin ..< range.width + margin {
+                for dy in -margin ..< range.height + margin {
+                    let onRing = dx < 0 || dy < 0 || dx >= range.width || dy >= range.height
+                    if margin == 0 {
+                        load(range.x + dx, y: range.y + dy, level: level, maxAge: maxAge, priority: .Interactive, deadline: deadline(dx, dy: dy, range: range))
+                    } else if onRing {
+                        load(range.x + dx, y: range.y + dy, level: level, maxAge: maxAge, priority: .Normal, deadline: nil)
+                    }
+                }
+            }
+        }
+    }
+
+    // Fetches what changed in the tiles on screen since their last sync
+    func refresh() {
+
+        guard let visible = visible else {
+            return
+        }
+
+        for dx in 0 ..< visible.range.width {
+            for dy in 0 ..< visible.range.height {
+                load(visible.range.x + dx, y: visible.range.y + dy, level: visible.level, maxAge: 0, priority: .Interactive, deadline: deadline(dx, dy: dy, range: visible.range))
+            }
+        }
+    }
+
+    // First tile column and row in view and how many of each
+    class func tileRange(region: MKCoordinateRegion, level: UInt32) -> (x: Int, y: Int, width: Int, height: Int) {
+
+        let tiles = Double(1 << level)
+
+        let north = min(region.center.latitude + region.span.latitudeDelta / 2, 85.05112878)
+        let south = max(region.center.latitude - region.span.latitudeDelta / 2, -85.05112878)
+        let west = region.center.longitude - region.span.longitudeDelta / 2
+        let east = region.center.longitude + region.span.longitudeDelta / 2
+
+        func row(latitude: Double) -> Int {
+            let sine = sin(latitude * M_PI / 180)
+            let y = 0.5 - log((1 + sine) / (1 - sine)) / (4 * M_PI)
+            return Int(min(max(floor(y * tiles), 0), tiles - 1))
+        }
+
+        // Columns are not clamped, load() wraps them around the 180th meridian
+        let x = Int(floor((west + 180) / 360 * tiles))
+        let width = min(Int(floor((east + 180) / 360 * tiles)) - x + 1, Int(tiles))
+
+        let y = row(north)
+
+        return (x: x, y: y, width: width, height: row(south) - y + 1)
+    }
+
+    // Later the further the tile at the offset is from the centre of the range
+    private func deadline(dx: Int, dy: Int, range: (x: Int, y: Int, width: Int, height: Int)) -> NSTimeInterval {
+
+        let rings = max(abs(Double(dx) - Double(range.width - 1) / 2), abs(Double(dy) - Double(range.height - 1) / 2))
+
+        return floor(rings) * deadlineStep
+    }
+
+    private func load(x: Int, y: Int, level: UInt32, maxAge: NSTimeInterval, priority: RequestScheduler.Priority, deadline: NSTimeInterval?) {
+
+        guard let found = tileKey(x, y: y, level: level) else {
+            return
+        }
+
+        let name = found.name
+
+        let tile = tiles[name] ?? makeTile(found.key, level: level)
+        tiles[name] = tile
+
+        if tile.sync.syncing {
+            return
+        }
+
+        if let synced = tile.synced where -synced.timeIntervalSinceNow < maxAge {
+            return
+        }
+
+        tile.sync.sync(priority, deadline: deadline) { (rows : [Int], error : NSError?) -> Void in
+
+            if error != nil {
+                // Error handling, the tile is tried again on the next update
+                return
+            }
+
+            tile.synced = NSDate()
+
+            // Evicted meanwhile: its members go again unless another tile
+            // holds them. The last tile on screen to load also lets the
+            // tiles of the level before go.
+            let evicted = self.tiles[name] !== tile
+
+            if let visible = self.visible where self.evict(visible.range, level: visible.level) || evicted {
+                self.evictMembers()
+            }
+
+            self.onChange?()
+        }
+    }
+
+    // The tile at the column and row, wrapped around the 180th meridian,
+    // with its name; nil off the top or bottom of the map
+    private func tileKey(x: Int, y: Int, level: UInt32) -> (key: UInt64, name: String)? {
+
+        let tilesPerSide = 1 << Int(level)
+
+        if y < 0 || y >= tilesPerSide {
+            return nil
+        }
+
+        let column = ((x % tilesPerSide) + tilesPerSide) % tilesPerSide
+
+        let key = LSQuadKeyFromTile(UInt32(column), UInt32(y), level)
+
+        var buffer = [CChar](count: Int(level) + 1, repeatedValue: 0)
+        LSQuadKeyToString(key, level, &buffer)
+
+        return (key: key, name: String.fromCString(buffer)!)
+    }
+
+    // Whether every tile on screen has been synced at least once
+    private func visibleLoaded() -> Bool {
+
+        guard let visible = visible else {
+            return false
+        }
+
+        for dx in 0 ..< visible.range.width {
+            for dy in 0 ..< visible.range.height {
+                if let tile = tileKey(visible.range.x + dx, y: visible.range.y + dy, level: visible.level) where tiles[tile.name]?.synced == nil {
+                    return false
+                }
+            }
+        }
+
+        return true
+    }
+
+    private func makeTile(key: UInt64, level: UInt32) -> Tile {
+
+        let bounds = LSQuadKeyDecode(key, level)
+
+        let northEast: [String: AnyObject] = ["_type": "point", "lat": bounds.maxLatitude, "lon": bounds.maxLongitude]
+        let southWest: [String: AnyObject] = ["_type": "point", "lat": bounds.minLatitude, "lon": bounds.minLongitude]
+
+        let clause: [String: AnyObject] = ["type": "geobox", "field": "location", "box": ["ne": northEast, "sw": southWest]]
+
+        return Tile(key: key, level: level, sync: DeltaSync(path: path, members: members, clause: clause))
+    }
+
+    // Returns whether any tile was forgotten
+    private func evict(range: (x: Int, y: Int, width: Int, height: Int), level: UInt32) -> Bool {
+
+        let before = tiles.count
+
+        let keepOtherLevels = !visibleLoaded()
+
+        for (name, tile) in tiles {
+
+            if tile.level != level && !keepOtherLevels {
+                tiles.removeValueForKey(name)
+                continue
+            }
+
+            if distance(tile, range: range, level: level) > evictDistance {
+                tiles.removeValueForKey(name)
+            }
+        }
+
+        return tiles.count != before
+    }
+
+    // Tiles at the level between the tile, which may be of another level,
+    // and the range; columns are counted the short way around the world
+    private func distance(tile: Tile, range: (x: Int, y: Int, width: Int, height: Int), level: UInt32) -> Int {
+
+        let tilesPerSide = 1 << Int(level)
+
+        var x: UInt32 = 0
+        var y: UInt32 = 0
+        LSQuadKeyTile(tile.key, &x, &y)
+
+        // First column and row of the tile at the level, and how many it spans
+        var column = Int(x)
+        var row = Int(y)
+        var size = 1
+
+        if tile.level < level {
+            size = 1 << Int(level - tile.level)
+            column *= size
+            row *= size
+        } else if tile.level > level {
+            column >>= Int(tile.level - level)
+            row >>= Int(tile.level - level)
+        }
+
+        let offset = ((column - range.x) % tilesPerSide + tilesPerSide) % tilesPerSide
+
+        var dx = 0
+
+        // Neither starting inside the range nor wrapping around into it
+        if offset >= range.width && offset + size <= tilesPerSide {
+            dx = min(offset - (range.width - 1), tilesPerSide - (offset + size - 1))
+        }
+
+        let dy = max(range.y - (row + size - 1), row - (range.y + range.height - 1), 0)
+
+        return max(dx, dy)
+    }
+
+    // Drops the members outside every tile kept, returns whether there were any
+    private func evictMembers() -> Bool {
+
+        let count = members.count
+
+        var held = [Bool](count: count, repeatedValue: false)
+
+        // A member is kept when the query of any kept tile, of whatever
+        // level, returns it; the table answers that locally
+        for tile in tiles.values {
+            for row in tile.sync.cachedRows() {
+                held[row] = true
+            }
+        }
+
+        let own = KiiUser.currentUser()?.userID
+
+        var evicted = [String]()
+
+        for row in 0 ..< count where !held[row] {
+            let userID = members.userID(row)
+            if userID != own {
+                evicted.append(userID)
+            }
+        }
+
+        // Rows move as others are removed, so they are found again by user
+        for userID in evicted {
+            let row = members.row(userID)
+            if row >= 0 {
+                members.remove(row)
+            }
+        }
+
+        return !evicted.isEmpty
+    }
+}
@@ -0,0 +1,77 @@
+//
+//  TrackSimplifier.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-24.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import MapKit
+import UIKit
+
+// Turns a stream of CLLocation fixes into the vertices that matter, every
+// dropped fix staying within tolerance meters of the simplified track.
+class TrackSimplifier: NSObject {
+
+    let ref: LSSimplifierRef
+
+    // Meters
+    let tolerance: Double
+
+    init(tolerance: Double = 5, maxWindow: Int = 120) {
+        ref = LSSimplifierCreate(tolerance, maxWindow)
+        self.tolerance = tolerance
+        super.init()
+    }
+
+    deinit {
+        LSSimplifierDestroy(ref)
+    }
+
+    // The vertices the fix completed, usually none
+    func add(location: CLLocation) -> [CLLocation] {
+
+        let pending = LSSimplifierAdd(ref, Int64(location.timestamp.timeIntervalSince1970 * 1000), location.coordinate.latitude, location.coordinate.longitude)
+
+        return drain(pending)
+    }
+
+    // Ends the track, the last fix becomes a vertex
+    func flush() -> [CLLocation] {
+        return drain(LSSimplifierFlush(ref))
+    }
+
+    private func drain(count: Int) -> [CLLocation] {
+
+        if count == 0 {
+            return []
+        }
+
+        var timestamps = [Int64](count: count, repeatedValue: 0)
+        var latitudes = [Double](count: count, repeatedValue: 0)
+        var longitudes = [Double](count: count, repeatedValue: 0)
+
+        let drained = LSSimplifierDrain(ref, &timestamps, &latitudes, &longitudes, count)
+
+        var vertices = [CLLocation]()
+
+        for i in 0 ..< drained {
+            vertices.append(CLLocation(coordinate: CLLocationCoordinate2DMake(latitudes[i], longitudes[i]), altitude: 0, horizontalAccuracy: 0, verticalAccuracy: -1, timestamp: NSDate(timeIntervalSince1970: Double(timestamps[i]) / 1000)))
+        }
+
+        return vertices
+    }
+
+    // Douglas-Peucker over a whole track, for drawing
+    class func simplify(coordinates: [CLLocationCoordinate2D], tolerance: Double) -> [CLLocationCoordinate2D] {
+
+        let latitudes = coordinates.map { $0.latitude }
+        let longitudes = coordinates.map { $0.longitude }
+
+        var keep = [UInt8](count: coordinates.count, repeatedValue: 0)
+
+        LSSimplifyPolyline(latitudes, longitudes, coordinates.count, tolerance, &keep)
+
+        return coordinates.enumerate().filter { keep[$0.index] != 0 }.map { $0.element }
+    }
+}
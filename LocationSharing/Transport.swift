@@ -0,0 +1,343 @@
+//
+//  Transport.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-31.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import UIKit
+
+// The one NSURLSession behind every request the app sends outside the SDK.
+//
+// KiiRequest opens its own connections and cannot be swapped out, so
+// requests that matter for refresh go through here instead. The session
+// keeps connections alive between requests and negotiates HTTP/2 where the
+// server offers it, so requests to one host share a connection and its TLS
+// session instead of each paying for a handshake. On top of that at most
+// maxPerHost requests to a host are in flight; the others wait in an
+// LSRequestScheduler of the host, so they start by priority class and
+// deadline and the last slot is kept for interactive requests: a map
+// refresh does not wait behind the saves queued before it.
+//
+// Responses come compressed whenever the server can: the session asks for
+// gzip and deflate and decodes them before the completion sees the data.
+// Request bodies are compressed by compressor when one is set. A host that
+// turns an encoding down, with 415 or with a 400 that names the content
+// encoding, gets the plain body again, and only plain bodies from then on.
+//
+// GET requests are revalidated against cache when it holds a body for them:
+// they go out with If-None-Match and a 304 is answered with the stored body as
+// a 200, so an unchanged object read through ObjectReader costs a header
+// only exchange. Other methods are never cached; a POST with If-None-Match
+// gets 412, not 304, so bucket queries always fetch the page.
+//
+// app points Kii Cloud requests at a base URL, which is how tests run them
+// against a local stand-in server. Counters of completed requests make
+// configurations comparable.
+class Transport: NSObject {
+
+    typealias Completion = (data: NSData?, response: NSHTTPURLResponse?, error: NSError?) -> Void
+
+    struct App {
+        let id: String
+        let key: String
+        // "https://api.kii.com/api" for the US site
+        let baseURL: NSURL
+    }
+
+    static let shared = Transport()
+
+    let session: NSURLSession
+
+    let maxPerHost: Int
+
+    var app: App?
+
+    var compressor: BodyCompressor?
+
+    var cache: ResponseCache?
+
+    // Learns the server time from the Date of every response
+    var clock: ServerClock?
+
+    private let lock = NSLock()
+    private var schedulers = [String: LSRequestSchedulerRef]()
+    // Tasks waiting for their turn, by scheduler request
+    private var waiting = [UInt64: NSURLSessionTask]()
+    private var plainHosts = Set<String>()
+
+    private(set) var completed = 0
+    private(set) var bytesReceived = 0
+    // Bytes of the bodies as they went over the wire, before decoding
+    private(set) var bytesSent = 0
+    private(set) var encodedBytesReceived = 0
+    private(set) var notModified = 0
+    private(set) var totalDuration: NSTimeInterval = 0
+
+    init(configuration: NSURLSessionConfiguration = NSURLSessionConfiguration.defaultSessionConfiguration(), maxPerHost: Int = 4) {
+
+        self.maxPerHost = max(maxPerHost, 1)
+
+        configuration.HTTPMaximumConnectionsPerHost = self.maxPerHost
+        configuration.timeoutIntervalForRequest = 30
+
+        session = NSURLSession(configuration: configuration)
+
+        super.init()
+    }
+
+    deinit {
+        for scheduler in schedulers.values {
+            LSRequestSchedulerDestroy(scheduler)
+        }
+    }
+
+    // The completion is called on a background queue. deadline is in seconds
+    // from now and orders requests within their priority class.
+    func send(request: NSURLRequest, priority: RequestScheduler.Priority = .Normal, deadline: NSTimeInterval? = nil, completion: Completion) {
+
+        let host = request.URL?.host ?? ""
+
+        let due = deadline.map { Int64((NSDate().timeIntervalSince1970 + $0) * 1000) } ?? Int64.max
+
+        let turn = (priority: priority, due: due)
+
+        guard let cache = cache where request.HTTPMethod == "GET" else {
+            deliver(request, host: host, turn: turn, completion: completion)
+            return
+        }
+
+        let key = ResponseCache.key(request)
+
+        let conditional = request.mutableCopy() as! NSMutableURLRequest
+        // The session must not answer or revalidate from its own cache
+        conditional.cachePolicy = .ReloadIgnoringLocalCacheData
+
+        if let etag = cache.etag(key) {
+            conditional.setValue(etag, forHTTPHeaderField: "If-None-Match")
+        }
+
+        deliver(conditional, host: host, turn: turn) { (data : NSData?, response : NSHTTPURLResponse?, error : NSError?) -> Void in
+
+            guard let response = response else {
+                completion(data: data, response: nil, error: error)
+                return
+            }
+
+            if response.statusCode == 304 {
+
+                if let body = cache.body(key), URL = response.URL {
+
+                    self.lock.lock()
+                    self.notModified += 1
+                    self.lock.unlock()
+
+                    completion(data: body, response: NSHTTPURLResponse(URL: URL, statusCode: 200, HTTPVersion: "HTTP/1.1", headerFields: response.allHeaderFields as? [String: String]), error: nil)
+                    return
+                }
+            }
+
+            cache.store(key, response: response, data: data)
+
+            completion(data: data, response: response, error: error)
+        }
+    }
+
+    // Compresses the body when it can
+    private func deliver(request: NSURLRequest, host: String, turn: Turn, completion: Completion) {
+
+        guard let body = request.HTTPBody, compressor = compressor where !isPlain(host) && request.valueForHTTPHeaderField("Content-Encoding") == nil, let encoded = compressor.compress(body) else {
+            start(request, host: host, turn: turn, completion: completion)
+            return
+        }
+
+        let compressed = request.mutableCopy() as! NSMutableURLRequest
+        compressed.HTTPBody = encoded
+        compressed.setValue(compressor.encoding, forHTTPHeaderField: "Content-Encoding")
+
+        start(compressed, host: host, turn: turn) { (data : NSData?, response : NSHTTPURLResponse?, error : NSError?) -> Void in
+
+            if let response = response where Transport.rejectsEncoding(response, data: data) {
+                self.setPlain(host)
+                self.start(request, host: host, turn: turn, completion: completion)
+                return
+            }
+
+            completion(data: data, response: response, error: error)
+        }
+    }
+
+    // Any other 400 is about the request itself and would fail plain too
+    class func rejectsEncoding(response: NSHTTPURLResponse, data: NSData?) -> Bool {
+
+        if response.statusCode == 415 {
+            return true
+        }
+
+        guard let data = data, body = NSString(data: data, encoding: NSUTF8StringEncoding) where response.statusCode == 400 else {
+            return false
+        }
+
+        let text = body.lowercaseString
+
+        return text.containsString("content-encoding") || text.containsString("content encoding")
+    }
+
+    // Blocks until the response is in, never call it on the main queue
+    func sendSynchronous(request: NSURLRequest, priority: RequestScheduler.Priority = .Normal, deadline: NSTimeInterval? = nil) -> (data: NSData?, response: NSHTTPURLResponse?, error: NSError?) {
+
+        let done = dispatch_semaphore_create(0)
+
+        var result: (data: NSData?, response: NSHTTPURLResponse?, error: NSError?) = (nil, nil, nil)
+
+        send(request, priority: priority, deadline: deadline) { (data : NSData?, response : NSHTTPURLResponse?, error : NSError?) -> Void in
+            result = (data, response, error)
+            dispatch_semaphore_signal(done)
+        }
+
+        dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER)
+
+        return result
+    }
+
+    // A Kii Cloud request for the path under the app, as the logged in user
+    func request(path: String, method: String = "GET", body: NSData? = nil, contentType: String? = nil) -> NSMutableURLRequest? {
+
+        guard let app = app, url = NSURL(string: app.baseURL.absoluteString + "/apps/" + app.id + "/" + path) else {
+            return nil
+        }
+
+        let request = NSMutableURLRequest(URL: url)
+        request.HTTPMethod = method
+        request.HTTPBody = body
+        request.setValue(app.id, forHTTPHeaderField: "X-Kii-AppID")
+        request.setValue(app.key, forHTTPHeaderField: "X-Kii-AppKey")
+
+        if let contentType = contentType {
+            request.setValue(contentType, forHTTPHeaderField: "Content-Type")
+        }
+
+        if let token = KiiUser.currentUser()?.accessToken {
+            request.setValue("Bearer " + token, forHTTPHeaderField: "Authorization")
+        }
+
+        return request
+    }
+
+    // Priority class and due time in ms of a request, kept for its retry
+    private typealias Turn = (priority: RequestScheduler.Priority, due: Int64)
+
+    private func start(request: NSURLRequest, host: String, turn: Turn, completion: Completion) {
+
+        enqueue(host, turn: turn) { (id : UInt64) -> NSURLSessionTask in
+
+            let started = NSDate()
+
+            var task: NSURLSessionDataTask!
+
+            task = self.session.dataTaskWithRequest(request) { (data : NSData?, response : NSURLResponse?, error : NSError?) -> Void in
+                self.finish(host, id: id, started: started, bytes: data?.length ?? 0, sent: Int(task.countOfBytesSent), encoded: Int(task.countOfBytesReceived))
+                if let response = response as? NSHTTPURLResponse {
+                    self.clock?.update(response, sent: started, received: NSDate())
+                }
+                completion(data: data, response: response as? NSHTTPURLResponse, error: error)
+            }
+
+            return task
+        }
+    }
+
+    // MARK: - Compression
+
+    private func isPlain(host: String) -> Bool {
+        lock.lock()
+        defer { lock.unlock() }
+        return plainHosts.contains(host)
+    }
+
+    private func setPlain(host: String) {
+        lock.lock()
+        plainHosts.insert(host)
+        lock.unlock()
+    }
+
+    // MARK: - Per host limit
+
+    // The task is made once the request has its ID, so its completion can
+    // finish the request even if it starts right away
+    private func enqueue(host: String, turn: Turn, task: (UInt64) -> NSURLSessionTask) {
+
+        lock.lock()
+
+        let scheduler = schedulers[host] ?? makeScheduler(host)
+
+        // Queues are not bounded here, every request sent gets its turn
+        let id = LSRequestSchedulerSubmit(scheduler, turn.priority.value, turn.due, nil)
+
+        waiting[id] = task(id)
+
+        lock.unlock()
+
+        pump(host)
+    }
+
+    // Called with the lock held
+    private func makeScheduler(host: String) -> LSRequestSchedulerRef {
+
+        let scheduler = LSRequestSchedulerCreate(maxPerHost)
+
+        for priority in [RequestScheduler.Priority.Interactive, .Normal, .Bulk] {
+            LSRequestSchedulerSetQueueLimit(scheduler, priority.value, Int.max)
+        }
+
+        schedulers[host] = scheduler
+
+        return scheduler
+    }
+
+    // Starts every request of the host allowed to run
+    private func pump(host: String) {
+
+        while true {
+
+            lock.lock()
+            let id = schedulers[host].map { LSRequestSchedulerNext($0) } ?? 0
+            let next = id != 0 ? waiting.removeValueForKey(id) : nil
+            lock.unlock()
+
+            guard let task = next else {
+                return
+            }
+
+            task.resume()
+        }
+    }
+
+    private func finish(host: String, id: UInt64, started: NSDate, bytes: Int, sent: Int, encoded: Int) {
+
+        lock.lock()
+
+        completed += 1
+        bytesReceived += bytes
+        bytesSent += sent
+        encodedBytesReceived += encoded
+        totalDuration += NSDate().timeIntervalSinceDate(started)
+
+        if let scheduler = schedulers[host] {
+            LSRequestSchedulerFinish(scheduler, id)
+        }
+
+        lock.unlock()
+
+        // The slot goes to the most urgent request waiting for the host
+        pump(host)
+    }
+
+    // Requests of the class waiting for a slot, to every host
+    func pending(priority: RequestScheduler.Priority) -> Int {
+        lock.lock()
+        defer { lock.unlock() }
+        return schedulers.values.reduce(0) { $0 + LSRequestSchedulerPending($1, priority.value) }
+    }
+}
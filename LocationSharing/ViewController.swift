@@ -25,9 +25,64 @@ class ViewController: UIViewController, MKMapViewDelegate, CLLocationManagerDele
     
     var readTimer = NSTimer()
     
+    // Pins glide between refreshes, so the map can be refreshed less often
+    var readInterval: NSTimeInterval = 5
+    
+    var animationTimer = NSTimer()
+    
+    var motion = MemberMotion()
+    
+    // The locations objects of the group, which the simulation in
+    // setDefaultLocations and updateUsersLocations moves; the tiles keep the
+    // member table current for the map
     var usersLocations: [AnyObject] = []
     
-    var usersAnnotations = [CustomPointAnnotation]()
+    var members = MemberTable()
+    
+    var writer = WriteCoalescer()
+    
+    // Reads the own object back, header only while it is unchanged
+    var reader = ObjectReader()
+    
+    // Fetches the members of the tiles on screen as the map moves
+    lazy var tiles: TileLoader = TileLoader(path: "groups/mygroup1/buckets/locations", members: self.members)
+    
+    var followViewport = true
+    
+    // Set once the map shows the region of the user, the storyboard region
+    // before it would load tiles of a whole continent
+    var regionReady = false
+    
+    // Own track from the location manager, reduced to the vertices worth keeping
+    var track = TrackSimplifier()
+    
+    // The latest vertices, older ones fall off so the track stays cheap to draw
+    var trackCoordinates = [CLLocationCoordinate2D]()
+    
+    var maxTrackCoordinates = 2000
+    
+    var trackLine: MKPolyline?
+    
+    // The latest fix is uploaded and pushed once either floor is passed,
+    // whether or not the simplifier has closed a vertex
+    var publishInterval: NSTimeInterval = 5
+    
+    var publishDistance: CLLocationDistance = 25
+    
+    var lastPublished: CLLocation?
+    
+    // Locations pushed by the other members, the read timer only runs while it is down
+    lazy var stream: LocationStream = LocationStream(topic: self.functions.getGroupWithID("mygroup1").topicWithName("locations"), members: self.members)
+    
+    // Location updates leave in one push message per 200 ms window
+    lazy var batcher: LocationBatcher = LocationBatcher(stream: self.stream)
+    
+    var usersAnnotations = MemberAnnotations()
+    
+    var clusters = MemberClusters()
+    
+    // Above this many members the map shows clusters instead of a pin per member
+    var clusterThreshold = 200
     
     override func viewDidLoad() {
         super.viewDidLoad()
@@ -44,26 +99,14 @@ class ViewController: UIViewController, MKMapViewDelegate, CLLocationManagerDele
         
         functions.login("alvin@example.com", password: "pass")
         
-        usersLocations = retrieveUsersLocations()
+        tiles.onChange = { [unowned self] in
+            self.showMembers()
+        }
         
-        setDefaultLocations()
-
-        let latitude:CLLocationDegrees = usersLocations[0].getGeoPointForKey("location")!.latitude
-        let longtitude:CLLocationDegrees = usersLocations[0].getGeoPointForKey("location")!.longitude
-        //let longtitude:CLLocationDegrees = 0
-        let latDelta = 0.05
-        let longDelta = 0.05
-        let span:MKCoordinateSpan = MKCoordinateSpanMake(latDelta, longDelta)
-        let location:CLLocationCoordinate2D = CLLocationCoordinate2DMake(latitude, longtitude)
-        let region:MKCoordinateRegion = MKCoordinateRegionMake(location, span)
-        
-        map.setRegion(region, animated: true)
         map.mapType = MKMapType.Standard
         map.showsUserLocation = true
         
-        initUsersAnnotations()
-        
-        updateUsersAnnotations()
+        loadUsersLocations()
         
         if let customView = NSBundle.mainBundle().loadNibNamed("LocationInfoSubview", owner: self, options: nil).first as? LocationInfoView {
             
@@ -76,103 +119,101 @@ class ViewController: UIViewController, MKMapViewDelegate, CLLocationManagerDele
 
         //writeTimer = NSTimer.scheduledTimerWithTimeInterval(0.6, target: self, selector: #selector(ViewController.updateUsersLocations), userInfo: nil, repeats: true)
         
-        //readTimer = NSTimer.scheduledTimerWithTimeInterval(2, target: self, selector: #selector(ViewController.readUsersLocations), userInfo: nil, repeats: true)
+        animationTimer = NSTimer.scheduledTimerWithTimeInterval(1.0 / 15, target: self, selector: #selector(ViewController.animateMembers), userInfo: nil, repeats: true)
+        
+        // Poll until the push connection is up
+        stream.onAvailabilityChange = { [unowned self] available in
+            self.setPolling(!available)
+        }
+        
+        stream.onUpdate = { [unowned self] rows in
+            self.showMembers()
+        }
         
     }
     
     func updateUsersAnnotations(){
     
-        let group = functions.getGroupWithID("mygroup1")
-        
-        let bucket = group.bucketWithName("locations")
-        
-        let allQuery = KiiQuery(clause: nil)
-        
-        // Create an array to store all the results in
-        var allResults = [AnyObject]()
+        // Merge the objects modified in the tiles on screen since their last
+        // sync; the pins that were added, removed or moved follow in onChange
+        tiles.refresh()
+
+    }
+    
+    
+    // Fetches the objects of the group on a background queue, then loads
+    // them into the member table and centers the map on the own one on the
+    // main queue
+    func loadUsersLocations(){
         
-        // Get an array of KiiObjects by querying the bucket
-        bucket.executeQuery(allQuery) { (query : KiiQuery?, KiiBucket, results : [AnyObject]?, nextQuery : KiiQuery?, error : NSError?) -> Void in
-            if error != nil {
-                // Error handling
-                return
-            }
-            // Add all the results from this query to the total results
-            allResults.appendContentsOf(results!)
-            
-            // list all users and corresponding latitude and longtitude
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0)) {
             
-            var userID: String
-            var latitude: CLLocationDegrees
-            var longtitude: CLLocationDegrees
+            let results = self.retrieveUsersLocations()
             
-            let allAnnotations = self.map.annotations
-            self.map.removeAnnotations(allAnnotations)
-            
-            for index in 0 ... allResults.count - 1{
+            dispatch_async(dispatch_get_main_queue()) {
+                
+                self.usersLocations = results
                 
-                userID = allResults[index].getObjectForKey("userID") as! String
+                self.members.load(results)
                 
-                latitude = allResults[index].getGeoPointForKey("location")!.latitude
-                longtitude = allResults[index].getGeoPointForKey("location")!.longitude
+                self.setDefaultLocations()
                 
-                if userID == self.usersAnnotations[index].id {
+                if let own = self.ownLocation(), userID = own.getObjectForKey("userID") as? String where self.members.row(userID) >= 0 {
                     
-                    latitude = allResults[index].getGeoPointForKey("location")!.latitude
-                    longtitude = allResults[index].getGeoPointForKey("location")!.longitude
-                    self.usersAnnotations[index].coordinate = CLLocationCoordinate2DMake(latitude, longtitude)
+                    let row = self.members.row(userID)
+                    
+                    let latitude:CLLocationDegrees = self.members.coordinate(row).latitude
+                    let longtitude:CLLocationDegrees = self.members.coordinate(row).longitude
+                    let latDelta = 0.05
+                    let longDelta = 0.05
+                    let span:MKCoordinateSpan = MKCoordinateSpanMake(latDelta, longDelta)
+                    let location:CLLocationCoordinate2D = CLLocationCoordinate2DMake(latitude, longtitude)
+                    let region:MKCoordinateRegion = MKCoordinateRegionMake(location, span)
+                    
+                    // The tiles load when the map has moved there
+                    self.regionReady = true
+                    self.map.setRegion(region, animated: true)
+                    
+                } else {
+                    
+                    // Nowhere to go, the tiles load for the map as it is
+                    self.regionReady = true
+                    self.tiles.update(self.map.region, zoom: MemberClusters.zoomOf(self.map))
                 }
- 
+                
+                self.showMembers()
+                
+                // Picks up what changed while the objects were loading
+                self.updateUsersAnnotations()
+                
+                // Polling and pushes start from the loaded rows
+                self.setPolling(true)
+                
+                self.stream.start()
             }
-            
-            self.map.addAnnotations(self.usersAnnotations)
         }
-
+        
     }
     
-    
-    func initUsersAnnotations(){
-        
-        let group = functions.getGroupWithID("mygroup1")
+    func showMembers(){
         
-        let bucket = group.bucketWithName("locations")
+        motion.update(members)
         
-        let allQuery = KiiQuery(clause: nil)
+        if members.count <= clusterThreshold {
+            clusters.removeAll(map)
+            usersAnnotations.update(map, members: members)
+        } else {
+            usersAnnotations.removeAll(map)
+            clusters.update(map, members: members)
+        }
         
-        // Create an array to store all the results in
-        var allResults = [AnyObject]()
+    }
+    
+    func animateMembers(){
         
-        // Get an array of KiiObjects by querying the bucket
-        do{
-            let results = try bucket.executeQuerySynchronous(allQuery, nextQuery: nil)
-            // Add all the results from this query to the total results
-            allResults.appendContentsOf(results)
-            
-            var userID: String
-            var latitude: CLLocationDegrees
-            var longtitude: CLLocationDegrees
-            
-            for obj in allResults{
-                
-                userID = obj.getObjectForKey("userID") as! String
-                
-                latitude = obj.getGeoPointForKey("location")!.latitude
-                longtitude = obj.getGeoPointForKey("location")!.longitude
-                
-                let annotation = CustomPointAnnotation()
-                annotation.coordinate = CLLocationCoordinate2DMake(latitude, longtitude)
-                annotation.id = userID
-                //annotation.subtitle = "Subtitle"
-                annotation.imageName = "pin2X.png"
-                
-                self.usersAnnotations.append(annotation)
-                
-            }
-   
-        } catch let error as NSError {
-            // Error handling
-            print(error)
-            return
+        // Clusters are redrawn with the region, only single pins move
+        if members.count <= clusterThreshold {
+            usersAnnotations.animate(members, motion: motion)
         }
         
     }
@@ -189,73 +230,85 @@ class ViewController: UIViewController, MKMapViewDelegate, CLLocationManagerDele
 
         if allResults.isEmpty == false{
             
-            for obj in allResults{
+            // All the objects go out together once they are set
+            let batch = BatchWriter()
+            
+            // A local move is newer than anything loaded; the trajectory store
+            // and the motion filters drop fixes that do not move time forward.
+            // Server time, like the _modified times the table holds
+            let now = ServerClock.milliseconds(ServerClock.shared.now())
+            
+            for obj in allResults {
                 
                 latitude += 0.005
                 longitude += 0.005
                 
+                if let userID = (obj as! KiiObject).getObjectForKey("userID") as? String where members.row(userID) >= 0 {
+                    members.setCoordinate(members.row(userID), coordinate: CLLocationCoordinate2DMake(latitude, longitude), timestamp: now)
+                }
+                
                 let location = KiiGeoPoint(latitude: latitude, andLongitude: longitude)
                 
-                obj.setGeoPoint(location, forKey:"location")
+                let patch = ObjectPatch(object: obj as! KiiObject)
                 
-                obj.saveAllFields(true, withBlock: { (object : KiiObject?, error : NSError?) -> Void in
-                    if error != nil {
-                        // Error handling
-                        return
-                    }
-                })
+                patch.setGeoPoint(location, forKey:"location")
+                patch.setString(GeoCell.geohash(latitude, longitude: longitude), forKey: GeoCell.fieldName)
+                
+                batch.add(patch)
             }
+            
+            batch.commit({ (succeeded : [KiiObject], failed : [KiiObject], error : NSError?) -> Void in
+                if error != nil {
+                    // Error handling
+                    print(error)
+                    return
+                }
+            })
+        }
+        
+    }
+    
+    func setPolling(enabled: Bool){
+        
+        if !enabled {
+            readTimer.invalidate()
+        } else if !readTimer.valid {
+            readTimer = NSTimer.scheduledTimerWithTimeInterval(readInterval, target: self, selector: #selector(ViewController.readUsersLocations), userInfo: nil, repeats: true)
         }
         
     }
     
     func readUsersLocations(){
     
-        let group = functions.getGroupWithID("mygroup1")
+        // Only the tiles on screen are polled, and only for what changed in them
+        tiles.refresh()
         
-        let bucket = group.bucketWithName("locations")
+        refreshOwnLocation()
         
-        let allQuery = KiiQuery(clause: nil)
+        members.trimHistory()
+    
+    }
+    
+    // Picks up moves of the own object saved from another device; the table
+    // keeps the local fix when it is newer
+    func refreshOwnLocation(){
         
-        // Create an array to store all the results in
-        var allResults = [AnyObject]()
+        guard let own = ownLocation() else {
+            return
+        }
         
-        // Get an array of KiiObjects by querying the bucket
-        bucket.executeQuery(allQuery) { (query : KiiQuery?, KiiBucket, results : [AnyObject]?, nextQuery : KiiQuery?, error : NSError?) -> Void in
-            if error != nil {
-                // Error handling
+        reader.read(own) { (fields : [String: AnyObject]?, error : NSError?) -> Void in
+            
+            guard let fields = fields else {
+                // Error handling, read again at the next poll
                 return
             }
-            // Add all the results from this query to the total results
-            allResults.appendContentsOf(results!)
             
-            // list all users and corresponding latitude and longtitude
-            
-            var userID: String
-            var latitude: CLLocationDegrees
-            var longtitude: CLLocationDegrees
-            
-            let allAnnotations = self.map.annotations
-            self.map.removeAnnotations(allAnnotations)
-
-            for obj in allResults{
-                
-                userID = obj.getObjectForKey("userID") as! String
-                
-                latitude = obj.getGeoPointForKey("location")!.latitude
-                longtitude = obj.getGeoPointForKey("location")!.longitude
-                
-                let annotation = CustomPointAnnotation()
-                annotation.coordinate = CLLocationCoordinate2DMake(latitude, longtitude)
-                annotation.title = userID
-                //annotation.subtitle = "Subtitle"
-                annotation.imageName = "pin2X.png"
-                
-                self.map.addAnnotation(annotation)
-                
+            if self.members.load(fields) >= 0 {
+                self.showMembers()
             }
         }
-    
+        
     }
     
     func updateUsersLocations(){
@@ -266,44 +319,61 @@ class ViewController: UIViewController, MKMapViewDelegate, CLLocationManagerDele
 
         if allResults.isEmpty == false{
 
-            for obj in allResults{
+            for obj in allResults {
+                
+                let object = obj as! KiiObject
                 
-                let latitude = obj.getGeoPointForKey("location")!.latitude + 0.0002
-                let longtitude = obj.getGeoPointForKey("location")!.longitude + 0.0002
+                guard let userID = object.getObjectForKey("userID") as? String else {
+                    continue
+                }
+                
+                // Members of tiles off screen are not in the table, the object
+                // holds the point last written for them
+                let row = members.row(userID)
+                
+                guard let current = row >= 0 ? members.coordinate(row) : object.getGeoPointForKey("location").map({ CLLocationCoordinate2DMake($0.latitude, $0.longitude) }) else {
+                    continue
+                }
+                
+                let latitude = current.latitude + 0.0002
+                let longtitude = current.longitude + 0.0002
                 
-                let location = KiiGeoPoint(latitude: latitude, andLongitude: longtitude)
+                let coordinate = CLLocationCoordinate2DMake(latitude, longtitude)
                 
-                obj.setGeoPoint(location, forKey:"location")
+                if row >= 0 {
+                    members.setCoordinate(row, coordinate: coordinate, timestamp: ServerClock.milliseconds(ServerClock.shared.now()))
+                }
                 
-                obj.saveAllFields(true, withBlock: { (object : KiiObject?, error : NSError?) -> Void in
-                    if error != nil {
-                        // Error handling
-                        print(error)
-                        return
-                    }
-                })
+                // Only the latest point is saved while a save of this object is in flight
+                writer.write(object, coordinate: coordinate)
+                
+                batcher.add(userID, location: CLLocation(latitude: latitude, longitude: longtitude))
             }
         }
     }
 
+    // Blocks until every page is in, never call it on the main queue
     func retrieveUsersLocations() -> [AnyObject]{
         
         let group = functions.getGroupWithID("mygroup1")
         
         let bucket = group.bucketWithName("locations")
 
-        // Build "all" query
+        // Build "all" query, the simulation moves every member
         let allQuery = KiiQuery(clause: nil)
         
         // Create an array to store all the results in
         var allResults = [AnyObject]()
         
-        // Get an array of KiiObjects by querying the bucket
-        do{
-            let results = try bucket.executeQuerySynchronous(allQuery, nextQuery: nil)
-            // Add all the results from this query to the total results
+        // Get every page of KiiObjects by querying the bucket
+        let cursor = QueryCursor(bucket: bucket, query: allQuery)
+        
+        while let results = cursor.next() {
+            // Add all the results from this page to the total results
             allResults.appendContentsOf(results)
-        } catch let error as NSError {
+        }
+        
+        if cursor.error != nil {
             // Error handling
             return []
         }
@@ -312,6 +382,93 @@ class ViewController: UIViewController, MKMapViewDelegate, CLLocationManagerDele
         
     }
     
+    func locationManager(manager: CLLocationManager, didUpdateLocations locations: [CLLocation]) {
+        
+        if let fix = locations.last {
+            publish(fix)
+        }
+        
+        var vertices = [CLLocation]()
+        
+        for location in locations {
+            vertices.appendContentsOf(track.add(location))
+        }
+        
+        if vertices.isEmpty {
+            return
+        }
+        
+        // Only significant vertices are kept for the track
+        trackCoordinates.appendContentsOf(vertices.map { $0.coordinate })
+        
+        if trackCoordinates.count > maxTrackCoordinates {
+            trackCoordinates.removeFirst(trackCoordinates.count - maxTrackCoordinates)
+        }
+        
+        drawTrack()
+    }
+    
+    // Uploads the fix and pushes it to the other members when it is far
+    // enough in time or distance from the last one sent
+    func publish(fix: CLLocation) {
+        
+        if let last = lastPublished where fix.timestamp.timeIntervalSinceDate(last.timestamp) < publishInterval && fix.distanceFromLocation(last) < publishDistance {
+            return
+        }
+        
+        lastPublished = fix
+        
+        if let own = ownLocation() {
+            writer.write(own, coordinate: fix.coordinate)
+        }
+        
+        // The other members get the fix right away instead of at their next poll
+        if let userID = KiiUser.currentUser()?.userID {
+            batcher.add(userID, location: fix)
+        }
+    }
+    
+    // Draws the track with what a point on screen can show, the vertices
+    // closer than that to the line are left out
+    func drawTrack() {
+        
+        let metersPerPoint = map.region.span.longitudeDelta * 111320 * cos(map.region.center.latitude * M_PI / 180) / Double(max(map.bounds.width, 1))
+        
+        var coordinates = TrackSimplifier.simplify(trackCoordinates, tolerance: max(metersPerPoint, track.tolerance))
+        
+        if let line = trackLine {
+            map.removeOverlay(line)
+        }
+        
+        trackLine = MKPolyline(coordinates: &coordinates, count: coordinates.count)
+        map.addOverlay(trackLine!)
+    }
+    
+    // The locations object of the user logged in
+    func ownLocation() -> KiiObject? {
+        
+        guard let userID = KiiUser.currentUser()?.userID else {
+            return nil
+        }
+        
+        for obj in usersLocations {
+            if let object = obj as? KiiObject where object.getObjectForKey("userID") as? String == userID {
+                return object
+            }
+        }
+        
+        return nil
+    }
+    
+    func mapView(mapView: MKMapView, rendererForOverlay overlay: MKOverlay) -> MKOverlayRenderer {
+        
+        let renderer = MKPolylineRenderer(overlay: overlay)
+        renderer.strokeColor = UIColor.blueColor()
+        renderer.lineWidth = 3
+        
+        return renderer
+    }
+    
     func mapView(mapView: MKMapView, viewForAnnotation annotation: MKAnnotation) -> MKAnnotationView? {
 
         if !(annotation is CustomPointAnnotation) {
@@ -337,9 +494,33 @@ class ViewController: UIViewController, MKMapViewDelegate, CLLocationManagerDele
         let cpa = annotation 
         anView!.image = UIImage(named:cpa.imageName)
         
+        // Clusters show their member count in a callout
+        if let cluster = annotation as? ClusterAnnotation {
+            anView!.canShowCallout = cluster.count > 1
+        } else {
+            anView!.canShowCallout = false
+        }
+        
         return anView
     }
     
+    func mapView(mapView: MKMapView, regionDidChangeAnimated animated: Bool) {
+        
+        if followViewport && regionReady {
+            tiles.update(map.region, zoom: MemberClusters.zoomOf(map))
+        }
+        
+        // Clusters depend on the zoom level and the visible region
+        if members.count > clusterThreshold {
+            clusters.update(map, members: members)
+        }
+        
+        // So does the detail the track is drawn with
+        if !trackCoordinates.isEmpty {
+            drawTrack()
+        }
+    }
+    
     func mapView(mapView: MKMapView, didSelectAnnotationView view: MKAnnotationView) {
 
         if !(view.annotation is CustomPointAnnotation) {
@@ -0,0 +1,103 @@
+//
+//  WriteCoalescer.swift
+//  LocationSharing
+//
+//  Created by Qi (Alvin) Jing on 2016-08-15.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import MapKit
+import UIKit
+
+// Saves location updates of KiiObjects without piling up requests. Each
+// object has at most one save in flight; anything written meanwhile only
+// replaces the pending point, and the latest one is saved when the request
+// returns. Points closer than minimumDistance meters to the last point sent
+// are dropped.
+//
+// Meant to be used from the main queue, where the save blocks are called.
+class WriteCoalescer: NSObject {
+
+    private class Entry {
+        let patch: ObjectPatch
+        var sent: CLLocationCoordinate2D?
+        var pending: CLLocationCoordinate2D?
+        var inFlight = false
+
+        init(object: KiiObject) {
+            patch = ObjectPatch(object: object)
+        }
+    }
+
+    let minimumDistance: Double
+
+    private var entries = [ObjectIdentifier: Entry]()
+
+    init(minimumDistance: Double = 5) {
+        self.minimumDistance = minimumDistance
+        super.init()
+    }
+
+    func write(object: KiiObject, coordinate: CLLocationCoordinate2D) {
+
+        let key = ObjectIdentifier(object)
+
+        let entry = entries[key] ?? Entry(object: object)
+        entries[key] = entry
+
+        if let sent = entry.sent where LSGeoDistance(sent.latitude, sent.longitude, coordinate.latitude, coordinate.longitude, LSGeoDistanceHaversine) < minimumDistance {
+            // Back within reach of what the server has, nothing to send
+            entry.pending = nil
+            return
+        }
+
+        entry.pending = coordinate
+
+        if !entry.inFlight {
+            flush(entry)
+        }
+    }
+
+    // Saves still waiting for the one in flight
+    var pendingCount: Int {
+        return entries.values.filter { $0.pending != nil }.count
+    }
+
+    private func flush(entry: Entry) {
+
+        guard let coordinate = entry.pending else {
+            return
+        }
+
+        let previous = entry.sent
+
+        entry.pending = nil
+        entry.sent = coordinate
+        entry.inFlight = true
+
+        entry.patch.setGeoPoint(KiiGeoPoint(latitude: coordinate.latitude, andLongitude: coordinate.longitude), forKey: "location")
+        entry.patch.setString(GeoCell.geohash(coordinate.latitude, longitude: coordinate.longitude), forKey: GeoCell.fieldName)
+
+        // Only location and geohash go out, queued behind any interactive SDK request
+        RequestScheduler.shared.with(.Bulk) {
+            entry.patch.save({ (error : NSError?) -> Void in
+
+                entry.inFlight = false
+
+                if error != nil {
+                    // Error handling
+                    print(error)
+                    // The server still has the previous point; keep the newest one
+                    // for the next write rather than retrying in a loop
+                    entry.sent = previous
+                    if entry.pending == nil {
+                        entry.pending = coordinate
+                    }
+                    return
+                }
+
+                self.flush(entry)
+            })
+        }
+    }
+}
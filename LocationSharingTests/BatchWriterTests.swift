@@ -0,0 +1,98 @@
+//
+//  BatchWriterTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import XCTest
+@testable import LocationSharing
+
+class BatchWriterTests: XCTestCase {
+
+    var transport: Transport!
+
+    override func setUp() {
+        super.setUp()
+        StubURLProtocol.reset()
+        transport = Transport(configuration: StubURLProtocol.configuration())
+        transport.app = Transport.App(id: "app", key: "key", baseURL: NSURL(string: "https://stub.example/api")!)
+    }
+
+    override func tearDown() {
+        StubURLProtocol.reset()
+        super.tearDown()
+    }
+
+    func patchOf(id: String) -> ObjectPatch {
+        let object = KiiObject(URI: "kiicloud://groups/group/buckets/locations/objects/" + id)!
+        let patch = ObjectPatch(object: object)
+        patch.setGeoPoint(KiiGeoPoint(latitude: 35.6, andLongitude: 139.7), forKey: "location")
+        return patch
+    }
+
+    func testCommitSendsAPartialUpdateOfEachObject() {
+
+        StubURLProtocol.handler = { (request) in
+            return StubURLProtocol.Response(status: request.request.URL!.path!.hasSuffix("/b") ? 409 : 200)
+        }
+
+        let patches = ["a", "b", "c"].map { self.patchOf($0) }
+
+        let batch = BatchWriter(transport: transport)
+        for patch in patches {
+            batch.add(patch)
+        }
+
+        let done = expectationWithDescription("commit")
+
+        batch.commit { (succeeded, failed, error) in
+            XCTAssertEqual(succeeded.count, 2)
+            XCTAssertEqual(failed.count, 1)
+            XCTAssertTrue(failed.first === patches[1].object)
+            XCTAssertNotNil(error)
+            done.fulfill()
+        }
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+
+        let requests = StubURLProtocol.requests
+        XCTAssertEqual(requests.count, 3)
+
+        for sent in requests {
+            XCTAssertEqual(sent.request.URL?.host, "stub.example")
+            XCTAssertTrue(sent.request.URL!.path!.hasPrefix("/api/apps/app/groups/group/buckets/locations/objects/"))
+            XCTAssertEqual(sent.request.HTTPMethod, "POST")
+            XCTAssertEqual(sent.request.valueForHTTPHeaderField("X-HTTP-Method-Override"), "PATCH")
+
+            let fields = try? NSJSONSerialization.JSONObjectWithData(sent.body, options: []) as? [String: AnyObject]
+            XCTAssertNotNil(fields??["location"])
+        }
+
+        // The failed object keeps its fields for the next save
+        XCTAssertFalse(patches[0].isDirty)
+        XCTAssertTrue(patches[1].isDirty)
+    }
+
+    func testCleanObjectsAreNotSent() {
+
+        let object = KiiObject(URI: "kiicloud://groups/group/buckets/locations/objects/a")!
+
+        let batch = BatchWriter(transport: transport)
+        batch.add(ObjectPatch(object: object))
+
+        let done = expectationWithDescription("commit")
+
+        batch.commit { (succeeded, failed, error) in
+            XCTAssertEqual(succeeded.count, 1)
+            XCTAssertTrue(failed.isEmpty)
+            XCTAssertNil(error)
+            done.fulfill()
+        }
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+
+        XCTAssertTrue(StubURLProtocol.requests.isEmpty)
+    }
+}
@@ -0,0 +1,136 @@
+//
+//  DeflaterTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import XCTest
+@testable import LocationSharing
+
+class DeflaterTests: XCTestCase {
+
+    // A location object like the ones BatchWriter sends
+    func locationBody() -> NSData {
+        let object = ["userID": "0123456789abcdef", "location": ["_type": "point", "lat": 35.658581, "lon": 139.745433], "timestamp": 1473206400000, "accuracy": 12.5, "speed": 1.4]
+        return try! NSJSONSerialization.dataWithJSONObject(object, options: [])
+    }
+
+    // Objects of several members, as a batch or a query page holds them
+    func locationsBody() -> NSData {
+        let objects = (0 ..< 20).map { (i) -> [String: AnyObject] in
+            return ["userID": "user\(i)", "location": ["_type": "point", "lat": 35.6 + Double(i) / 1000, "lon": 139.7], "timestamp": 1473206400000 + i]
+        }
+        return try! NSJSONSerialization.dataWithJSONObject(["results": objects], options: [])
+    }
+
+    func queryBody() -> NSData {
+        let query = ["bucketQuery": ["clause": ["type": "range", "field": "_modified", "lowerLimit": 1473206400000, "lowerIncluded": true], "orderBy": "_modified", "descending": false], "bestEffortLimit": 100]
+        return try! NSJSONSerialization.dataWithJSONObject(query, options: [])
+    }
+
+    // windowBits as for inflateInit2, 31 for gzip and 15 for a zlib stream;
+    // a stream that asks for a dictionary gets the given one
+    func decompress(data: NSData, windowBits: Int32, dictionary: NSData? = nil, dictionaryID: UInt32 = 0) -> NSData? {
+
+        var stream = z_stream()
+
+        guard inflateInit2_(&stream, windowBits, ZLIB_VERSION, Int32(sizeof(z_stream))) == Z_OK else {
+            return nil
+        }
+
+        defer { inflateEnd(&stream) }
+
+        let input = NSMutableData(data: data)
+        let output = NSMutableData(length: 64 * 1024)!
+
+        stream.next_in = UnsafeMutablePointer<Bytef>(input.mutableBytes)
+        stream.avail_in = uInt(input.length)
+        stream.next_out = UnsafeMutablePointer<Bytef>(output.mutableBytes)
+        stream.avail_out = uInt(output.length)
+
+        var status = inflate(&stream, Z_FINISH)
+
+        if status == Z_NEED_DICT {
+
+            guard let dictionary = dictionary where stream.adler == uLong(dictionaryID) else {
+                return nil
+            }
+
+            guard inflateSetDictionary(&stream, UnsafePointer<Bytef>(dictionary.bytes), uInt(dictionary.length)) == Z_OK else {
+                return nil
+            }
+
+            status = inflate(&stream, Z_FINISH)
+        }
+
+        if status != Z_STREAM_END {
+            return nil
+        }
+
+        output.length = Int(stream.total_out)
+
+        return output
+    }
+
+    func testGzipRoundTrip() {
+
+        let compressor = BodyCompressor()!
+        XCTAssertEqual(compressor.encoding, "gzip")
+        XCTAssertEqual(compressor.dictionaryID, 0)
+
+        // The stream is reset between bodies, so each one stands alone
+        for body in [locationsBody(), queryBody(), locationsBody()] {
+
+            guard let compressed = compressor.compress(body) else {
+                XCTFail("not compressed")
+                continue
+            }
+
+            XCTAssertLessThan(compressed.length, body.length)
+            XCTAssertEqual(decompress(compressed, windowBits: 31), body)
+        }
+    }
+
+    func testDictionaryRoundTrip() {
+
+        let compressor = BodyCompressor.locationObjects()!
+        XCTAssertEqual(compressor.encoding, "deflate")
+        XCTAssertNotEqual(compressor.dictionaryID, 0)
+
+        var length = 0
+        let bytes = LSDeflaterLocationDictionary(&length)
+        let dictionary = NSData(bytes: bytes, length: length)
+
+        for body in [locationBody(), queryBody(), locationBody()] {
+
+            guard let compressed = compressor.compress(body) else {
+                XCTFail("not compressed")
+                continue
+            }
+
+            XCTAssertEqual(decompress(compressed, windowBits: 15, dictionary: dictionary, dictionaryID: compressor.dictionaryID), body)
+
+            // Without the dictionary the receiver cannot read it
+            XCTAssertNil(decompress(compressed, windowBits: 15))
+        }
+    }
+
+    func testDictionaryShrinksLocationObjects() {
+
+        let body = locationBody()
+
+        let plain = BodyCompressor(minimumLength: 0)!.compress(body)?.length ?? body.length
+        let primed = BodyCompressor.locationObjects()!.compress(body)?.length ?? body.length
+
+        XCTAssertLessThan(primed, plain)
+    }
+
+    func testShortBodyIsNotCompressed() {
+
+        let compressor = BodyCompressor()!
+
+        XCTAssertNil(compressor.compress("{\"type\":\"all\"}".dataUsingEncoding(NSUTF8StringEncoding)!))
+    }
+}
@@ -0,0 +1,83 @@
+//
+//  DeltaSyncTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import XCTest
+@testable import LocationSharing
+
+class DeltaSyncTests: XCTestCase {
+
+    var transport: Transport!
+
+    override func setUp() {
+        super.setUp()
+        StubURLProtocol.reset()
+        transport = Transport(configuration: StubURLProtocol.configuration())
+        transport.app = Transport.App(id: "app", key: "key", baseURL: NSURL(string: "https://stub.example/api")!)
+
+        StubURLProtocol.handler = { (request) in
+            let body = "{\"results\":[{\"userID\":\"user\",\"location\":{\"_type\":\"point\",\"lat\":35.6,\"lon\":139.7},\"_modified\":1473206400000}]}"
+            return StubURLProtocol.Response(status: 200, headers: ["Content-Type": "application/json"], body: body.dataUsingEncoding(NSUTF8StringEncoding)!)
+        }
+    }
+
+    override func tearDown() {
+        StubURLProtocol.reset()
+        super.tearDown()
+    }
+
+    func testCallDuringSyncJoinsIt() {
+
+        let sync = DeltaSync(path: "groups/group/buckets/locations", members: MemberTable(), transport: transport)
+
+        let first = expectationWithDescription("first")
+        let second = expectationWithDescription("second")
+
+        var results = [[Int]]()
+
+        sync.sync { (rows, error) in
+            XCTAssertNil(error)
+            results.append(rows)
+            first.fulfill()
+        }
+
+        XCTAssertTrue(sync.syncing)
+
+        sync.sync { (rows, error) in
+            XCTAssertNil(error)
+            results.append(rows)
+            second.fulfill()
+        }
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+
+        // One query, both callers hear of its rows in the order they called
+        XCTAssertEqual(StubURLProtocol.requests.count, 1)
+        XCTAssertEqual(results.count, 2)
+        XCTAssertEqual(results.first ?? [], [0])
+        XCTAssertEqual(results.last ?? [], [0])
+        XCTAssertFalse(sync.syncing)
+        XCTAssertEqual(sync.highWaterMark, 1473206400000)
+    }
+
+    func testNextSyncStartsFromTheMark() {
+
+        let sync = DeltaSync(path: "groups/group/buckets/locations", members: MemberTable(), transport: transport)
+
+        let done = expectationWithDescription("synced")
+
+        sync.sync { (rows, error) in
+            done.fulfill()
+        }
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+
+        let clause = sync.query()
+        XCTAssertEqual(clause["type"] as? String, "range")
+        XCTAssertEqual((clause["lowerLimit"] as? NSNumber)?.longLongValue, 1473206400000)
+    }
+}
@@ -0,0 +1,97 @@
+//
+//  LocalClauseTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import XCTest
+@testable import LocationSharing
+
+class LocalClauseTests: XCTestCase {
+
+    var members: MemberTable!
+
+    // Rows 0 to 4 in this order
+    override func setUp() {
+        super.setUp()
+        members = MemberTable()
+        for (userID, latitude, longitude, modified) in [("alice", 35.6, 139.7, 1000), ("bob", 35.61, 139.71, 2000), ("carol", 35.7, 139.8, 3000), ("dave", -33.86, 151.21, 4000), ("alan", 35.605, 139.705, 5000)] {
+            members.load(["userID": userID, "location": ["_type": "point", "lat": latitude, "lon": longitude], "_modified": modified])
+        }
+    }
+
+    func rows(clause: [String: AnyObject]) -> [Int]? {
+        return LocalClause(dictionary: clause)?.rows(members)
+    }
+
+    func point(latitude: Double, _ longitude: Double) -> [String: AnyObject] {
+        return ["_type": "point", "lat": latitude, "lon": longitude]
+    }
+
+    // Around alice, bob and alan
+    func box() -> [String: AnyObject] {
+        return ["type": "geobox", "field": "location", "box": ["ne": point(35.65, 139.75), "sw": point(35.55, 139.65)]]
+    }
+
+    func testAll() {
+        XCTAssertEqual(rows(["type": "all"]) ?? [], [0, 1, 2, 3, 4])
+        XCTAssertEqual(rows(["type": "hasField", "field": "location", "fieldType": "POINT"]) ?? [], [0, 1, 2, 3, 4])
+    }
+
+    func testEquals() {
+        XCTAssertEqual(rows(["type": "eq", "field": "userID", "value": "bob"]) ?? [], [1])
+        XCTAssertEqual(rows(["type": "eq", "field": "_modified", "value": 3000]) ?? [], [2])
+        // Fields the table does not hold never match
+        XCTAssertEqual(rows(["type": "eq", "field": "name", "value": "bob"]) ?? [0], [])
+    }
+
+    func testWholeQuery() {
+        XCTAssertEqual(rows(["bucketQuery": ["clause": ["type": "eq", "field": "userID", "value": "bob"]]]) ?? [], [1])
+    }
+
+    func testRange() {
+        XCTAssertEqual(rows(["type": "range", "field": "_modified", "lowerLimit": 2000, "lowerIncluded": true, "upperLimit": 4000, "upperIncluded": false]) ?? [], [1, 2])
+        XCTAssertEqual(rows(["type": "range", "field": "_modified", "lowerLimit": 2000, "lowerIncluded": false]) ?? [], [2, 3, 4])
+        // Limits are included unless they say otherwise
+        XCTAssertEqual(rows(["type": "range", "field": "_modified", "upperLimit": 2000]) ?? [], [0, 1])
+    }
+
+    func testIn() {
+        XCTAssertEqual(rows(["type": "in", "field": "userID", "values": ["alice", "dave", "zed"]]) ?? [], [0, 3])
+    }
+
+    func testPrefix() {
+        XCTAssertEqual(rows(["type": "prefix", "field": "userID", "prefix": "al"]) ?? [], [0, 4])
+    }
+
+    func testGeoBox() {
+        XCTAssertEqual(rows(box()) ?? [], [0, 1, 4])
+    }
+
+    func testGeoDistance() {
+        // bob is about 1.4 km from alice, alan about 0.7 km
+        XCTAssertEqual(rows(["type": "geodistance", "field": "location", "center": point(35.6, 139.7), "radius": 2000]) ?? [], [0, 1, 4])
+        XCTAssertEqual(rows(["type": "geodistance", "field": "location", "center": point(35.6, 139.7), "radius": 1000]) ?? [], [0, 4])
+    }
+
+    func testAndOrNot() {
+        XCTAssertEqual(rows(["type": "and", "clauses": [box(), ["type": "range", "field": "_modified", "lowerLimit": 2000]]]) ?? [], [1, 4])
+        XCTAssertEqual(rows(["type": "or", "clauses": [["type": "eq", "field": "userID", "value": "dave"], ["type": "prefix", "field": "userID", "prefix": "ca"]]]) ?? [], [2, 3])
+        XCTAssertEqual(rows(["type": "not", "clause": box()]) ?? [], [2, 3])
+
+        let nested: [String: AnyObject] = ["type": "or", "clauses": [["type": "eq", "field": "userID", "value": "alice"], ["type": "and", "clauses": [["type": "prefix", "field": "userID", "prefix": "d"], ["type": "range", "field": "_modified", "upperLimit": 4000]]]]]
+        XCTAssertEqual(rows(["type": "not", "clause": nested]) ?? [], [1, 2, 4])
+    }
+
+    func testUnknownClauseIsRejected() {
+        XCTAssertNil(LocalClause(dictionary: ["type": "bogus"]))
+    }
+
+    // The rows a tile keeps are the ones its own query would return
+    func testDeltaSyncAnswersFromTheTable() {
+        let sync = DeltaSync(path: "groups/group/buckets/locations", members: members, clause: box())
+        XCTAssertEqual(sync.cachedRows(), [0, 1, 4])
+    }
+}
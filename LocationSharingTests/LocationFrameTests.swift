@@ -0,0 +1,170 @@
+//
+//  LocationFrameTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import CoreLocation
+import XCTest
+@testable import LocationSharing
+
+class LocationFrameTests: XCTestCase {
+
+    func record(userID: String, latitude: Double = 35.6, longitude: Double = 139.7, heading: Double = -1, speed: Double = -1, accuracy: Double = -1, timestamp: Int64) -> LSLocationRecord {
+        return LSLocationRecord(userKey: LSLocationFrameUserKey(userID), latitude: latitude, longitude: longitude, heading: heading, speed: speed, accuracy: accuracy, timestamp: timestamp)
+    }
+
+    // An empty NSData when the records cannot go in one frame
+    func encode(records: [LSLocationRecord]) -> NSData {
+        let size = LSLocationFrameEncode(records, records.count, nil, 0)
+        var bytes = [UInt8](count: size, repeatedValue: 0)
+        XCTAssertEqual(LSLocationFrameEncode(records, records.count, &bytes, size), size)
+        return NSData(bytes: bytes, length: size)
+    }
+
+    func decode(frame: NSData) -> [LSLocationRecord] {
+        let bytes = UnsafePointer<UInt8>(frame.bytes)
+        let count = LSLocationFrameCount(bytes, frame.length)
+        XCTAssertGreaterThanOrEqual(count, 0)
+        return (0 ..< Int(max(count, 0))).map { (index) -> LSLocationRecord in
+            var decoded = LSLocationRecord()
+            XCTAssertTrue(LSLocationFrameRecordAt(bytes, frame.length, index, &decoded))
+            return decoded
+        }
+    }
+
+    func testLatitudeBounds() {
+
+        let records = decode(encode([record("north", latitude: 90, timestamp: 0), record("south", latitude: -90, timestamp: 0), record("beyond", latitude: 95, timestamp: 0)]))
+
+        // The poles are steps of their own, anything past them is clamped
+        XCTAssertEqual(records.map { $0.latitude }, [90, -90, 90])
+        XCTAssertEqual(records[0].userKey, LSLocationFrameUserKey("north"))
+    }
+
+    func testLongitudeWraps() {
+
+        let records = decode(encode([record("east", longitude: 180, timestamp: 0), record("west", longitude: -180.0000001, timestamp: 0), record("around", longitude: 539.7, timestamp: 0), record("tokyo", longitude: 139.7, timestamp: 0)]))
+
+        // 180 is -180 again, and whole turns are dropped
+        XCTAssertEqual(records[0].longitude, -180)
+        XCTAssertEqual(records[1].longitude, -180)
+        XCTAssertEqualWithAccuracy(records[2].longitude, 179.7, accuracy: 1e-5)
+        XCTAssertEqualWithAccuracy(records[3].longitude, 139.7, accuracy: 1e-5)
+    }
+
+    func testUnknownSpeedAndAccuracy() {
+
+        let records = decode(encode([
+            record("unknown", heading: 90, timestamp: 0),
+            record("nan", heading: 90, speed: Double.NaN, accuracy: Double.NaN, timestamp: 0),
+            record("stopped", heading: 90, speed: 0, accuracy: 254.5, timestamp: 0),
+            record("fast", heading: 400, speed: 70, accuracy: 0.4, timestamp: 0)
+        ]))
+
+        // No heading without a speed to go with it
+        XCTAssertEqual(records[0].speed, -1)
+        XCTAssertEqual(records[0].accuracy, -1)
+        XCTAssertEqual(records[0].heading, -1)
+
+        XCTAssertEqual(records[1].speed, -1)
+        XCTAssertEqual(records[1].accuracy, -1)
+
+        XCTAssertEqual(records[2].speed, 0)
+        XCTAssertEqual(records[2].heading, -1)
+        XCTAssertEqual(records[2].accuracy, -1)
+
+        // Capped at 63.5 m/s, the heading wraps
+        XCTAssertEqual(records[3].speed, 63.5)
+        XCTAssertEqualWithAccuracy(records[3].heading, 40, accuracy: 1.4)
+        XCTAssertEqual(records[3].accuracy, 0)
+    }
+
+    func testTimeRange() {
+
+        let base: Int64 = 1473206400000
+
+        // 4095 steps of 10 ms from the oldest record fit, in any order
+        let frame = encode([record("late", timestamp: base + 40959), record("early", timestamp: base), record("middle", timestamp: base + 12345)])
+        XCTAssertEqual(frame.length, Int(LSLocationFrameHeaderSize + 3 * LSLocationFrameRecordSize))
+        XCTAssertEqual(decode(frame).map { $0.timestamp }, [base + 40950, base, base + 12340])
+
+        // One more step does not
+        let records = [record("early", timestamp: base), record("late", timestamp: base + 40960)]
+        XCTAssertEqual(LSLocationFrameEncode(records, records.count, nil, 0), 0)
+
+        XCTAssertEqual(encode([]).length, Int(LSLocationFrameHeaderSize))
+    }
+
+    func testMalformedFrame() {
+
+        let frame = encode([record("alice", timestamp: 0)])
+        let bytes = UnsafePointer<UInt8>(frame.bytes)
+
+        XCTAssertEqual(LSLocationFrameCount(bytes, frame.length), 1)
+        XCTAssertEqual(LSLocationFrameCount(bytes, frame.length - 1), -1)
+        XCTAssertEqual(LSLocationFrameCount(bytes + 1, frame.length - 1), -1)
+
+        var decoded = LSLocationRecord()
+        XCTAssertFalse(LSLocationFrameRecordAt(bytes, frame.length, 1, &decoded))
+
+        // The member table ignores it as a whole
+        XCTAssertEqual(MemberTable().apply(frame.subdataWithRange(NSRange(location: 0, length: frame.length - 1))), [])
+    }
+
+    func fields(userID: String, modified: Int64) -> [String: AnyObject] {
+        return ["userID": userID, "location": ["lat": 1.0, "lon": 1.0], "_modified": NSNumber(longLong: modified)]
+    }
+
+    func testAmbiguousKeysAreIgnored() {
+
+        // Two user IDs with the same FNV-1a hash
+        XCTAssertEqual(LSLocationFrameUserKey("user449599"), LSLocationFrameUserKey("user612382"))
+
+        let members = MemberTable()
+        let first = members.load(fields("user449599", modified: 0))
+        let second = members.load(fields("user612382", modified: 0))
+        let dave = members.load(fields("dave", modified: 0))
+
+        let frame = encode([
+            record("user449599", latitude: 10, longitude: 20, timestamp: 2000),
+            record("user612382", latitude: 10, longitude: 20, timestamp: 2000),
+            record("dave", latitude: 10, longitude: 20, timestamp: 2000),
+            record("eve", latitude: 10, longitude: 20, timestamp: 2000)
+        ])
+
+        // Neither member sharing the key moves, nor the one not in the table
+        XCTAssertEqual(members.apply(frame), [dave])
+        XCTAssertEqual(members.coordinate(first).latitude, 1)
+        XCTAssertEqual(members.coordinate(second).latitude, 1)
+        XCTAssertEqualWithAccuracy(members.coordinate(dave).latitude, 10, accuracy: 1e-5)
+        XCTAssertEqualWithAccuracy(members.coordinate(dave).longitude, 20, accuracy: 1e-5)
+    }
+
+    func testStaleRecordsAreIgnored() {
+
+        let members = MemberTable()
+        let alice = members.load(fields("alice", modified: 2000))
+        let bob = members.load(fields("bob", modified: 2000))
+
+        // No newer than the saved object, as a push arriving after the fetch
+        let stale = encode([record("alice", latitude: 10, timestamp: 1990), record("bob", latitude: 10, timestamp: 2000)])
+        XCTAssertEqual(members.apply(stale), [])
+        XCTAssertEqual(members.coordinate(alice).latitude, 1)
+        XCTAssertEqual(members.coordinate(bob).latitude, 1)
+
+        let fresh = encode([record("alice", latitude: 10, timestamp: 2010), record("bob", latitude: 10, timestamp: 1000)])
+        XCTAssertEqual(members.apply(fresh), [alice])
+        XCTAssertEqual(LSMemberTableTimestamps(members.ref)[alice], 2010)
+
+        // The same frame again moves nobody
+        XCTAssertEqual(members.apply(fresh), [])
+
+        // Nor does it take back a member the table moved since
+        members.setCoordinate(bob, coordinate: CLLocationCoordinate2DMake(5, 5), timestamp: 3000)
+        XCTAssertEqual(members.apply(encode([record("bob", latitude: 10, timestamp: 2500)])), [])
+        XCTAssertEqual(members.coordinate(bob).latitude, 5)
+    }
+}
@@ -0,0 +1,10 @@
+//
+//  LocationSharingTests-Bridging-Header.h
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+// zlib inflates what LSDeflater compressed, the app itself only deflates
+#include <zlib.h>
@@ -0,0 +1,151 @@
+//
+//  LocationStreamTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import CoreLocation
+import XCTest
+@testable import LocationSharing
+
+class LocationStreamTests: XCTestCase {
+
+    // MARK: - Codec
+
+    func decode(bytes: [UInt8], maxPacketSize: Int = 1 << 20) -> (packets: [LSMQTTPacket], failed: Bool) {
+
+        let decoder = LSMQTTDecoderCreate(maxPacketSize)
+        defer { LSMQTTDecoderDestroy(decoder) }
+
+        LSMQTTDecoderFeed(decoder, bytes, bytes.count)
+
+        var packets = [LSMQTTPacket]()
+        var packet = LSMQTTPacket()
+
+        while LSMQTTDecoderNext(decoder, &packet) {
+            packets.append(packet)
+        }
+
+        return (packets: packets, failed: LSMQTTDecoderFailed(decoder))
+    }
+
+    func testPublishRoundTrip() {
+
+        let payload: [UInt8] = [1, 2, 3, 4, 5]
+
+        let size = LSMQTTEncodePublish("members/a", 7, 1, false, payload, payload.count, nil, 0)
+        XCTAssertGreaterThan(size, 0)
+
+        var packet = [UInt8](count: size, repeatedValue: 0)
+        XCTAssertEqual(LSMQTTEncodePublish("members/a", 7, 1, false, payload, payload.count, &packet, size), size)
+
+        let decoder = LSMQTTDecoderCreate(1 << 20)
+        defer { LSMQTTDecoderDestroy(decoder) }
+
+        // A byte at a time, as a slow socket would hand them over
+        var decoded = LSMQTTPacket()
+
+        for (index, byte) in packet.enumerate() {
+            LSMQTTDecoderFeed(decoder, [byte], 1)
+            XCTAssertEqual(LSMQTTDecoderNext(decoder, &decoded), index == packet.count - 1)
+        }
+
+        XCTAssertEqual(UInt32(decoded.type), LSMQTTPublish.rawValue)
+        XCTAssertEqual(decoded.qos, 1)
+        XCTAssertEqual(decoded.packetID, 7)
+        XCTAssertEqual(NSString(bytes: decoded.topic, length: decoded.topicLength, encoding: NSUTF8StringEncoding), "members/a")
+        XCTAssertEqual(Array(UnsafeBufferPointer(start: decoded.payload, count: decoded.payloadLength)), payload)
+    }
+
+    func testConnectAndSubscribeDecode() {
+
+        var bytes = [UInt8]()
+
+        for encode in [{ LSMQTTEncodeConnect("client", nil, nil, 60, true, $0, $1) }, { LSMQTTEncodeSubscribe(3, "members/a", 1, $0, $1) }] as [(UnsafeMutablePointer<UInt8>, Int) -> Int] {
+            let size = encode(nil, 0)
+            var packet = [UInt8](count: size, repeatedValue: 0)
+            encode(&packet, size)
+            bytes.appendContentsOf(packet)
+        }
+
+        let result = decode(bytes)
+
+        XCTAssertFalse(result.failed)
+        XCTAssertEqual(result.packets.map { UInt32($0.type) }, [LSMQTTConnect.rawValue, LSMQTTSubscribe.rawValue])
+        XCTAssertEqual(result.packets.last?.packetID, 3)
+    }
+
+    func testOversizedPacketFails() {
+
+        let payload = [UInt8](count: 100, repeatedValue: 0)
+
+        let size = LSMQTTEncodePublish("members/a", 0, 0, false, payload, payload.count, nil, 0)
+        var packet = [UInt8](count: size, repeatedValue: 0)
+        LSMQTTEncodePublish("members/a", 0, 0, false, payload, payload.count, &packet, size)
+
+        let result = decode(packet, maxPacketSize: 16)
+
+        XCTAssertTrue(result.packets.isEmpty)
+        XCTAssertTrue(result.failed)
+    }
+
+    // MARK: - Stream
+
+    func testStreamAppliesPushedFrames() {
+
+        let members = MemberTable()
+
+        let object = KiiObject(URI: "kiicloud://groups/group/buckets/locations/objects/alice")!
+        object.setObject("alice", forKey: "userID")
+        object.setGeoPoint(KiiGeoPoint(latitude: 35.0, andLongitude: 139.0), forKey: "location")
+        members.load([object])
+
+        let location = CLLocation(coordinate: CLLocationCoordinate2DMake(35.5, 139.5), altitude: 0, horizontalAccuracy: 5, verticalAccuracy: -1, course: 90, speed: 1, timestamp: NSDate())
+        let frame = LocationStream.frameOf([LocationStream.recordOf("alice", location: location)])!
+
+        let message = try! NSJSONSerialization.dataWithJSONObject(["f": frame.base64EncodedStringWithOptions([])], options: [])
+
+        guard let broker = LoopbackBroker(topic: "installation/alice") else {
+            XCTFail("No loopback socket")
+            return
+        }
+
+        broker.messages = [message]
+        broker.start()
+
+        let stream = LocationStream(topic: KiiGroup(ID: "group").topicWithName("locations"), members: members)
+
+        let available = expectationWithDescription("available")
+        let updated = expectationWithDescription("updated")
+
+        stream.onAvailabilityChange = { (isAvailable) in
+            if isAvailable {
+                available.fulfill()
+            }
+        }
+
+        stream.onUpdate = { (rows) in
+            XCTAssertEqual(rows, [members.row("alice")])
+            updated.fulfill()
+        }
+
+        stream.start(LocationStream.Endpoint(host: "127.0.0.1", port: broker.port, secure: false, clientID: "alice", username: nil, password: nil, topic: broker.topic))
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+
+        XCTAssertTrue(stream.isAvailable)
+
+        let coordinate = members.coordinate(members.row("alice"))
+        XCTAssertEqualWithAccuracy(coordinate.latitude, 35.5, accuracy: 1e-5)
+        XCTAssertEqualWithAccuracy(coordinate.longitude, 139.5, accuracy: 1e-5)
+
+        XCTAssertEqual(broker.received.prefix(2).map { UInt32($0) }, [LSMQTTConnect.rawValue, LSMQTTSubscribe.rawValue])
+
+        stream.stop()
+        broker.stop()
+
+        XCTAssertFalse(stream.isAvailable)
+    }
+}
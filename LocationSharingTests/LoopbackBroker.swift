@@ -0,0 +1,198 @@
+//
+//  LoopbackBroker.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import Foundation
+@testable import LocationSharing
+
+// Just enough of an MQTT broker on 127.0.0.1 to hold one LocationStream
+// connection: CONNECT is accepted, SUBSCRIBE is granted QoS 1 and answered
+// with every message in messages, published on topic. The packet types the
+// client sent are recorded.
+class LoopbackBroker {
+
+    let port: Int
+
+    let topic: String
+
+    // Payloads published to the client once it has subscribed
+    var messages = [NSData]()
+
+    private let listener: Int32
+    private let queue = dispatch_queue_create("LocationSharingTests.LoopbackBroker", nil)
+    private let lock = NSLock()
+    private var client: Int32 = -1
+    private var stopped = false
+    private var types = [UInt8]()
+
+    var received: [UInt8] {
+        lock.lock()
+        defer { lock.unlock() }
+        return types
+    }
+
+    init?(topic: String) {
+
+        self.topic = topic
+
+        listener = socket(AF_INET, SOCK_STREAM, 0)
+
+        if listener < 0 {
+            return nil
+        }
+
+        var address = sockaddr_in()
+        address.sin_len = UInt8(sizeofValue(address))
+        address.sin_family = sa_family_t(AF_INET)
+        address.sin_addr.s_addr = inet_addr("127.0.0.1")
+        address.sin_port = 0
+
+        var length = socklen_t(sizeofValue(address))
+
+        // Port 0, the system picks a free one
+        let bound = withUnsafeMutablePointer(&address) { (pointer) -> Bool in
+            let socketAddress = UnsafeMutablePointer<sockaddr>(pointer)
+            return bind(listener, socketAddress, length) == 0 && listen(listener, 1) == 0 && getsockname(listener, socketAddress, &length) == 0
+        }
+
+        if !bound {
+            Darwin.close(listener)
+            return nil
+        }
+
+        port = Int(UInt16(bigEndian: address.sin_port))
+    }
+
+    deinit {
+        stop()
+    }
+
+    // Serves one connection on a queue of its own
+    func start() {
+
+        dispatch_async(queue) {
+
+            let client = accept(self.listener, nil, nil)
+
+            if client < 0 {
+                return
+            }
+
+            self.lock.lock()
+            self.client = client
+            self.lock.unlock()
+
+            let decoder = LSMQTTDecoderCreate(1 << 20)
+
+            defer {
+                LSMQTTDecoderDestroy(decoder)
+                self.lock.lock()
+                self.client = -1
+                self.lock.unlock()
+                Darwin.close(client)
+            }
+
+            var buffer = [UInt8](count: 4096, repeatedValue: 0)
+
+            while true {
+
+                let count = Darwin.read(client, &buffer, buffer.count)
+
+                if count <= 0 {
+                    return
+                }
+
+                LSMQTTDecoderFeed(decoder, buffer, count)
+
+                var packet = LSMQTTPacket()
+
+                while LSMQTTDecoderNext(decoder, &packet) {
+
+                    self.lock.lock()
+                    self.types.append(packet.type)
+                    self.lock.unlock()
+
+                    switch UInt32(packet.type) {
+
+                    case LSMQTTConnect.rawValue:
+                        // Accepted, no session present
+                        self.send(client, bytes: [0x20, 0x02, 0x00, 0x00])
+
+                    case LSMQTTSubscribe.rawValue:
+                        self.send(client, bytes: [0x90, 0x03, UInt8(packet.packetID >> 8), UInt8(packet.packetID & 0xFF), 0x01])
+                        for (index, message) in self.messages.enumerate() {
+                            self.publish(client, message: message, packetID: UInt16(index + 1))
+                        }
+
+                    case LSMQTTPingReq.rawValue:
+                        self.send(client, bytes: [0xD0, 0x00])
+
+                    case LSMQTTDisconnect.rawValue:
+                        return
+
+                    default:
+                        break
+                    }
+                }
+
+                if LSMQTTDecoderFailed(decoder) {
+                    return
+                }
+            }
+        }
+    }
+
+    func stop() {
+
+        lock.lock()
+        let client = self.client
+        let stopped = self.stopped
+        self.client = -1
+        self.stopped = true
+        lock.unlock()
+
+        if stopped {
+            return
+        }
+
+        if client >= 0 {
+            shutdown(client, SHUT_RDWR)
+        }
+
+        shutdown(listener, SHUT_RDWR)
+        Darwin.close(listener)
+    }
+
+    private func publish(client: Int32, message: NSData, packetID: UInt16) {
+
+        let payload = UnsafePointer<UInt8>(message.bytes)
+
+        let size = LSMQTTEncodePublish(topic, packetID, 1, false, payload, message.length, nil, 0)
+
+        var packet = [UInt8](count: size, repeatedValue: 0)
+
+        LSMQTTEncodePublish(topic, packetID, 1, false, payload, message.length, &packet, size)
+
+        send(client, bytes: packet)
+    }
+
+    private func send(client: Int32, bytes: [UInt8]) {
+
+        var sent = 0
+
+        while sent < bytes.count {
+
+            let written = bytes.withUnsafeBufferPointer { Darwin.write(client, $0.baseAddress + sent, bytes.count - sent) }
+
+            if written <= 0 {
+                return
+            }
+
+            sent += written
+        }
+    }
+}
@@ -0,0 +1,103 @@
+//
+//  QueryPageCursorTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import XCTest
+@testable import LocationSharing
+
+class QueryPageCursorTests: XCTestCase {
+
+    var transport: Transport!
+
+    let pages = 6
+
+    override func setUp() {
+        super.setUp()
+        StubURLProtocol.reset()
+        transport = Transport(configuration: StubURLProtocol.configuration())
+        transport.app = Transport.App(id: "app", key: "key", baseURL: NSURL(string: "https://stub.example/api")!)
+
+        let pages = self.pages
+
+        // Page n holds member n and the key of page n + 1, the last has none
+        StubURLProtocol.handler = { (request) in
+
+            let query = (try? NSJSONSerialization.JSONObjectWithData(request.body, options: [])) as? [String: AnyObject]
+            let page = Int(query?["paginationKey"] as? String ?? "0") ?? 0
+
+            var body = "{\"results\":[{\"userID\":\"user\(page)\",\"location\":{\"_type\":\"point\",\"lat\":35.6,\"lon\":139.7},\"_modified\":\(1473206400000 + page)}]"
+            if page + 1 < pages {
+                body += ",\"nextPaginationKey\":\"\(page + 1)\""
+            }
+            body += "}"
+
+            return StubURLProtocol.Response(status: 200, headers: ["Content-Type": "application/json"], body: body.dataUsingEncoding(NSUTF8StringEncoding)!)
+        }
+    }
+
+    override func tearDown() {
+        StubURLProtocol.reset()
+        super.tearDown()
+    }
+
+    func testWalksEveryPage() {
+
+        let cursor = QueryPageCursor(path: "groups/group/buckets/locations", transport: transport)
+
+        let members = MemberTable()
+        var count = 0
+
+        while let page = cursor.next() {
+            members.load(page)
+            count += 1
+        }
+
+        XCTAssertNil(cursor.error)
+        XCTAssertEqual(count, pages)
+        XCTAssertEqual(members.count, pages)
+    }
+
+    // Pages left in the window must not bring the process down when the
+    // cursor goes away
+    func testCancelledMidStream() {
+
+        var cursor: QueryPageCursor? = QueryPageCursor(path: "groups/group/buckets/locations", transport: transport, window: 2)
+
+        XCTAssertNotNil(cursor!.next())
+
+        // The window fills up behind the page taken
+        NSThread.sleepForTimeInterval(0.2)
+
+        cursor!.cancel()
+        cursor = nil
+
+        // The fetcher stops and lets go of the state it shares
+        NSThread.sleepForTimeInterval(0.2)
+
+        let sent = StubURLProtocol.requests.count
+
+        XCTAssertLessThan(sent, pages)
+
+        NSThread.sleepForTimeInterval(0.2)
+
+        XCTAssertEqual(StubURLProtocol.requests.count, sent)
+    }
+
+    func testCancelBeforeTheFirstPage() {
+
+        let cursor = QueryPageCursor(path: "groups/group/buckets/locations", transport: transport, window: 3)
+
+        cursor.cancel()
+
+        // At most the page in flight, then nil for good
+        while cursor.next() != nil {
+        }
+
+        XCTAssertNil(cursor.next())
+        XCTAssertLessThanOrEqual(StubURLProtocol.requests.count, 1)
+    }
+}
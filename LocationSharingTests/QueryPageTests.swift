@@ -0,0 +1,141 @@
+//
+//  QueryPageTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import XCTest
+@testable import LocationSharing
+
+class QueryPageTests: XCTestCase {
+
+    let basic = "{\"results\":[{\"userID\":\"alice\",\"location\":{\"_type\":\"point\",\"lat\":35.6,\"lon\":139.7},\"_modified\":1473206400000},{\"userID\":\"bob\",\"location\":{\"_type\":\"point\",\"lat\":-33.86,\"lon\":151.21},\"_modified\":1473206400005}],\"nextPaginationKey\":\"200/2\"}"
+
+    // Fed chunk bytes at a time, all at once when chunk is 0
+    func parse(json: String, chunk: Int = 0) -> (page: QueryPage, valid: Bool) {
+
+        let page = QueryPage()
+        let data = json.dataUsingEncoding(NSUTF8StringEncoding)!
+        let step = chunk > 0 ? chunk : max(data.length, 1)
+
+        var offset = 0
+        repeat {
+            let length = min(step, data.length - offset)
+            LSQueryPageFeed(page.ref, UnsafePointer<UInt8>(data.bytes) + offset, length)
+            offset += length
+        } while offset < data.length
+
+        return (page: page, valid: LSQueryPageFinish(page.ref))
+    }
+
+    func userIDs(members: MemberTable) -> [String] {
+        return (0 ..< members.count).map { members.userID($0) }
+    }
+
+    func testPage() {
+
+        let parsed = parse(basic)
+        XCTAssertTrue(parsed.valid)
+        XCTAssertEqual(parsed.page.nextPaginationKey, "200/2")
+
+        let members = MemberTable()
+        XCTAssertEqual(members.load(parsed.page), [0, 1])
+        XCTAssertEqual(userIDs(members), ["alice", "bob"])
+        XCTAssertEqualWithAccuracy(members.coordinate(1).latitude, -33.86, accuracy: 1e-9)
+        XCTAssertEqualWithAccuracy(members.coordinate(1).longitude, 151.21, accuracy: 1e-9)
+        XCTAssertEqual(LSQueryPageMaxModified(parsed.page.ref), 1473206400005)
+    }
+
+    // The index is built 64 bytes at a time, any split must read the same
+    func testChunkBoundaries() {
+
+        for chunk in [1, 3, 63, 64, 65, 127] {
+
+            let parsed = parse(basic, chunk: chunk)
+            XCTAssertTrue(parsed.valid, "chunk \(chunk)")
+            XCTAssertEqual(parsed.page.nextPaginationKey, "200/2", "chunk \(chunk)")
+
+            let members = MemberTable()
+            members.load(parsed.page)
+            XCTAssertEqual(userIDs(members), ["alice", "bob"], "chunk \(chunk)")
+        }
+    }
+
+    func testEscapes() {
+
+        // Quotes, brackets and backslashes inside strings are not structure
+        let json = "{\"results\":[{\"note\":\"say \\\"}]\\\" \\\\\",\"userID\":\"a\\\"b\\\\\",\"location\":{\"lat\":1.5,\"lon\":2.5},\"_modified\":7}]}"
+
+        for chunk in [0, 1, 2, 5, 64] {
+
+            let parsed = parse(json, chunk: chunk)
+            XCTAssertTrue(parsed.valid, "chunk \(chunk)")
+
+            let members = MemberTable()
+            members.load(parsed.page)
+            XCTAssertEqual(userIDs(members), ["a\"b\\"], "chunk \(chunk)")
+        }
+    }
+
+    // An escape whose backslash ends one block and whose quote starts the next
+    func testEscapeAcrossBlocks() {
+
+        for padding in 30 ..< 140 {
+
+            let json = "{\"results\":[{\"userID\":\"" + String(count: padding, repeatedValue: Character("x")) + "\\\"q\\\\\",\"location\":{\"lat\":1,\"lon\":2},\"_modified\":3}],\"nextPaginationKey\":\"k\(padding)\"}"
+
+            for chunk in [0, 1, 64] {
+
+                let parsed = parse(json, chunk: chunk)
+                XCTAssertTrue(parsed.valid, "padding \(padding) chunk \(chunk)")
+                XCTAssertEqual(parsed.page.nextPaginationKey, "k\(padding)", "padding \(padding) chunk \(chunk)")
+
+                let members = MemberTable()
+                members.load(parsed.page)
+                XCTAssertEqual(userIDs(members), [String(count: padding, repeatedValue: Character("x")) + "\"q\\"], "padding \(padding) chunk \(chunk)")
+            }
+        }
+    }
+
+    func testSkipsNestedValues() {
+
+        // Other fields are jumped over whatever they hold, results without
+        // a userID or a location are left out
+        let json = "{\"results\":[{\"extra\":{\"a\":[1,{\"b\":[[],{}]}],\"c\":\"]}\"},\"userID\":\"carol\",\"tags\":[[1,2],[3]],\"location\":{\"_type\":\"point\",\"lat\":10,\"lon\":20},\"_modified\":9},{\"userID\":\"nolocation\",\"_modified\":1},{\"location\":{\"lat\":1,\"lon\":1}}],\"queryDescription\":\"WHERE ( 1 = 1 )\"}"
+
+        for chunk in [0, 7] {
+
+            let parsed = parse(json, chunk: chunk)
+            XCTAssertTrue(parsed.valid)
+            XCTAssertNil(parsed.page.nextPaginationKey)
+
+            let members = MemberTable()
+            XCTAssertEqual(members.load(parsed.page), [0])
+            XCTAssertEqual(userIDs(members), ["carol"])
+            XCTAssertEqual(LSQueryPageMaxModified(parsed.page.ref), 9)
+        }
+    }
+
+    func testPaginationKey() {
+
+        // Found before the results as well as after them
+        let first = parse("{\"nextPaginationKey\":\"k\",\"results\":[]}")
+        XCTAssertTrue(first.valid)
+        XCTAssertEqual(first.page.nextPaginationKey, "k")
+
+        // The last page has none
+        let last = parse("{\"results\":[]}")
+        XCTAssertTrue(last.valid)
+        XCTAssertNil(last.page.nextPaginationKey)
+        XCTAssertEqual(MemberTable().load(last.page), [])
+    }
+
+    func testMalformed() {
+
+        for json in ["", "hello", "[1,2]", "{\"results\":[{\"userID\":\"a\"", "{\"results\":[{\"userID\":\"a}]}", "{\"results\":{}}", "{\"nextPaginationKey\":\"k\"}"] {
+            XCTAssertFalse(parse(json).valid, json)
+        }
+    }
+}
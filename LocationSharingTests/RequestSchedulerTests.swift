@@ -0,0 +1,97 @@
+//
+//  RequestSchedulerTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import XCTest
+@testable import LocationSharing
+
+class RequestSchedulerTests: XCTestCase {
+
+    func testFullQueueHoldsTheSubmitter() {
+
+        // One slot for bulk requests, the other is kept for interactive ones
+        let scheduler = RequestScheduler(maxRunning: 2, queueLimit: 2)
+
+        let total = 6
+        let gate = dispatch_semaphore_create(0)
+        let lock = NSLock()
+        var submitted = 0
+        var ran = 0
+
+        let done = expectationWithDescription("ran")
+
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)) {
+            for _ in 0 ..< total {
+                scheduler.submit(.Bulk) {
+                    dispatch_semaphore_wait(gate, DISPATCH_TIME_FOREVER)
+                    lock.lock()
+                    ran += 1
+                    if ran == total {
+                        done.fulfill()
+                    }
+                    lock.unlock()
+                }
+                lock.lock()
+                submitted += 1
+                lock.unlock()
+            }
+        }
+
+        NSThread.sleepForTimeInterval(0.2)
+
+        // One running and two queued, the fourth waits to be submitted
+        lock.lock()
+        XCTAssertEqual(submitted, 3)
+        lock.unlock()
+        XCTAssertEqual(scheduler.pending(.Bulk), 2)
+
+        for _ in 0 ..< total {
+            dispatch_semaphore_signal(gate)
+        }
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+
+        XCTAssertEqual(ran, total)
+        XCTAssertEqual(scheduler.pending(.Bulk), 0)
+    }
+
+    func testSubmitFromRunningRequestDoesNotWait() {
+
+        // The only slot is held by the request that submits
+        let scheduler = RequestScheduler(maxRunning: 1, queueLimit: 1)
+
+        let total = 4
+        let lock = NSLock()
+        var ran = 0
+
+        let done = expectationWithDescription("ran")
+
+        let count = {
+            lock.lock()
+            ran += 1
+            if ran == total + 1 {
+                done.fulfill()
+            }
+            lock.unlock()
+        }
+
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)) {
+            scheduler.submit(.Bulk) {
+                // All but the first are set aside, the queue holds one
+                for _ in 0 ..< total {
+                    scheduler.submit(.Bulk, block: count)
+                }
+                XCTAssertEqual(scheduler.pending(.Bulk), total)
+                count()
+            }
+        }
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+
+        XCTAssertEqual(scheduler.pending(.Bulk), 0)
+    }
+}
@@ -0,0 +1,134 @@
+//
+//  StubURLProtocol.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import Foundation
+
+// A local stand-in for Kii Cloud: every request of a session made with
+// configuration() is answered in process by handler instead of going out,
+// and recorded with its body so tests can check what was sent.
+//
+// The handler runs off the loading thread, so a handler that blocks holds
+// only its own request, like a slow server would.
+class StubURLProtocol: NSURLProtocol {
+
+    struct Response {
+        let status: Int
+        let headers: [String: String]
+        let body: NSData
+
+        init(status: Int, headers: [String: String] = [:], body: NSData = NSData()) {
+            self.status = status
+            self.headers = headers
+            self.body = body
+        }
+    }
+
+    struct Request {
+        let request: NSURLRequest
+        let body: NSData
+    }
+
+    static var handler: ((Request) -> Response)?
+
+    private static let lock = NSLock()
+    private static var recorded = [Request]()
+
+    class var requests: [Request] {
+        lock.lock()
+        defer { lock.unlock() }
+        return recorded
+    }
+
+    class func configuration() -> NSURLSessionConfiguration {
+        let configuration = NSURLSessionConfiguration.ephemeralSessionConfiguration()
+        configuration.protocolClasses = [StubURLProtocol.self]
+        return configuration
+    }
+
+    class func reset() {
+        lock.lock()
+        recorded.removeAll()
+        handler = nil
+        lock.unlock()
+    }
+
+    override class func canInitWithRequest(request: NSURLRequest) -> Bool {
+        return true
+    }
+
+    override class func canonicalRequestForRequest(request: NSURLRequest) -> NSURLRequest {
+        return request
+    }
+
+    private var stopped = false
+
+    override func startLoading() {
+
+        let sent = Request(request: request, body: StubURLProtocol.bodyOf(request))
+
+        StubURLProtocol.lock.lock()
+        StubURLProtocol.recorded.append(sent)
+        let handler = StubURLProtocol.handler
+        StubURLProtocol.lock.unlock()
+
+        // The client is told on the thread that started loading
+        let runLoop = CFRunLoopGetCurrent()
+
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)) {
+
+            let answer = handler?(sent) ?? Response(status: 404)
+
+            CFRunLoopPerformBlock(runLoop, kCFRunLoopCommonModes) {
+
+                if self.stopped {
+                    return
+                }
+
+                let response = NSHTTPURLResponse(URL: self.request.URL!, statusCode: answer.status, HTTPVersion: "HTTP/1.1", headerFields: answer.headers)!
+
+                self.client?.URLProtocol(self, didReceiveResponse: response, cacheStoragePolicy: .NotAllowed)
+                self.client?.URLProtocol(self, didLoadData: answer.body)
+                self.client?.URLProtocolDidFinishLoading(self)
+            }
+
+            CFRunLoopWakeUp(runLoop)
+        }
+    }
+
+    override func stopLoading() {
+        stopped = true
+    }
+
+    // The session hands the body over as a stream
+    private class func bodyOf(request: NSURLRequest) -> NSData {
+
+        if let body = request.HTTPBody {
+            return body
+        }
+
+        let body = NSMutableData()
+
+        guard let stream = request.HTTPBodyStream else {
+            return body
+        }
+
+        var buffer = [UInt8](count: 4096, repeatedValue: 0)
+
+        stream.open()
+        while true {
+            let length = stream.read(&buffer, maxLength: buffer.count)
+            if length <= 0 {
+                break
+            }
+            body.appendBytes(buffer, length: length)
+        }
+        stream.close()
+
+        return body
+    }
+}
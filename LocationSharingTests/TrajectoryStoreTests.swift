@@ -0,0 +1,166 @@
+//
+//  TrajectoryStoreTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import XCTest
+@testable import LocationSharing
+
+class TrajectoryStoreTests: XCTestCase {
+
+    var store: LSTrajectoryStoreRef!
+
+    override func setUp() {
+        super.setUp()
+        store = LSTrajectoryStoreCreate()
+    }
+
+    override func tearDown() {
+        LSTrajectoryStoreDestroy(store)
+        super.tearDown()
+    }
+
+    // A walk at 1 Hz, long enough to fill two chunks and start a third
+    func walk(store: LSTrajectoryStoreRef, user: UInt32 = 0, fixes: Int = 3000) {
+        for i in 0 ..< fixes {
+            XCTAssertTrue(LSTrajectoryStoreAppend(store, user, Int64(i + 1) * 1000, 35.6 + Double(i) * 1e-5, 139.7 - Double(i) * 1e-5))
+        }
+    }
+
+    func query(store: LSTrajectoryStoreRef, user: UInt32 = 0, from: Int64, to: Int64) -> [(timestamp: Int64, latitude: Double, longitude: Double)] {
+
+        let capacity = LSTrajectoryStoreQuery(store, user, from, to, nil, nil, nil, 0)
+
+        var timestamps = [Int64](count: capacity, repeatedValue: 0)
+        var latitudes = [Double](count: capacity, repeatedValue: 0)
+        var longitudes = [Double](count: capacity, repeatedValue: 0)
+
+        XCTAssertEqual(LSTrajectoryStoreQuery(store, user, from, to, &timestamps, &latitudes, &longitudes, capacity), capacity)
+
+        return (0 ..< capacity).map { (timestamp: timestamps[$0], latitude: latitudes[$0], longitude: longitudes[$0]) }
+    }
+
+    func testRoundTrip() {
+
+        walk(store)
+        XCTAssertEqual(LSTrajectoryStoreCount(store, 0), 3000)
+        XCTAssertEqual(LSTrajectoryStoreCount(store, 1), 0)
+
+        let fixes = query(store, from: 0, to: Int64.max)
+        XCTAssertEqual(fixes.count, 3000)
+
+        // Kept to the micro-degree
+        for (i, fix) in fixes.enumerate() {
+            XCTAssertEqual(fix.timestamp, Int64(i + 1) * 1000)
+            XCTAssertEqualWithAccuracy(fix.latitude, 35.6 + Double(i) * 1e-5, accuracy: 1e-6)
+            XCTAssertEqualWithAccuracy(fix.longitude, 139.7 - Double(i) * 1e-5, accuracy: 1e-6)
+        }
+
+        // No newer than the last fix, so fetching the same object again adds nothing
+        XCTAssertFalse(LSTrajectoryStoreAppend(store, 0, 3000 * 1000, 0, 0))
+        XCTAssertEqual(LSTrajectoryStoreCount(store, 0), 3000)
+    }
+
+    func testRangeQuery() {
+
+        walk(store)
+
+        // Starts between two fixes, ends on one, within a chunk
+        let window = query(store, from: 1020500, to: 1050000)
+        XCTAssertEqual(window.map { $0.timestamp }, (1021 ... 1050).map { Int64($0) * 1000 })
+        XCTAssertEqualWithAccuracy(window[0].latitude, 35.6102, accuracy: 1e-6)
+
+        // Across the chunk boundary after 1024 fixes
+        XCTAssertEqual(query(store, from: 1000000, to: 1100000).map { $0.timestamp }, (1000 ... 1100).map { Int64($0) * 1000 })
+
+        // Around every index entry of the first chunk
+        for entry in 1 ..< 32 {
+            let from = Int64(entry * 32) * 1000
+            XCTAssertEqual(query(store, from: from, to: from + 2000).map { $0.timestamp }, [from, from + 1000, from + 2000])
+        }
+
+        XCTAssertEqual(query(store, from: 2000000, to: 1000000).count, 0)
+        XCTAssertEqual(query(store, from: 4000000, to: 5000000).count, 0)
+        XCTAssertEqual(query(store, user: 7, from: 0, to: Int64.max).count, 0)
+
+        // Fewer than the window holds are written, all of them are counted
+        var timestamps = [Int64](count: 2, repeatedValue: 0)
+        var latitudes = [Double](count: 2, repeatedValue: 0)
+        var longitudes = [Double](count: 2, repeatedValue: 0)
+        XCTAssertEqual(LSTrajectoryStoreQuery(store, 0, 1000, 10000, &timestamps, &latitudes, &longitudes, 2), 10)
+        XCTAssertEqual(timestamps, [1000, 2000])
+    }
+
+    func testSerialize() {
+
+        walk(store)
+        walk(store, user: 2, fixes: 10)
+
+        let size = LSTrajectoryStoreSerialize(store, nil, 0)
+        var bytes = [UInt8](count: size, repeatedValue: 0)
+        XCTAssertEqual(LSTrajectoryStoreSerialize(store, &bytes, size), size)
+
+        let copy = LSTrajectoryStoreCreate()
+        defer {
+            LSTrajectoryStoreDestroy(copy)
+        }
+
+        XCTAssertTrue(LSTrajectoryStoreDeserialize(copy, bytes, bytes.count))
+        XCTAssertEqual(LSTrajectoryStoreCount(copy, 0), 3000)
+        XCTAssertEqual(LSTrajectoryStoreCount(copy, 1), 0)
+        XCTAssertEqual(LSTrajectoryStoreCount(copy, 2), 10)
+
+        // The rebuilt index answers the same windows
+        XCTAssertEqual(query(copy, from: 1020500, to: 1050000).map { $0.timestamp }, query(store, from: 1020500, to: 1050000).map { $0.timestamp })
+
+        // Truncated or foreign bytes leave the store empty
+        XCTAssertFalse(LSTrajectoryStoreDeserialize(copy, bytes, bytes.count - 1))
+        XCTAssertEqual(LSTrajectoryStoreCount(copy, 0), 0)
+        XCTAssertFalse(LSTrajectoryStoreDeserialize(copy, [UInt8]("LST2".utf8), 4))
+    }
+
+    func testTrim() {
+
+        walk(store)
+        walk(store, user: 2, fixes: 10)
+
+        LSTrajectoryStoreTrim(store, 2500000)
+
+        // Whole chunks only, the one holding the cutoff stays
+        XCTAssertEqual(LSTrajectoryStoreCount(store, 0), 3000 - 2048)
+        XCTAssertEqual(query(store, from: 0, to: Int64.max).first?.timestamp, 2049000)
+
+        // All older than the cutoff, the newest chunk stays and still
+        // rejects a fix fetched again
+        XCTAssertEqual(LSTrajectoryStoreCount(store, 2), 10)
+        XCTAssertFalse(LSTrajectoryStoreAppend(store, 2, 5000, 0, 0))
+    }
+
+    func testRemovedMemberLeavesNoHistory() {
+
+        let members = MemberTable()
+
+        let fields = { (modified: Int64) -> [String: AnyObject] in
+            return ["userID": "alice", "location": ["lat": 35.6, "lon": 139.7], "_modified": NSNumber(longLong: modified)]
+        }
+
+        members.load(fields(1000))
+        let row = members.load(fields(2000))
+        XCTAssertEqual(members.history(row, from: 0, to: Int64.max).map { $0.timestamp }, [1000, 2000])
+
+        let user = LSMemberTableUserIndices(members.ref)[row]
+        members.remove(row)
+        XCTAssertEqual(LSTrajectoryStoreCount(members.history, user), 0)
+
+        // Back in view, the member starts a new history
+        XCTAssertEqual(members.history(members.load(fields(3000)), from: 0, to: Int64.max).map { $0.timestamp }, [3000])
+
+        members.historyRetention = 1000
+        members.load(fields(4000))
+        members.trimHistory(4500)
+        XCTAssertEqual(LSTrajectoryStoreCount(members.history, user), 2)
+    }
+}
@@ -0,0 +1,261 @@
+//
+//  TransportTests.swift
+//  LocationSharingTests
+//
+//  Created by Qi (Alvin) Jing on 2016-09-07.
+//  Copyright © 2016 Qi (Alvin) Jing. All rights reserved.
+//
+
+import XCTest
+@testable import LocationSharing
+
+class TransportTests: XCTestCase {
+
+    var transport: Transport!
+
+    override func setUp() {
+        super.setUp()
+        StubURLProtocol.reset()
+        transport = Transport(configuration: StubURLProtocol.configuration())
+        transport.app = Transport.App(id: "app", key: "key", baseURL: NSURL(string: "https://stub.example/api")!)
+        transport.compressor = BodyCompressor()
+    }
+
+    override func tearDown() {
+        StubURLProtocol.reset()
+        super.tearDown()
+    }
+
+    // A body long enough to be compressed
+    func queryBody() -> NSData {
+        let query = ["bucketQuery": ["clause": ["type": "all"]], "bestEffortLimit": 100, "paginationKey": String(count: 200, repeatedValue: Character("k"))]
+        return try! NSJSONSerialization.dataWithJSONObject(query, options: [])
+    }
+
+    func post(path: String = "groups/group/buckets/locations/query") -> (data: NSData?, response: NSHTTPURLResponse?, error: NSError?) {
+
+        let request = transport.request(path, method: "POST", body: queryBody(), contentType: "application/json")!
+
+        let done = expectationWithDescription("response")
+
+        var result: (data: NSData?, response: NSHTTPURLResponse?, error: NSError?) = (nil, nil, nil)
+
+        transport.send(request) { (data, response, error) in
+            result = (data, response, error)
+            done.fulfill()
+        }
+
+        waitForExpectationsWithTimeout(5, handler: nil)
+
+        return result
+    }
+
+    func encodings() -> [String?] {
+        return StubURLProtocol.requests.map { $0.request.valueForHTTPHeaderField("Content-Encoding") }
+    }
+
+    func testBadRequestNamingTheEncodingFallsBack() {
+
+        StubURLProtocol.handler = { (request) in
+            if request.request.valueForHTTPHeaderField("Content-Encoding") != nil {
+                return StubURLProtocol.Response(status: 400, body: "{\"errorCode\":\"INVALID_INPUT_DATA\",\"message\":\"Unsupported Content-Encoding: gzip\"}".dataUsingEncoding(NSUTF8StringEncoding)!)
+            }
+            return StubURLProtocol.Response(status: 200)
+        }
+
+        XCTAssertEqual(post().response?.statusCode, 200)
+        XCTAssertEqual(post().response?.statusCode, 200)
+
+        // Sent plain again once, then plain from the start
+        XCTAssertEqual(encodings().map { $0 ?? "" }, ["gzip", "", ""])
+    }
+
+    func testUnsupportedMediaTypeFallsBack() {
+
+        StubURLProtocol.handler = { (request) in
+            if request.request.valueForHTTPHeaderField("Content-Encoding") != nil {
+                return StubURLProtocol.Response(status: 415)
+            }
+            return StubURLProtocol.Response(status: 200)
+        }
+
+        XCTAssertEqual(post().response?.statusCode, 200)
+        XCTAssertEqual(post().response?.statusCode, 200)
+
+        XCTAssertEqual(encodings().map { $0 ?? "" }, ["gzip", "", ""])
+
+        // The plain retry carries the same body
+        let bodies = StubURLProtocol.requests.map { $0.body }
+        XCTAssertEqual(bodies[1], queryBody())
+        XCTAssertEqual(bodies[2], queryBody())
+    }
+
+    func testOtherBadRequestIsReturned() {
+
+        StubURLProtocol.handler = { (request) in
+            return StubURLProtocol.Response(status: 400, body: "{\"errorCode\":\"QUERY_NOT_SUPPORTED\"}".dataUsingEncoding(NSUTF8StringEncoding)!)
+        }
+
+        XCTAssertEqual(post().response?.statusCode, 400)
+        XCTAssertEqual(post().response?.statusCode, 400)
+
+        // Not retried, and the host keeps getting compressed bodies
+        XCTAssertEqual(encodings().map { $0 ?? "" }, ["gzip", "gzip"])
+    }
+
+    func testNotModifiedAnswersFromCache() {
+
+        transport.cache = ResponseCache()
+
+        let object = "{\"userID\":\"user\",\"location\":{\"_type\":\"point\",\"lat\":35.6,\"lon\":139.7},\"_modified\":1473206400000}".dataUsingEncoding(NSUTF8StringEncoding)!
+
+        StubURLProtocol.handler = { (request) in
+            if request.request.valueForHTTPHeaderField("If-None-Match") == "\"1\"" {
+                return StubURLProtocol.Response(status: 304, headers: ["ETag": "\"1\""])
+            }
+            return StubURLProtocol.Response(status: 200, headers: ["ETag": "\"1\"", "Content-Type": "application/json"], body: object)
+        }
+
+        let get = { () -> (data: NSData?, response: NSHTTPURLResponse?) in
+
+            let request = self.transport.request("groups/group/buckets/locations/objects/object")!
+
+            let done = self.expectationWithDescription("response")
+
+            var result: (data: NSData?, response: NSHTTPURLResponse?) = (nil, nil)
+
+            self.transport.send(request) { (data, response, error) in
+                result = (data, response)
+                done.fulfill()
+            }
+
+            self.waitForExpectationsWithTimeout(5, handler: nil)
+
+            return result
+        }
+
+        let first = get()
+        XCTAssertEqual(first.response?.statusCode, 200)
+        XCTAssertEqual(first.data, object)
+
+        // Revalidated, the server sends no body and the cache supplies it
+        let second = get()
+        XCTAssertEqual(second.response?.statusCode, 200)
+        XCTAssertEqual(second.data, object)
+        XCTAssertEqual(transport.notModified, 1)
+
+        let tags = StubURLProtocol.requests.map { $0.request.valueForHTTPHeaderField("If-None-Match") ?? "" }
+        XCTAssertEqual(tags, ["", "\"1\""])
+    }
+
+    func testQueryIsNotRevalidated() {
+
+        transport.cache = ResponseCache()
+
+        StubURLProtocol.handler = { (request) in
+            return StubURLProtocol.Response(status: 200, headers: ["ETag": "\"1\""])
+        }
+
+        post()
+        post()
+
+        // A POST with If-None-Match would get 412
+        let tags = StubURLProtocol.requests.map { $0.request.valueForHTTPHeaderField("If-None-Match") ?? "" }
+        XCTAssertEqual(tags, ["", ""])
+        XCTAssertEqual(transport.cache?.count, 0)
+    }
+
+    func testInteractiveQueryOvertakesQueuedSaves() {
+
+        // One slot for bulk requests, the other is kept for interactive ones
+        let transport = Transport(configuration: StubURLProtocol.configuration(), maxPerHost: 2)
+        transport.app = self.transport.app
+
+        let gate = dispatch_semaphore_create(0)
+
+        // Saves hang until the gate opens, queries are answered right away
+        StubURLProtocol.handler = { (request) in
+            if request.request.URL?.path?.hasSuffix("/query") != true {
+                dispatch_semaphore_wait(gate, DISPATCH_TIME_FOREVER)
+            }
+            return StubURLProtocol.Response(status: 200)
+        }
+
+        let saves = 8
+        let lock = NSLock()
+        var saved = 0
+
+        let group = dispatch_group_create()
+
+        for i in 0 ..< saves {
+            let request = transport.request("groups/group/buckets/locations/objects/\(i)", method: "POST", body: queryBody(), contentType: "application/json")!
+            dispatch_group_enter(group)
+            transport.send(request, priority: .Bulk) { (data, response, error) in
+                lock.lock()
+                saved += 1
+                lock.unlock()
+                dispatch_group_leave(group)
+            }
+        }
+
+        NSThread.sleepForTimeInterval(0.2)
+
+        // One save on the wire, the others wait for its slot
+        XCTAssertEqual(transport.pending(.Bulk), saves - 1)
+
+        let request = transport.request("groups/group/buckets/locations/query", method: "POST", body: queryBody(), contentType: "application/vnd.kii.QueryRequest+json")!
+
+        let queried = expectationWithDescription("queried")
+
+        transport.send(request, priority: .Interactive) { (data, response, error) in
+            XCTAssertEqual(response?.statusCode, 200)
+            lock.lock()
+            XCTAssertEqual(saved, 0)
+            lock.unlock()
+            queried.fulfill()
+        }
+
+        waitForExpectationsWithTimeout(2, handler: nil)
+
+        for _ in 0 ..< saves {
+            dispatch_semaphore_signal(gate)
+        }
+
+        XCTAssertEqual(dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, Int64(5 * NSEC_PER_SEC))), 0)
+        XCTAssertEqual(saved, saves)
+    }
+
+    // Requests through the whole transport, compression and per host limit
+    // included, against the in process stand-in instead of the network
+    func testThroughputAgainstLocalStandIn() {
+
+        let page = NSMutableData()
+        page.appendData("{\"results\":[".dataUsingEncoding(NSUTF8StringEncoding)!)
+        for i in 0 ..< 100 {
+            let object = (i == 0 ? "" : ",") + "{\"userID\":\"user\(i)\",\"location\":{\"_type\":\"point\",\"lat\":35.6,\"lon\":139.7},\"_modified\":1473206400000}"
+            page.appendData(object.dataUsingEncoding(NSUTF8StringEncoding)!)
+        }
+        page.appendData("]}".dataUsingEncoding(NSUTF8StringEncoding)!)
+
+        StubURLProtocol.handler = { (request) in
+            return StubURLProtocol.Response(status: 200, headers: ["Content-Type": "application/json"], body: page)
+        }
+
+        let body = queryBody()
+
+        measureBlock {
+
+            let group = dispatch_group_create()
+
+            for _ in 0 ..< 200 {
+                let request = self.transport.request("groups/group/buckets/locations/query", method: "POST", body: body, contentType: "application/json")!
+                dispatch_group_enter(group)
+                self.transport.send(request) { (data, response, error) in
+                    dispatch_group_leave(group)
+                }
+            }
+
+            dispatch_group_wait(group, DISPATCH_TIME_FOREVER)
+        }
+    }
+}